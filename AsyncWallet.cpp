@@ -0,0 +1,124 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AsyncWallet.h"
+#include "ZRBitcoin.h"
+#include "TransactionManager.h"
+
+#include <iostream>
+
+
+const unsigned int AsyncWallet::WORKERS = 4;
+
+AsyncWallet * AsyncWallet::instance = 0;
+RsMutex AsyncWallet::creation_mutex( "async_wallet_creation_mutex" );
+
+
+AsyncWallet * AsyncWallet::Instance()
+{
+    RsStackMutex creationMutex( creation_mutex );
+    if( !AsyncWallet::instance ){
+        AsyncWallet::instance = new AsyncWallet();
+    }
+    return AsyncWallet::instance;
+}
+
+AsyncWallet::AsyncWallet() :
+    m_stopped( false )
+{
+}
+
+void AsyncWallet::submit( const WalletRequest & request )
+{
+    QMutexLocker lock( &m_mutex );
+    if( m_stopped ){
+        std::cerr << "Zero Reserve: Wallet stopped, dropping operation " << request.m_op << " for TX " << request.m_txId << std::endl;
+        return;
+    }
+    m_pending.push_back( request );
+    if( m_workers.empty() ){
+        for( unsigned int i = 0; i < WORKERS; i++ ){
+            Worker * worker = new Worker( this );
+            m_workers.push_back( worker );
+            worker->start();
+        }
+    }
+    m_submitted.wakeOne();
+}
+
+void AsyncWallet::stop()
+{
+    std::vector< Worker * > workers;
+    {
+        QMutexLocker lock( &m_mutex );
+        m_stopped = true;
+        workers.swap( m_workers );
+        m_submitted.wakeAll();
+    }
+    for( std::vector< Worker * >::iterator it = workers.begin(); it != workers.end(); it++ ){
+        (*it)->join();
+        delete *it;
+    }
+}
+
+void AsyncWallet::dispatch()
+{
+    std::list< WalletRequest > done;
+    {
+        QMutexLocker lock( &m_mutex );
+        done.swap( m_done );
+    }
+    for( std::list< WalletRequest >::const_iterator it = done.begin(); it != done.end(); it++ ){
+        TransactionManager::resume( *it );
+    }
+}
+
+void AsyncWallet::work()
+{
+    QMutexLocker lock( &m_mutex );
+    for( ;; ){
+        while( m_pending.empty() && !m_stopped ) m_submitted.wait( &m_mutex );
+        if( m_stopped ) return;
+        WalletRequest request = m_pending.front();
+        m_pending.pop_front();
+
+        lock.unlock();
+        execute( request );
+        lock.relock();
+        m_done.push_back( request );
+    }
+}
+
+void AsyncWallet::execute( WalletRequest & request )
+{
+    ZR::Bitcoin * bitcoin = ZR::Bitcoin::Instance();
+    switch( request.m_op ){
+    case WalletRequest::NEW_ADDRESS:
+        request.m_recvAddr = bitcoin->newAddress();
+        request.m_result = ( request.m_recvAddr.empty() )? ZR::ZR_FAILURE : ZR::ZR_SUCCESS;
+        break;
+    case WalletRequest::MK_RAW_TX:
+        request.m_result = bitcoin->mkRawTx( request.m_btcAmount, request.m_sendAddr, request.m_recvAddr, request.m_txHex, request.m_btcTxId );
+        break;
+    case WalletRequest::SEND_RAW:
+        request.m_result = bitcoin->sendRaw( request.m_txHex );
+        break;
+    }
+    if( request.m_result != ZR::ZR_SUCCESS ){
+        std::cerr << "Zero Reserve: Wallet operation " << request.m_op << " failed for TX " << request.m_txId << std::endl;
+    }
+}
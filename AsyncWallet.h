@@ -0,0 +1,111 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASYNCWALLET_H
+#define ASYNCWALLET_H
+
+#include "zrtypes.h"
+
+#include "util/rsthreads.h"
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <list>
+#include <vector>
+
+/**
+ * @brief A wallet operation a TX waits for
+ */
+
+class WalletRequest
+{
+public:
+    enum Operation {
+        NEW_ADDRESS = 0,   // out: m_recvAddr
+        MK_RAW_TX,         // in: m_btcAmount, m_sendAddr, m_recvAddr out: m_sendAddr, m_txHex, m_btcTxId
+        SEND_RAW           // in: m_txHex
+    };
+
+    WalletRequest( Operation op, const ZR::TransactionId & txId ) :
+        m_op( op ),
+        m_txId( txId ),
+        m_result( ZR::ZR_FAILURE )
+    {}
+
+    Operation m_op;
+    ZR::TransactionId m_txId;       // the TX to resume
+    ZR::ZR_Number m_btcAmount;
+    ZR::BitcoinAddress m_sendAddr;
+    ZR::BitcoinAddress m_recvAddr;
+    ZR::BitcoinTxHex m_txHex;
+    ZR::TransactionId m_btcTxId;
+    ZR::RetVal m_result;
+};
+
+
+/**
+ * @brief Runs the wallet calls of the contracts on a thread of their own
+ *
+ * A TX submits a request and returns. When bitcoind answered, dispatch() resumes the TX with
+ * the result on the service thread, see @see TransactionManager::resume. A slow bitcoind so only
+ * holds up the TX waiting for it, not all the others. WORKERS requests run at once, so one slow
+ * call does not hold up the other TX either.
+ */
+
+class AsyncWallet
+{
+    AsyncWallet();
+    AsyncWallet( const AsyncWallet & );
+public:
+    static AsyncWallet * Instance();
+
+    void submit( const WalletRequest & request );
+
+    /** resume the TX whose requests are done */
+    void dispatch();
+
+    /** wait for the calls in progress and end the workers. Requests submitted after are dropped */
+    void stop();
+
+private:
+    class Worker : public RsThread
+    {
+    public:
+        Worker( AsyncWallet * wallet ) : m_wallet( wallet ) {}
+        virtual void run(){ m_wallet->work(); }
+    private:
+        AsyncWallet * m_wallet;
+    };
+
+    void work();
+    void execute( WalletRequest & request );
+
+    std::list< WalletRequest > m_pending;
+    std::list< WalletRequest > m_done;
+    QMutex m_mutex;
+    QWaitCondition m_submitted;
+    std::vector< Worker * > m_workers;
+    bool m_stopped;
+
+    static const unsigned int WORKERS;   // wallet calls in progress at once
+
+    static AsyncWallet * instance;
+    static RsMutex creation_mutex;
+};
+
+#endif // ASYNCWALLET_H
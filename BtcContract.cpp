@@ -136,16 +136,16 @@ bool BtcContract::poll()
     if( confirmations >= reqConfirmations ){
         // TODO: Check BTC Address and amount
         ZrDB::Instance()->beginTx();
-        execute();
-        if( !m_btcTxId.empty() ){
-            try{
+        try{
+            execute();
+            if( !m_btcTxId.empty() ){
                 ZrDB::Instance()->rmBtcContract( m_btcTxId, m_party );
-                ZrDB::Instance()->commitTx();
-            }
-            catch( std::exception e ){
-                g_ZeroReservePlugin->placeMsg( std::string( "Exception caught: " ) + e.what() + " Can't remove contract " + m_btcTxId );
-                ZrDB::Instance()->rollbackTx();
             }
+            ZrDB::Instance()->commitTx();   // always ends the DB transaction, it holds the connection
+        }
+        catch( std::exception e ){
+            g_ZeroReservePlugin->placeMsg( std::string( "Exception caught: " ) + e.what() + " Can't remove contract " + m_btcTxId );
+            ZrDB::Instance()->rollbackTx();
         }
         return true;
     }
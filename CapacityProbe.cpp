@@ -0,0 +1,213 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "CapacityProbe.h"
+#include "RSZRRemoteItems.h"
+#include "Router.h"
+#include "Credit.h"
+#include "MyOrders.h"
+#include "p3ZeroReserverRS.h"
+#include "ZeroReservePlugin.h"
+
+#include <openssl/rand.h>
+#include <QDateTime>
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+
+const qint64 CapacityProbe::PROBE_TTL = 10000;      // 10 seconds
+const qint64 CapacityProbe::PROBE_TIMEOUT = 5000;
+
+CapacityProbe::RequestList CapacityProbe::m_probes;
+CapacityProbe::RequestList CapacityProbe::m_returnPath;
+std::map< ZR::VirtualAddress, qint64 > CapacityProbe::m_probed;
+RsMutex CapacityProbe::m_probeMutex( "probe_mutex" );
+
+
+CapacityProbe::Result CapacityProbe::capacity( const OrderBook::Order * other, ZR::ZR_Number & capacity )
+{
+    Router::CandidateList candidates;
+    Router::Instance()->getRoutes( other->m_order_id, candidates );
+    if( candidates.empty() ) return UNKNOWN;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    bool known = false;
+    capacity = 0;
+    for( Router::CandidateList::const_iterator it = candidates.begin(); it != candidates.end(); it++ ){
+        if( (*it).m_probed == 0 || now - (*it).m_probed > PROBE_TTL ) continue;
+        known = true;
+        if( (*it).m_credit > capacity ) capacity = (*it).m_credit;
+    }
+    if( known ) return KNOWN;
+
+    {
+        RsStackMutex probeMutex( m_probeMutex );
+        std::map< ZR::VirtualAddress, qint64 >::const_iterator it = m_probed.find( other->m_order_id );
+        if( it != m_probed.end() ){
+            if( now - (*it).second < PROBE_TIMEOUT ) return PENDING;
+            if( now - (*it).second < PROBE_TTL ) return UNKNOWN;   // no answer - don't flood the route with probes
+        }
+        m_probed[ other->m_order_id ] = now;
+    }
+
+    std::string currency = Currency::currencySymbols[ other->m_currency ];
+    for( Router::CandidateList::const_iterator it = candidates.begin(); it != candidates.end(); it++ ){
+        probe( other->m_order_id, (*it).m_gateway, currency );
+    }
+    return PENDING;
+}
+
+
+void CapacityProbe::probe( const ZR::VirtualAddress & dest, const ZR::PeerAddress & gateway, const std::string & currency )
+{
+    Credit c( gateway, currency );
+    c.loadPeer();
+
+    std::string probeId = newProbeId();
+    {
+        RsStackMutex probeMutex( m_probeMutex );
+        Request & request = m_probes[ probeId ];
+        request.m_dest = dest;
+        request.m_gateway = gateway;
+        request.m_sent = QDateTime::currentMSecsSinceEpoch();
+    }
+
+    p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+    RSZRRemoteProbeItem * item = new RSZRRemoteProbeItem( dest, Router::SERVER, probeId, currency, c.getMyAvailable() );
+    item->PeerId( gateway );
+    p3zr->sendItem( item );
+}
+
+
+void CapacityProbe::handleItem( RSZRRemoteProbeItem * item )
+{
+    p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+
+    if( item->getDirection() == Router::SERVER ){
+        // the credit a contract from the previous node would get, see BtcContract::RECEIVER
+        ZR::ZR_Number capacity = item->getCapacity();
+        try{
+            Credit c( item->PeerId(), item->getCurrency() );
+            c.loadPeer();
+            if( c.getPeerAvailable() < capacity ) capacity = c.getPeerAvailable();
+        }
+        catch( std::runtime_error e ){
+            std::cerr << "Zero Reserve: CapacityProbe: Exception caught: " << e.what() << std::endl;
+            return;
+        }
+        if( capacity < 0 ) capacity = 0;
+
+        if( MyOrders::Instance()->find( item->getAddress() ) != NULL ){
+            answer( item, capacity );
+            return;
+        }
+
+        ZR::PeerAddress nextHop = Router::Instance()->nextHop( item->getAddress() );
+        if( nextHop.empty() || capacity == 0 ){
+            answer( item, 0 );
+            return;
+        }
+        {
+            RsStackMutex probeMutex( m_probeMutex );
+            if( m_returnPath.find( item->getProbeId() ) != m_returnPath.end() ){
+                std::cerr << "Zero Reserve: CapacityProbe: Loop detected for " << item->getAddress() << std::endl;
+                return;
+            }
+            Request & request = m_returnPath[ item->getProbeId() ];
+            request.m_dest = item->getAddress();
+            request.m_gateway = item->PeerId();
+            request.m_sent = QDateTime::currentMSecsSinceEpoch();
+        }
+        RSZRRemoteProbeItem * forwardItem = new RSZRRemoteProbeItem( item->getAddress(), Router::SERVER, item->getProbeId(), item->getCurrency(), capacity );
+        forwardItem->PeerId( nextHop );
+        p3zr->sendItem( forwardItem );
+        return;
+    }
+
+    Request request;
+    bool mine = false;
+    {
+        RsStackMutex probeMutex( m_probeMutex );
+        RequestList::iterator it = m_probes.find( item->getProbeId() );
+        if( it != m_probes.end() ){
+            mine = true;
+            request = (*it).second;
+            m_probes.erase( it );
+        }
+        else {
+            it = m_returnPath.find( item->getProbeId() );
+            if( it == m_returnPath.end() ) return;   // too late
+            request = (*it).second;
+            m_returnPath.erase( it );
+        }
+    }
+
+    if( mine ){
+        std::cerr << "Zero Reserve: CapacityProbe: " << request.m_dest << " via " << request.m_gateway
+                  << ": " << item->getCapacity().toDecimalStdString() << " " << item->getCurrency() << std::endl;
+        Router::Instance()->reportCapacity( request.m_dest, request.m_gateway, item->getCapacity() );
+        MyOrders::Instance()->match();
+        return;
+    }
+
+    RSZRRemoteProbeItem * returnItem = new RSZRRemoteProbeItem( item->getAddress(), Router::CLIENT, item->getProbeId(), item->getCurrency(), item->getCapacity() );
+    returnItem->PeerId( request.m_gateway );
+    p3zr->sendItem( returnItem );
+}
+
+
+void CapacityProbe::answer( RSZRRemoteProbeItem * item, const ZR::ZR_Number & capacity )
+{
+    p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+    RSZRRemoteProbeItem * returnItem = new RSZRRemoteProbeItem( item->getAddress(), Router::CLIENT, item->getProbeId(), item->getCurrency(), capacity );
+    returnItem->PeerId( item->PeerId() );
+    p3zr->sendItem( returnItem );
+}
+
+
+void CapacityProbe::timeout()
+{
+    RsStackMutex probeMutex( m_probeMutex );
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for( RequestList::iterator it = m_probes.begin(); it != m_probes.end(); ){
+        if( now - (*it).second.m_sent > PROBE_TIMEOUT ) m_probes.erase( it++ );
+        else it++;
+    }
+    for( RequestList::iterator it = m_returnPath.begin(); it != m_returnPath.end(); ){
+        if( now - (*it).second.m_sent > PROBE_TIMEOUT ) m_returnPath.erase( it++ );
+        else it++;
+    }
+    for( std::map< ZR::VirtualAddress, qint64 >::iterator it = m_probed.begin(); it != m_probed.end(); ){
+        if( now - (*it).second > PROBE_TTL ) m_probed.erase( it++ );
+        else it++;
+    }
+}
+
+
+std::string CapacityProbe::newProbeId()
+{
+    unsigned char random[ 16 ];
+    RAND_bytes( random, sizeof( random ) );
+    std::ostringstream id;
+    for( unsigned int i = 0; i < sizeof( random ); i++ ){
+        id << std::hex << std::setw( 2 ) << std::setfill( '0' ) << (int)random[ i ];
+    }
+    return id.str();
+}
@@ -0,0 +1,80 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CAPACITYPROBE_H
+#define CAPACITYPROBE_H
+
+#include "zrtypes.h"
+#include "OrderBook.h"
+
+#include "util/rsthreads.h"
+
+#include <map>
+#include <string>
+
+class RSZRRemoteProbeItem;
+
+/**
+ * @brief Finds the bottleneck credit along the routes to an order before buying from it
+ *
+ * A probe is sent through each candidate gateway of a route. Every node on the way lowers the
+ * capacity to what it would accept from its predecessor, the owner of the order returns it.
+ * The result ends up in the @see Router candidate and is valid for PROBE_TTL, so the buyer can
+ * size the QUERY of the contract to what the route can carry and skip routes which carry nothing.
+ */
+
+class CapacityProbe
+{
+public:
+    enum Result {
+        KNOWN = 0,     // capacity holds the best probed capacity
+        PENDING,       // probes are on their way, ask again later
+        UNKNOWN        // the probes did not come back, e.g. old peers on the route
+    };
+
+    /** capacity of the best route to the seller's order in its currency. Starts probes as needed */
+    static Result capacity( const OrderBook::Order * other, ZR::ZR_Number & capacity );
+
+    static void handleItem( RSZRRemoteProbeItem * item );
+
+    /** drop unanswered probes, call this periodically */
+    static void timeout();
+
+    static const qint64 PROBE_TTL;        // how long a measured capacity is trusted
+    static const qint64 PROBE_TIMEOUT;    // how long to wait for an answer
+
+private:
+    class Request
+    {
+    public:
+        ZR::VirtualAddress m_dest;
+        ZR::PeerAddress m_gateway;     // my side: the gateway probed, hop side: where the answer goes
+        qint64 m_sent;
+    };
+    typedef std::map< std::string, Request > RequestList;
+
+    static void probe( const ZR::VirtualAddress & dest, const ZR::PeerAddress & gateway, const std::string & currency );
+    static void answer( RSZRRemoteProbeItem * item, const ZR::ZR_Number & capacity );
+    static std::string newProbeId();
+
+    static RequestList m_probes;       // my probes, by probe ID
+    static RequestList m_returnPath;   // probes of others passing through
+    static std::map< ZR::VirtualAddress, qint64 > m_probed;   // when a destination was probed last
+    static RsMutex m_probeMutex;
+};
+
+#endif // CAPACITYPROBE_H
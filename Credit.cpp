@@ -106,4 +106,5 @@ void Credit::publish()
 {
     p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
     p3zr->sendCredit( this );
+    p3zr->announceSubscriptions( m_currency );
 }
@@ -0,0 +1,163 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "InboundQueue.h"
+#include "RSZRRemoteItems.h"
+
+#include "serialiser/rsserial.h"
+
+#include <QDateTime>
+
+
+const unsigned int InboundQueue::RECEIVE_BUDGET = 1000;
+const unsigned int InboundQueue::WORK_BUDGET = 200;
+const unsigned int InboundQueue::MAX_QUEUED = 2000;
+
+// TX control, credit, gossip. The gossip burst covers the order book a friend sends on connect
+const double InboundQueue::RATE[ SendQueue::PRIORITY_NUMBER ]  = { 50, 10, 100 };
+const double InboundQueue::BURST[ SendQueue::PRIORITY_NUMBER ] = { 100, 50, 500 };
+
+
+bool InboundQueue::Bucket::take( double rate, double burst, qint64 now, unsigned int tokens )
+{
+    if( m_tokens < 0 ){
+        m_tokens = burst;
+    }
+    else {
+        m_tokens += rate * ( now - m_last ) / 1000;
+        if( m_tokens > burst ) m_tokens = burst;
+    }
+    m_last = now;
+
+    if( m_tokens < tokens ) return false;
+    m_tokens -= tokens;
+    return true;
+}
+
+
+InboundQueue::InboundQueue() :
+    m_queueMutex( "inbound_queue_mutex" )
+{
+}
+
+InboundQueue::~InboundQueue()
+{
+    for( PeerQueues::iterator it = m_queues.begin(); it != m_queues.end(); it++ ){
+        for( int prio = 0; prio < SendQueue::PRIORITY_NUMBER; prio++ ){
+            ItemQueue & queue = (*it).second.m_items[ prio ];
+            for( ItemQueue::iterator itemIt = queue.begin(); itemIt != queue.end(); itemIt++ ){
+                delete (*itemIt).m_item;
+            }
+        }
+    }
+}
+
+void InboundQueue::push( RsItem * item )
+{
+    SendQueue::Priority prio = SendQueue::priority( item );
+
+    RsStackMutex queueMutex( m_queueMutex );
+    PeerQueue & peerQueue = m_queues[ item->PeerId() ];
+    peerQueue.m_stats.received++;
+
+    ItemQueue & queue = peerQueue.m_items[ prio ];
+    if( queue.size() >= MAX_QUEUED ){
+        peerQueue.m_stats.dropped++;
+        delete item;
+        return;
+    }
+    Entry entry;
+    entry.m_item = item;
+    entry.m_deferred = false;
+    queue.push_back( entry );
+}
+
+RsItem * InboundQueue::take( PeerQueue & peerQueue, qint64 now )
+{
+    for( int prio = 0; prio < SendQueue::PRIORITY_NUMBER; prio++ ){
+        ItemQueue & queue = peerQueue.m_items[ prio ];
+        if( queue.empty() ) continue;
+        if( !peerQueue.m_buckets[ prio ].take( RATE[ prio ], BURST[ prio ], now, cost( queue.front().m_item ) ) ) continue;
+
+        RsItem * item = queue.front().m_item;
+        queue.pop_front();
+        peerQueue.m_stats.processed++;
+        return item;
+    }
+    return NULL;
+}
+
+unsigned int InboundQueue::cost( RsItem * item )
+{
+    if( item->PacketSubType() != RsZeroReserveItem::ZERORESERVE_ORDERBATCH_ITEM ) return 1;
+    unsigned int orders = static_cast< RsZeroReserveOrderBatchItem * >( item )->getOrders().size();
+    return ( orders > 0 )? orders : 1;
+}
+
+RsItem * InboundQueue::next()
+{
+    RsStackMutex queueMutex( m_queueMutex );
+    if( m_queues.empty() ) return NULL;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    // one round, starting after the peer served last
+    PeerQueues::iterator it = m_queues.upper_bound( m_cursor );
+    for( unsigned int n = 0; n < m_queues.size(); n++, it++ ){
+        if( it == m_queues.end() ) it = m_queues.begin();
+        RsItem * item = take( (*it).second, now );
+        if( item ){
+            m_cursor = (*it).first;
+            return item;
+        }
+    }
+    return NULL;
+}
+
+void InboundQueue::endTick()
+{
+    RsStackMutex queueMutex( m_queueMutex );
+    for( PeerQueues::iterator it = m_queues.begin(); it != m_queues.end(); it++ ){
+        PeerQueue & peerQueue = (*it).second;
+        for( int prio = 0; prio < SendQueue::PRIORITY_NUMBER; prio++ ){
+            ItemQueue & queue = peerQueue.m_items[ prio ];
+            // the ones not marked yet arrived this tick, they are at the end
+            for( ItemQueue::reverse_iterator itemIt = queue.rbegin(); itemIt != queue.rend() && !(*itemIt).m_deferred; itemIt++ ){
+                (*itemIt).m_deferred = true;
+                peerQueue.m_stats.deferred++;
+            }
+        }
+    }
+}
+
+void InboundQueue::getStats( const std::string & peerId, Stats & stats )
+{
+    RsStackMutex queueMutex( m_queueMutex );
+    PeerQueues::iterator it = m_queues.find( peerId );
+    if( it != m_queues.end() ) stats = (*it).second.m_stats;
+}
+
+void InboundQueue::getStats( Stats & stats )
+{
+    RsStackMutex queueMutex( m_queueMutex );
+    for( PeerQueues::iterator it = m_queues.begin(); it != m_queues.end(); it++ ){
+        const Stats & peerStats = (*it).second.m_stats;
+        stats.received += peerStats.received;
+        stats.processed += peerStats.processed;
+        stats.deferred += peerStats.deferred;
+        stats.dropped += peerStats.dropped;
+    }
+}
@@ -0,0 +1,114 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INBOUNDQUEUE_H
+#define INBOUNDQUEUE_H
+
+#include "SendQueue.h"
+#include "zrtypes.h"
+
+#include "util/rsthreads.h"
+
+#include <map>
+#include <list>
+#include <string>
+
+class RsItem;
+
+/**
+ * @brief Incoming items per peer, rate limited and served round robin
+ *
+ * Items are classified like outgoing ones, @see SendQueue::Priority. Each peer has a token bucket
+ * per class; a peer that sends faster than its bucket allows has its items deferred to later
+ * ticks, and dropped once MAX_QUEUED of a class are waiting. next() serves the peers in turn, so
+ * one noisy friend cannot starve the others, and the caller bounds the work per tick. An item costs
+ * a token per order it carries, @see cost().
+ */
+
+class InboundQueue
+{
+    InboundQueue( const InboundQueue & );
+public:
+    class Stats
+    {
+    public:
+        Stats() : received( 0 ), processed( 0 ), deferred( 0 ), dropped( 0 ) {}
+        unsigned long received;
+        unsigned long processed;
+        unsigned long deferred;    // items not processed in the tick they arrived
+        unsigned long dropped;     // items thrown away because the queue was full
+    };
+
+    InboundQueue();
+    ~InboundQueue();
+
+    /** takes ownership of the item */
+    void push( RsItem * item );
+    /** @return the next item to process, or NULL if nothing may be processed now */
+    RsItem * next();
+    /** the share of the rate limits and the WORK_BUDGET the item takes: 1, or the number of orders in a batch */
+    static unsigned int cost( RsItem * item );
+    /** account for the items left over, call this at the end of each tick */
+    void endTick();
+
+    void getStats( Stats & stats );
+    void getStats( const std::string & peerId, Stats & stats );
+
+    static const unsigned int RECEIVE_BUDGET;   // items taken from RetroShare per tick
+    static const unsigned int WORK_BUDGET;      // items processed per tick
+    static const unsigned int MAX_QUEUED;       // per peer and class
+
+private:
+    class Bucket
+    {
+    public:
+        Bucket() : m_tokens( -1 ), m_last( 0 ) {}
+        bool take( double rate, double burst, qint64 now, unsigned int tokens );
+
+        double m_tokens;   // -1: not initialized yet
+        qint64 m_last;
+    };
+
+    class Entry
+    {
+    public:
+        RsItem * m_item;
+        bool m_deferred;
+    };
+    typedef std::list< Entry > ItemQueue;
+
+    class PeerQueue
+    {
+    public:
+        ItemQueue m_items[ SendQueue::PRIORITY_NUMBER ];
+        Bucket m_buckets[ SendQueue::PRIORITY_NUMBER ];
+        Stats m_stats;
+    };
+    typedef std::map< std::string, PeerQueue > PeerQueues;
+
+    /** @return an item of the peer its buckets allow, or NULL */
+    RsItem * take( PeerQueue & peerQueue, qint64 now );
+
+    PeerQueues m_queues;
+    std::string m_cursor;    // the peer served last
+    RsMutex m_queueMutex;
+
+    static const double RATE[ SendQueue::PRIORITY_NUMBER ];    // items per second
+    static const double BURST[ SendQueue::PRIORITY_NUMBER ];
+};
+
+#endif // INBOUNDQUEUE_H
@@ -22,8 +22,12 @@
 #include "TmContract.h"
 #include "ZRBitcoin.h"
 #include "Router.h"
+#include "CapacityProbe.h"
+#include "OrderSweep.h"
 #include "zrdb.h"
 
+#include <QDateTime>
+
 #include <iostream>
 #include <sstream>
 
@@ -121,7 +125,7 @@ void MyOrders::match()
     RsStackMutex orderMutex( m_order_mutex );
     for( OrderIterator it = m_orders.begin(); it != m_orders.end(); it++ ){
         Order * order = *it;
-        if( order->m_orderType == Order::BID ){
+        if( order->m_orderType == Order::BID && order->m_execution == Order::LIMIT ){
             match( order );
         }
     }
@@ -135,33 +139,81 @@ ZR::RetVal MyOrders::match( Order * myOrder )
     OrderList asks;
     m_asks->filterOrders( asks, myOrder->m_currency );
     ZR::ZR_Number amount = myOrder->m_amount;
+    std::list< std::pair< Order *, ZR::ZR_Number > > fills;
+    ZR::RetVal result = ZR::ZR_SUCCESS;
     for( OrderIterator askIt = asks.begin(); askIt != asks.end(); askIt++ ){
         Order * other = *askIt;
         if( other->m_ignored ) continue;   // trying to execute this order did not go well in the past. Don't try again.
         if( other->m_isMyOrder ) continue; // don't fill own orders
         if( myOrder->m_matched.find( other->m_order_id ) != myOrder->m_matched.end() ) continue; // matched that already
-        if( myOrder->m_price < other->m_price ) break;    // no need to try and find matches beyond
+        if( myOrder->m_execution != Order::MARKET && myOrder->m_price < other->m_price ) break;    // no need to try and find matches beyond
+
+        // size the buy to what the route can carry - wait for the probes before trying worse prices
+        ZR::ZR_Number capacity;
+        CapacityProbe::Result probe = CapacityProbe::capacity( other, capacity );
+        if( probe == CapacityProbe::PENDING ){
+            if( myOrder->m_execution == Order::LIMIT ) break;
+            probe = CapacityProbe::UNKNOWN;     // an immediate order does not wait, the contract finds out
+        }
+        if( probe == CapacityProbe::KNOWN && capacity <= 0 ) continue;   // no route to this seller can carry anything now
+
         std::cerr << "Zero Reserve: Match at ask price " << other->m_price.toStdString() << std::endl;
 
         myOrder->m_matched.insert( other->m_order_id );
 
-        if( amount > other->m_amount ){
-            buy( other, myOrder, other->m_amount );
+        ZR::ZR_Number fill = ( amount > other->m_amount )? other->m_amount : amount;
+        if( probe == CapacityProbe::KNOWN && fill * other->m_price > capacity ){
+            fill = capacity / other->m_price;
         }
-        else {
-            buy( other, myOrder, amount );
-            return ZR::ZR_FINISH;
+        fills.push_back( std::make_pair( other, fill ) );
+        amount -= fill;
+        if( amount <= 0 ){
+            result = ZR::ZR_FINISH;
+            break;
         }
-        amount -= other->m_amount;
     }
-    return ZR::ZR_SUCCESS;
+    if( fills.empty() ) return ZR::ZR_FAILURE;
+    buy( myOrder, fills );   // myOrder may be gone after this
+    return result;
+}
+
+
+void MyOrders::execute( Order * order )
+{
+    p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+    p3zr->post( new Execution( order->m_order_id ) );
+}
+
+void MyOrders::Execution::run()
+{
+    MyOrders * myOrders = MyOrders::Instance();
+    Order * order = myOrders->find( m_orderId );
+    if( order == NULL ) return;
+
+    std::cerr << "Zero Reserve: Executing " << order->m_order_id << ( order->m_execution == Order::MARKET ? " at market" : " immediate or cancel" ) << std::endl;
+    if( myOrders->match( order ) != ZR::ZR_FAILURE ) return;   // the sweep owns it now
+
+    g_ZeroReservePlugin->placeMsg( "Nothing to buy for this order in the book" );
+    myOrders->remove( order->m_order_id );
+    delete order;
 }
 
 
-void MyOrders::buy( Order * other, Order * myOrder, const ZR::ZR_Number amount )
+void MyOrders::buy( Order * myOrder, const std::list< std::pair< Order *, ZR::ZR_Number > > & fills )
 {
-    TmContractCoordinator * tm = new TmContractCoordinator( other, myOrder, amount );
-    if( ZR::ZR_FAILURE == tm->init() ) delete tm;
+    std::cerr << "Zero Reserve: Sweeping " << fills.size() << " asks for " << myOrder->m_order_id << std::endl;
+    OrderSweep * sweep = new OrderSweep( myOrder );
+
+    // all legs join the sweep before any of them can finish
+    std::list< TmContractCoordinator * > legs;
+    for( std::list< std::pair< Order *, ZR::ZR_Number > >::const_iterator it = fills.begin(); it != fills.end(); it++ ){
+        legs.push_back( new TmContractCoordinator( (*it).first, sweep, (*it).second ) );
+    }
+    sweep->detach();
+
+    for( std::list< TmContractCoordinator * >::const_iterator it = legs.begin(); it != legs.end(); it++ ){
+        TransactionManager::start( *it );
+    }
 }
 
 
@@ -171,6 +223,10 @@ void MyOrders::cancelOrder( int index )
     std::cerr << "Zero Reserve: Cancelling order: " << index << std::endl;
     p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
     Order * order = m_filteredOrders[ index ];
+    if( order->m_execution != Order::LIMIT ){
+        g_ZeroReservePlugin->placeMsg( "This order is executing and cancels what it cannot buy by itself" );
+        return;
+    }
 
     remove( order->m_order_id );
     if( order->m_orderType == Order::ASK ){
@@ -184,3 +240,192 @@ void MyOrders::cancelOrder( int index )
     p3zr->publishOrder( order );
 }
 
+
+void MyOrders::notifyFilled( const Order * order, const ZR::ZR_Number & amount )
+{
+    OrderBook * book = ( order->m_orderType == Order::ASK )? m_asks : m_bids;
+    book->notifyFilled( order, amount );
+}
+
+
+ZR::RetVal MyOrders::placeOrders( const std::vector< Order * > & orders )
+{
+    std::set< Order::ID > ids;
+    for( std::vector< Order * >::const_iterator it = orders.begin(); it != orders.end(); it++ ){
+        Order * order = *it;
+        if( order->m_execution != Order::LIMIT || order->m_amount <= 0 || order->m_price <= 0
+                || !ids.insert( order->m_order_id ).second || find( order->m_order_id ) != NULL ){
+            g_ZeroReservePlugin->placeMsg( "Invalid order in bulk order " + order->m_order_id );
+            return ZR::ZR_FAILURE;
+        }
+    }
+
+    ZrDB * db = ZrDB::Instance();
+    db->beginTx();
+    try {
+        for( std::vector< Order * >::const_iterator it = orders.begin(); it != orders.end(); it++ ){
+            db->addOrder( *it );
+        }
+        db->commitTx();
+    }
+    catch( std::runtime_error & e ){
+        db->rollbackTx();
+        g_ZeroReservePlugin->placeMsg( std::string( "Exception caught at " ) + __func__ + ": " + e.what() );
+        return ZR::ZR_FAILURE;
+    }
+
+    for( std::vector< Order * >::const_iterator it = orders.begin(); it != orders.end(); it++ ){
+        Order * order = *it;
+        addOrder( order );
+        ( ( order->m_orderType == Order::ASK )? m_asks : m_bids )->addOrder( order );
+    }
+    std::cerr << "Zero Reserve: Placed " << orders.size() << " orders" << std::endl;
+
+    p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+    p3zr->publishOrders( orders );
+    return ZR::ZR_SUCCESS;
+}
+
+
+ZR::RetVal MyOrders::cancelOrders( const std::vector< Order::ID > & orderIds )
+{
+    std::vector< Order * > orders;
+    {
+        RsStackMutex orderMutex( m_order_mutex );
+        for( std::vector< Order::ID >::const_iterator it = orderIds.begin(); it != orderIds.end(); it++ ){
+            Order * order = NULL;
+            for( OrderIterator orderIt = m_orders.begin(); orderIt != m_orders.end(); orderIt++ ){
+                if( (*orderIt)->m_order_id == *it ){
+                    order = *orderIt;
+                    break;
+                }
+            }
+            if( order == NULL || order->m_execution != Order::LIMIT || order->m_locked || order->m_commitment > 0 ){
+                g_ZeroReservePlugin->placeMsg( "Cannot cancel order " + *it + " now" );
+                for( std::vector< Order * >::iterator lockIt = orders.begin(); lockIt != orders.end(); lockIt++ ){
+                    (*lockIt)->m_locked = false;
+                }
+                return ZR::ZR_FAILURE;
+            }
+            order->m_locked = true;   // keep the matcher off it
+            orders.push_back( order );
+        }
+    }
+
+    // one DB transaction, the books only follow once it went through. The transaction holds the
+    // connection, so it must not wait for the order mutex of a book which is writing to the DB
+    ZrDB * db = ZrDB::Instance();
+    db->beginTx();
+    try {
+        for( std::vector< Order * >::iterator it = orders.begin(); it != orders.end(); it++ ){
+            db->deleteOrder( *it );
+        }
+        db->commitTx();
+    }
+    catch( std::runtime_error & e ){
+        db->rollbackTx();
+        for( std::vector< Order * >::iterator it = orders.begin(); it != orders.end(); it++ ){
+            (*it)->m_locked = false;
+        }
+        g_ZeroReservePlugin->placeMsg( std::string( "Exception caught at " ) + __func__ + ": " + e.what() );
+        return ZR::ZR_FAILURE;
+    }
+
+    for( std::vector< Order * >::iterator it = orders.begin(); it != orders.end(); it++ ){
+        Order * order = *it;
+        remove( order->m_order_id );
+        ( ( order->m_orderType == Order::ASK )? m_asks : m_bids )->remove( order->m_order_id );
+    }
+
+    for( std::vector< Order * >::iterator it = orders.begin(); it != orders.end(); it++ ){
+        (*it)->m_purpose = Order::CANCEL;
+    }
+    std::cerr << "Zero Reserve: Cancelled " << orders.size() << " orders" << std::endl;
+
+    p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+    p3zr->publishOrders( orders );
+    return ZR::ZR_SUCCESS;
+}
+
+
+ZR::RetVal MyOrders::amendOrder( int index, const ZR::ZR_Number & price, const ZR::ZR_Number & amount )
+{
+    Order::ID orderId;
+    {
+        RsStackMutex orderMutex( m_order_mutex );
+        if( index < 0 || index >= m_filteredOrders.size() ) return ZR::ZR_FAILURE;
+        orderId = m_filteredOrders[ index ]->m_order_id;
+    }
+    return amendOrder( orderId, price, amount );
+}
+
+
+ZR::RetVal MyOrders::amendOrder( const Order::ID & orderId, const ZR::ZR_Number & price, const ZR::ZR_Number & amount, Order::ID * newId )
+{
+    Order * oldOrder = NULL;
+    {
+        RsStackMutex orderMutex( m_order_mutex );
+        for( OrderIterator it = m_orders.begin(); it != m_orders.end(); it++ ){
+            if( (*it)->m_order_id == orderId ){
+                oldOrder = *it;
+                break;
+            }
+        }
+        if( oldOrder == NULL ){
+            g_ZeroReservePlugin->placeMsg( "No such order " + orderId );
+            return ZR::ZR_FAILURE;
+        }
+        if( oldOrder->m_execution != Order::LIMIT || oldOrder->m_locked || oldOrder->m_commitment > 0 ){
+            g_ZeroReservePlugin->placeMsg( "This order is executing. Try again when it is done" );
+            return ZR::ZR_FAILURE;
+        }
+        if( oldOrder->m_orderType == Order::ASK && amount > oldOrder->m_amount ){
+            g_ZeroReservePlugin->placeMsg( "The order address only holds the amount of this order. Place a new order to sell more" );
+            return ZR::ZR_FAILURE;
+        }
+        oldOrder->m_locked = true;   // keep the matcher off it
+    }
+    std::cerr << "Zero Reserve: Amending order: " << oldOrder->m_order_id << std::endl;
+
+    Order * order = new Order( *oldOrder );
+    order->m_price = price;
+    order->m_amount = amount;
+    order->m_matched.clear();
+    order->m_locked = false;
+    order->m_purpose = Order::NEW;   // stored as a new order, m_replaces means nothing after a restart
+    order->m_replaces = oldOrder->m_order_id;
+    order->m_timeStamp = QDateTime::currentMSecsSinceEpoch();
+    order->setOrderId();
+
+    // one DB transaction, a crash must not leave both orders behind
+    ZrDB * db = ZrDB::Instance();
+    db->beginTx();
+    try {
+        db->addOrder( order );
+        db->deleteOrder( oldOrder );
+        db->commitTx();
+    }
+    catch( std::runtime_error & e ){
+        db->rollbackTx();
+        g_ZeroReservePlugin->placeMsg( std::string( "Exception caught at " ) + __func__ + ": " + e.what() );
+        oldOrder->m_locked = false;
+        delete order;
+        return ZR::ZR_FAILURE;
+    }
+
+    OrderBook * book = ( order->m_orderType == Order::ASK )? m_asks : m_bids;
+    remove( oldOrder->m_order_id );
+    book->remove( oldOrder->m_order_id );
+    delete oldOrder;
+    addOrder( order );
+    book->addOrder( order );
+
+    // REPLACE only goes out once, publishOrder() takes a copy
+    p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+    order->m_purpose = Order::REPLACE;
+    p3zr->publishOrder( order );
+    order->m_purpose = Order::NEW;
+    if( newId ) *newId = order->m_order_id;
+    return ZR::ZR_SUCCESS;
+}
+
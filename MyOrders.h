@@ -22,8 +22,11 @@
 #include "OrderBook.h"
 #include "Payment.h"
 #include "ZeroReservePlugin.h"
+#include "ZrScheduler.h"
 
 #include <map>
+#include <list>
+#include <vector>
 
 /**
  * @brief Holds pointers to all orders from myself.
@@ -47,20 +50,59 @@ public:
 
     void cancelOrder( int index );
 
+    /**
+     * @brief Change price and amount of one of my limit orders with a single REPLACE
+     * The order gets a new ID, so TX under way at the old terms fail. Asks keep their order address,
+     * which is funded for the old amount - they can only shrink.
+     */
+    ZR::RetVal amendOrder( int index, const ZR::ZR_Number & price, const ZR::ZR_Number & amount );
+    /** @param newId if not NULL, gets the ID of the order which replaced orderId */
+    ZR::RetVal amendOrder( const Order::ID & orderId, const ZR::ZR_Number & price, const ZR::ZR_Number & amount, Order::ID * newId = NULL );
+
+    /**
+     * @brief Place many limit orders at once, all or none
+     * They are stored in one DB transaction and published in one item per friend.
+     * @return ZR::ZR_SUCCESS if the orders were placed, the book owns them then. Else the caller still does.
+     */
+    ZR::RetVal placeOrders( const std::vector< Order * > & orders );
+    /** Cancel many of my orders at once, all or none. Orders in a TX cannot be cancelled this way */
+    ZR::RetVal cancelOrders( const std::vector< Order::ID > & orderIds );
+
     /** iterate through all my orders and try matching */
     void match();
 
+    /**
+     * @brief Buy right away what an IOC or MARKET bid can get from the asks in the book
+     * The asks belong to the service thread, the order is matched there in its next tick. It is
+     * gone when its contracts are, or then if nothing crosses it.
+     */
+    void execute( Order * order );
+
+    /** tell the listeners of the book of order that it was filled by amount */
+    virtual void notifyFilled( const Order * order, const ZR::ZR_Number & amount );
+
     OrderBook * getBids(){ return m_bids; }
     OrderBook * getAsks(){ return m_asks; }
 
     static MyOrders * Instance();
 
 protected:
-    /** Matches one of my orders with all "other" others  */
+    /** Matches one of my orders with all "other" others. @return ZR::ZR_FAILURE if nothing matched */
     ZR::RetVal match( Order *myOrder );
 
-    /** Buyer side: start buying Bitcoins */
-    void buy( Order * other, Order * myOrder, const ZR::ZR_Number amount );
+    /** Buyer side: start buying Bitcoins from all the asks at once */
+    void buy( Order * myOrder, const std::list< std::pair< Order *, ZR::ZR_Number > > & fills );
+
+    /** the service thread part of execute() */
+    class Execution : public ZrScheduler::Task
+    {
+    public:
+        Execution( const Order::ID & orderId ) : m_orderId( orderId ) {}
+        virtual void run();
+    private:
+        Order::ID m_orderId;
+    };
+    friend class Execution;
 
 private:
     OrderBook * m_bids;
@@ -0,0 +1,209 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "OrderAggregator.h"
+#include "ZrConfig.h"
+#include "zrdb.h"
+
+#include "util/radix64.h"
+
+#include <openssl/sha.h>
+#include <openssl/rand.h>
+#include <QDateTime>
+
+#include <iostream>
+#include <sstream>
+
+
+OrderAggregator * OrderAggregator::instance = 0;
+RsMutex OrderAggregator::creation_mutex( "aggregator_creation_mutex" );
+
+
+OrderAggregator * OrderAggregator::Instance()
+{
+    RsStackMutex creationMutex( creation_mutex );
+    if( !OrderAggregator::instance ){
+        OrderAggregator::instance = new OrderAggregator();
+    }
+    return OrderAggregator::instance;
+}
+
+OrderAggregator::OrderAggregator() :
+    m_mutex( "aggregator_mutex" )
+{
+    unsigned char random[ 32 ];
+    if( RAND_bytes( random, sizeof( random ) ) != 1 ){
+        std::cerr << "Zero Reserve: OrderAggregator: Not enough randomness for the level secret" << std::endl;
+    }
+    m_secret = std::string( (const char*)random, sizeof( random ) );
+}
+
+bool OrderAggregator::enabled()
+{
+    return ZrConfig::Instance()->getInteger( ZrDB::ORDER_AGGREGATION ) != 0;
+}
+
+OrderBook::Order::ID OrderAggregator::levelId( const OrderBook::Order & order )
+{
+    unsigned char md[ SHA256_DIGEST_LENGTH ];
+    std::ostringstream dataStream;
+    dataStream << m_secret << order.m_orderType << ':' << order.m_currency << ':' << order.m_price.toStdString();
+    std::string data = dataStream.str();
+    SHA256( (const unsigned char*)data.c_str(), data.length(), md );
+    OrderBook::Order::ID id;
+    Radix64::encode( (const char*)md, SHA256_DIGEST_LENGTH, id );
+    return id;
+}
+
+bool OrderAggregator::refresh( Level & level )
+{
+    level.m_order.m_amount = 0;
+    level.m_order.m_timeStamp = 0;
+    level.m_order.m_hops = 0;
+    for( MemberList::const_iterator it = level.m_members.begin(); it != level.m_members.end(); it++ ){
+        const Member & member = (*it).second;
+        level.m_order.m_amount = level.m_order.m_amount + member.m_amount;
+        // the level lives as long as its youngest order and is as close as its closest
+        if( member.m_timeStamp > level.m_order.m_timeStamp ) level.m_order.m_timeStamp = member.m_timeStamp;
+        if( it == level.m_members.begin() || member.m_hops < level.m_order.m_hops ) level.m_order.m_hops = member.m_hops;
+    }
+    return !level.m_members.empty();
+}
+
+bool OrderAggregator::update( const OrderBook::Order & order, OrderBook::Order & level )
+{
+    if( order.m_isMyOrder ) return false;
+
+    RsStackMutex mutex( m_mutex );
+    LevelMap::iterator lit;
+    bool isNew = false;
+
+    if( order.m_purpose == OrderBook::Order::FILLED || order.m_purpose == OrderBook::Order::CANCEL ){
+        std::map< OrderBook::Order::ID, OrderBook::Order::ID >::iterator mit = m_memberOf.find( order.m_order_id );
+        if( mit == m_memberOf.end() ) return false;
+        lit = m_levels.find( (*mit).second );
+        m_memberOf.erase( mit );
+        if( lit == m_levels.end() ) return false;
+        (*lit).second.m_members.erase( order.m_order_id );
+    }
+    else {
+        OrderBook::Order::ID id = levelId( order );
+        lit = m_levels.find( id );
+        if( lit == m_levels.end() ){
+            isNew = true;
+            Level & newLevel = m_levels[ id ];
+            newLevel.m_order.m_order_id = id;
+            newLevel.m_order.m_orderType = order.m_orderType;
+            newLevel.m_order.m_currency = order.m_currency;
+            newLevel.m_order.m_price = order.m_price;
+            lit = m_levels.find( id );
+        }
+        Member & member = (*lit).second.m_members[ order.m_order_id ];
+        member.m_amount = order.m_amount;
+        member.m_timeStamp = order.m_timeStamp;
+        member.m_hops = order.m_hops;
+        m_memberOf[ order.m_order_id ] = id;
+    }
+
+    Level & current = (*lit).second;
+    ZR::ZR_Number oldAmount = current.m_order.m_amount;
+    if( !refresh( current ) ){
+        level = current.m_order;
+        level.m_purpose = OrderBook::Order::FILLED;
+        level.m_timeStamp = QDateTime::currentMSecsSinceEpoch();
+        m_levels.erase( lit );
+        return true;
+    }
+    if( !isNew && oldAmount == current.m_order.m_amount ) return false;
+
+    level = current.m_order;
+    level.m_purpose = ( isNew )? OrderBook::Order::NEW : OrderBook::Order::PARTLY_FILLED;
+    return true;
+}
+
+bool OrderAggregator::isLevel( const OrderBook::Order::ID & id )
+{
+    RsStackMutex mutex( m_mutex );
+    return m_levels.find( id ) != m_levels.end();
+}
+
+bool OrderAggregator::resolve( const OrderBook::Order::ID & id, const ZR::ZR_Number & amount, OrderBook::Order::ID & concrete )
+{
+    RsStackMutex mutex( m_mutex );
+    LevelMap::const_iterator lit = m_levels.find( id );
+    if( lit == m_levels.end() ) return false;
+
+    // the closest order which fills the whole amount, else the biggest one - the payee lowers the amount
+    const MemberList & members = (*lit).second.m_members;
+    MemberList::const_iterator best = members.end();
+    MemberList::const_iterator biggest = members.end();
+    for( MemberList::const_iterator it = members.begin(); it != members.end(); it++ ){
+        if( (*it).second.m_amount >= amount && ( best == members.end() || (*it).second.m_hops < (*best).second.m_hops ) )
+            best = it;
+        if( biggest == members.end() || (*it).second.m_amount > (*biggest).second.m_amount )
+            biggest = it;
+    }
+    if( best == members.end() ) best = biggest;
+    if( best == members.end() ) return false;
+
+    concrete = (*best).first;
+    return true;
+}
+
+void OrderAggregator::getLevels( LevelList & levels )
+{
+    RsStackMutex mutex( m_mutex );
+    for( LevelMap::const_iterator it = m_levels.begin(); it != m_levels.end(); it++ ){
+        levels.push_back( (*it).second.m_order );
+        levels.back().m_purpose = OrderBook::Order::NEW;
+    }
+}
+
+void OrderAggregator::timeout( LevelList & changed )
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    RsStackMutex mutex( m_mutex );
+    for( LevelMap::iterator lit = m_levels.begin(); lit != m_levels.end(); ){
+        Level & level = (*lit).second;
+        bool expired = false;
+        for( MemberList::iterator it = level.m_members.begin(); it != level.m_members.end(); ){
+            if( now - (*it).second.m_timeStamp > OrderBook::Order::timeout ){
+                m_memberOf.erase( (*it).first );
+                level.m_members.erase( it++ );
+                expired = true;
+            }
+            else {
+                it++;
+            }
+        }
+        if( !expired ){
+            lit++;
+            continue;
+        }
+        if( refresh( level ) ){
+            changed.push_back( level.m_order );
+            changed.back().m_purpose = OrderBook::Order::PARTLY_FILLED;
+            lit++;
+        }
+        else {
+            changed.push_back( level.m_order );
+            changed.back().m_purpose = OrderBook::Order::FILLED;
+            changed.back().m_timeStamp = now;
+            m_levels.erase( lit++ );
+        }
+    }
+}
@@ -0,0 +1,110 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ORDERAGGREGATOR_H
+#define ORDERAGGREGATOR_H
+
+#include "zrtypes.h"
+#include "OrderBook.h"
+
+#include "util/rsthreads.h"
+
+#include <map>
+#include <list>
+#include <string>
+
+/**
+ * @brief Folds the orders passing through this node into price levels
+ *
+ * With ORDER_AGGREGATION switched on, a hop no longer forwards every order it learns from upstream.
+ * It advertises one synthetic order per type, currency and price instead, carrying the total amount
+ * of the orders at that price and routed via itself. A QUERY for such a level arrives at this node
+ * as a hop, which resolves it to one of the concrete orders behind it, see @see TmContractCohorteHop.
+ *
+ * The level IDs are derived from a secret of this session, so they do not collide with those of
+ * other hops and levels of levels are possible. Our own orders are never aggregated.
+ */
+
+class OrderAggregator
+{
+    OrderAggregator();
+    OrderAggregator( const OrderAggregator & );
+public:
+    typedef std::list< OrderBook::Order > LevelList;
+
+    static OrderAggregator * Instance();
+
+    bool enabled();
+
+    /**
+     * @brief account an order from upstream to its level
+     * @param order the order as received
+     * @param level the new state of the level, to be published instead of the order
+     * @return false if the level did not change
+     */
+    bool update( const OrderBook::Order & order, OrderBook::Order & level );
+
+    /** @return true if the ID is one of the levels this node advertises */
+    bool isLevel( const OrderBook::Order::ID & id );
+
+    /**
+     * @brief pick the order behind a level which takes a QUERY
+     * @param id ID of the level
+     * @param amount Bitcoin amount to buy
+     * @param concrete the order to forward the QUERY to
+     * @return false if the level is unknown or empty
+     */
+    bool resolve( const OrderBook::Order::ID & id, const ZR::ZR_Number & amount, OrderBook::Order::ID & concrete );
+
+    /** the current levels, to bootstrap a new friend */
+    void getLevels( LevelList & levels );
+
+    /** drop timed out orders from the levels. @param changed the levels to publish */
+    void timeout( LevelList & changed );
+
+private:
+    class Member
+    {
+    public:
+        ZR::ZR_Number m_amount;
+        qint64 m_timeStamp;
+        unsigned int m_hops;
+    };
+    typedef std::map< OrderBook::Order::ID, Member > MemberList;
+
+    class Level
+    {
+    public:
+        OrderBook::Order m_order;
+        MemberList m_members;
+    };
+    typedef std::map< OrderBook::Order::ID, Level > LevelMap;
+
+    OrderBook::Order::ID levelId( const OrderBook::Order & order );
+    /** recalculate the level from its members, @return false if it is empty */
+    bool refresh( Level & level );
+
+    LevelMap m_levels;
+    std::map< OrderBook::Order::ID, OrderBook::Order::ID > m_memberOf;   // order -> its level
+    std::string m_secret;
+    RsMutex m_mutex;
+
+    static OrderAggregator * instance;
+    static RsMutex creation_mutex;
+};
+
+#endif // ORDERAGGREGATOR_H
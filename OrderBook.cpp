@@ -19,11 +19,15 @@
 #include "ZeroReservePlugin.h"
 #include "p3ZeroReserverRS.h"
 #include "zrdb.h"
+#include "ZrConfig.h"
+#include "MyOrders.h"
+#include "OrderAggregator.h"
 
 #include "util/radix64.h"
 
 #include <openssl/sha.h>
 #include <iostream>
+#include <map>
 
 #ifdef ZR_TESTNET
 const qint64 OrderBook::Order::timeout = 1800000;   // 30 minutes
@@ -32,7 +36,10 @@ const qint64 OrderBook::Order::timeout = 86400000;  // one day
 #endif
 
 OrderBook::OrderBook() :
-    m_order_mutex("order_mutex")
+    m_order_mutex("order_mutex"),
+    m_listener_mutex( "order_listener_mutex" ),
+    m_evicted( 0 ),
+    m_rejected( 0 )
 {
     m_myOrders = NULL;
 }
@@ -135,11 +142,217 @@ void OrderBook::filterOrders( OrderList & filteredOrders, const Currency::Curren
     qSort( filteredOrders.begin(), filteredOrders.end(), compareOrder );
 }
 
+/** walks a price index from the best price on, @see OrderBook::isCompetitive */
+template< class Iterator >
+static bool withinTopLevels( Iterator it, Iterator end, const OrderBook::Order * order, unsigned int topLevels )
+{
+    unsigned int levels = 0;    // better price levels
+    ZR::ZR_Number level;
+    for( ; it != end; it++ ){
+        const ZR::ZR_Number & price = (*it).first;
+        if( order->m_orderType == OrderBook::Order::ASK ? price >= order->m_price : price <= order->m_price )
+            return true;   // reached the price of the order
+        if( levels == 0 || price != level ){
+            level = price;
+            levels++;
+        }
+        if( levels >= topLevels ) return false;
+    }
+    return true;
+}
+
+bool OrderBook::isCompetitive( const Order * order, const ZR::ZR_Number & band, unsigned int topLevels )
+{
+    if( band <= 0 && topLevels == 0 ) return true;
+
+    // the price index is sorted already, only the levels ahead of the order are looked at
+    RsStackMutex orderMutex( m_order_mutex );
+    std::map< Currency::CurrencySymbols, PriceIndex >::const_iterator prices = m_byPrice.find( order->m_currency );
+    if( prices == m_byPrice.end() || (*prices).second.empty() ) return true;
+    const PriceIndex & index = (*prices).second;
+
+    if( band > 0 ){
+        ZR::ZR_Number best = bestPrice( order->m_currency, order->m_orderType, order );
+        if( order->m_orderType == Order::ASK ? order->m_price <= best * ( ZR::ZR_Number( 1 ) + band ) : order->m_price >= best * ( ZR::ZR_Number( 1 ) - band ) )
+            return true;
+    }
+
+    if( topLevels > 0 ){
+        if( order->m_orderType == Order::ASK ) return withinTopLevels( index.begin(), index.end(), order, topLevels );
+        return withinTopLevels( index.rbegin(), index.rend(), order, topLevels );
+    }
+    return false;
+}
+
+ZR::ZR_Number OrderBook::distance( const Order * order, const ZR::ZR_Number & best )
+{
+    if( best <= 0 ) return 0;
+    return ( order->m_orderType == Order::ASK )? ( order->m_price - best ) / best : ( best - order->m_price ) / best;
+}
+
+ZR::ZR_Number OrderBook::bestPrice( Currency::CurrencySymbols currency, Order::OrderType type, const Order * candidate )
+{
+    bool known = false;
+    ZR::ZR_Number best;
+    std::map< Currency::CurrencySymbols, PriceIndex >::const_iterator prices = m_byPrice.find( currency );
+    if( prices != m_byPrice.end() && !(*prices).second.empty() ){
+        best = ( type == Order::ASK )? (*(*prices).second.begin()).first : (*(*prices).second.rbegin()).first;
+        known = true;
+    }
+    if( candidate->m_currency == currency && candidate->m_orderType == type &&
+            ( !known || ( ( type == Order::ASK )? candidate->m_price < best : candidate->m_price > best ) ) )
+        best = candidate->m_price;
+    return best;
+}
+
+void OrderBook::indexOrder( Order * order )
+{
+    m_byPrice[ order->m_currency ].insert( std::make_pair( order->m_price, order ) );
+    m_byGateway[ order->m_gateway ].insert( order );
+}
+
+void OrderBook::unindexOrder( Order * order )
+{
+    std::map< Currency::CurrencySymbols, PriceIndex >::iterator prices = m_byPrice.find( order->m_currency );
+    if( prices != m_byPrice.end() ){
+        PriceIndex & index = (*prices).second;
+        std::pair< PriceIndex::iterator, PriceIndex::iterator > range = index.equal_range( order->m_price );
+        for( PriceIndex::iterator it = range.first; it != range.second; it++ ){
+            if( (*it).second == order ){
+                index.erase( it );
+                break;
+            }
+        }
+        if( index.empty() ) m_byPrice.erase( prices );
+    }
+    std::map< std::string, std::set< Order * > >::iterator gateway = m_byGateway.find( order->m_gateway );
+    if( gateway != m_byGateway.end() ){
+        (*gateway).second.erase( order );
+        if( (*gateway).second.empty() ) m_byGateway.erase( gateway );
+    }
+}
+
+bool OrderBook::admit( const Order * order )
+{
+    enum Group { NONE, GATEWAY, CURRENCY, TOTAL };
+    ZrConfig * config = ZrConfig::Instance();
+    qint64 maxGateway = config->getInteger( ZrDB::MAX_ORDERS_PER_GATEWAY );
+    qint64 maxCurrency = config->getInteger( ZrDB::MAX_ORDERS_PER_CURRENCY );
+    qint64 maxTotal = config->getInteger( ZrDB::MAX_ORDERS );
+    if( maxGateway <= 0 && maxCurrency <= 0 && maxTotal <= 0 ) return true;
+
+    for( ;; ){
+        Order * victim = NULL;
+        {
+            RsStackMutex orderMutex( m_order_mutex );
+            std::map< std::string, std::set< Order * > >::const_iterator gateway = m_byGateway.find( order->m_gateway );
+            std::map< Currency::CurrencySymbols, PriceIndex >::const_iterator currency = m_byPrice.find( order->m_currency );
+
+            Group group = NONE;
+            if( maxGateway > 0 && !order->m_gateway.empty() && gateway != m_byGateway.end() && (qint64)(*gateway).second.size() >= maxGateway ) group = GATEWAY;
+            else if( maxCurrency > 0 && currency != m_byPrice.end() && (qint64)(*currency).second.size() >= maxCurrency ) group = CURRENCY;
+            else if( maxTotal > 0 && m_orders.size() >= maxTotal ) group = TOTAL;
+            if( group == NONE ) return true;
+
+            ZR::ZR_Number worst;
+            if( group == GATEWAY ){
+                for( std::set< Order * >::const_iterator it = (*gateway).second.begin(); it != (*gateway).second.end(); it++ ){
+                    Order * o = *it;
+                    if( o->m_isMyOrder || o->m_locked || o->m_commitment != 0 ) continue;
+                    ZR::ZR_Number d = distance( o, bestPrice( o->m_currency, o->m_orderType, order ) );
+                    if( victim == NULL || d > worst ){
+                        victim = o;
+                        worst = d;
+                    }
+                }
+            }
+            else {
+                // the worst order of a currency is at the far end of its price index
+                for( std::map< Currency::CurrencySymbols, PriceIndex >::const_iterator prices = m_byPrice.begin(); prices != m_byPrice.end(); prices++ ){
+                    if( group == CURRENCY && (*prices).first != order->m_currency ) continue;
+                    const PriceIndex & index = (*prices).second;
+                    Order * candidate = NULL;
+                    if( order->m_orderType == Order::ASK ){
+                        for( PriceIndex::const_reverse_iterator it = index.rbegin(); it != index.rend() && !candidate; it++ ){
+                            Order * o = (*it).second;
+                            if( !o->m_isMyOrder && !o->m_locked && o->m_commitment == 0 ) candidate = o;
+                        }
+                    }
+                    else {
+                        for( PriceIndex::const_iterator it = index.begin(); it != index.end() && !candidate; it++ ){
+                            Order * o = (*it).second;
+                            if( !o->m_isMyOrder && !o->m_locked && o->m_commitment == 0 ) candidate = o;
+                        }
+                    }
+                    if( candidate == NULL ) continue;
+                    ZR::ZR_Number d = distance( candidate, bestPrice( candidate->m_currency, candidate->m_orderType, order ) );
+                    if( victim == NULL || d > worst ){
+                        victim = candidate;
+                        worst = d;
+                    }
+                }
+            }
+            if( victim == NULL || distance( order, bestPrice( order->m_currency, order->m_orderType, order ) ) >= worst ){
+                m_rejected++;
+                return false;
+            }
+            m_evicted++;
+        }
+        evict( victim );
+    }
+}
+
+void OrderBook::evict( Order * order )
+{
+    std::cerr << "Zero Reserve: Order book full, evicting " << order->m_order_id << " from " << order->m_gateway << std::endl;
+    Order * evicted = remove( order->m_order_id );
+    if( evicted == NULL ) return;
+
+    OrderAggregator * aggregator = OrderAggregator::Instance();
+    if( aggregator->enabled() ){
+        OrderBook::Order gone( *evicted );   // leaves its price level
+        gone.m_purpose = Order::CANCEL;
+        OrderBook::Order level;
+        if( aggregator->update( gone, level ) ){
+            p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+            p3zr->publishOrder( &level );
+        }
+    }
+    delete evicted;
+}
+
+void OrderBook::getUsage( Usage & usage )
+{
+    RsStackMutex orderMutex( m_order_mutex );
+    usage.orders = m_orders.size();
+    usage.bytes = 0;
+    for( OrderIterator it = m_orders.begin(); it != m_orders.end(); it++ ){
+        const Order * order = *it;
+        usage.bytes += sizeof( Order ) + sizeof( Order* ) + order->m_order_id.capacity() + order->m_btcAddr.capacity() +
+                       order->m_gateway.capacity() + order->m_matched.size() * ( sizeof( Order::ID ) + 64 );
+    }
+    usage.evicted = m_evicted;
+    usage.rejected = m_rejected;
+}
+
 ZR::RetVal OrderBook::processMyOrder( Order* order )
 {
     ZR::RetVal retval = ZR::ZR_SUCCESS;
     p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
 
+    if( order->m_execution != Order::LIMIT ){
+        // nobody can buy from an ask that is not published - only bids execute on the spot
+        if( order->m_orderType != Order::BID ){
+            g_ZeroReservePlugin->placeMsg( "Only buy orders can be immediate or market orders" );
+            delete order;
+            return ZR::ZR_FAILURE;
+        }
+        // neither stored nor published, it is gone once its contracts are
+        m_myOrders->addOrder( order );
+        MyOrders::Instance()->execute( order );
+        return ZR::ZR_SUCCESS;
+    }
+
     try {
         ZrDB::Instance()->addOrder( order );
     }
@@ -182,6 +395,7 @@ ZR::RetVal OrderBook::processOrder( Order* order )
 
     if( Order::PARTLY_FILLED == order->m_purpose ){
         Order * _o = NULL;
+        bool known = false;
         {
             RsStackMutex orderMutex( m_order_mutex );
             for(OrderIterator it = m_orders.begin(); it != m_orders.end(); it++){
@@ -191,10 +405,13 @@ ZR::RetVal OrderBook::processOrder( Order* order )
                         return ZR::ZR_FINISH; // we have this update already - do nothing
                     }
                     order->m_ignored = _o->m_ignored;
+                    known = true;
                     break;
                 }
             }
         }
+        if( !known && !admit( order ) )
+            return ZR::ZR_FINISH;
         remove( order->m_order_id );  // remove so it gets reinserted with the updates values below.
         addOrder( order );            // add even if we don't have it yet
         return ZR::ZR_SUCCESS;
@@ -203,7 +420,31 @@ ZR::RetVal OrderBook::processOrder( Order* order )
     if( find( order->m_order_id ) != NULL )
             return ZR::ZR_FINISH; // order already in book
 
+    if( Order::REPLACE == order->m_purpose && !order->m_replaces.empty() ){
+        if( m_myOrders->find( order->m_replaces ) != NULL )
+            return ZR::ZR_FAILURE; // nobody else replaces my own orders
+
+        // only what came from the same friend is replaced, anybody could name the old ID
+        bool sameGateway = false;
+        {
+            RsStackMutex orderMutex( m_order_mutex );
+            for( OrderIterator it = m_orders.begin(); it != m_orders.end(); it++ ){
+                if( (*it)->m_order_id != order->m_replaces ) continue;
+                sameGateway = ( (*it)->m_gateway == order->m_gateway );
+                break;
+            }
+        }
+        // like a partly filled order, the old one may still be in a TX, so it is not deleted
+        Order * oldOrder = ( sameGateway )? remove( order->m_replaces ) : NULL;
+        if( oldOrder ){
+            order->m_ignored = oldOrder->m_ignored;
+            return addOrder( order );   // it had its place in the book already
+        }
+    }
+
     // its a new order we don't have yet
+    if( !admit( order ) )
+        return ZR::ZR_FINISH;
     return addOrder( order );
 }
 
@@ -216,6 +457,8 @@ ZR::RetVal OrderBook::addOrder( Order * order )
 
     RsStackMutex orderMutex( m_order_mutex );
     m_orders.append( order );
+    indexOrder( order );
+    notifyChanged( order, false );
 
     if( order->m_currency != m_currency ) return ZR::ZR_SUCCESS;
 
@@ -233,6 +476,8 @@ OrderBook::Order * OrderBook::remove( const std::string & order_id )
         if( order_id == (*it)->m_order_id ){
             Order * order = *it;
             m_orders.erase( it );
+            unindexOrder( order );
+            notifyChanged( order, true );
             ZrDB::Instance()->deleteOrder( order);
             beginResetModel();
             filterOrders( m_filteredOrders, m_currency );
@@ -243,6 +488,34 @@ OrderBook::Order * OrderBook::remove( const std::string & order_id )
     return NULL;
 }
 
+void OrderBook::addListener( Listener * listener )
+{
+    RsStackMutex listenerMutex( m_listener_mutex );
+    m_listeners.push_back( listener );
+}
+
+void OrderBook::removeListener( Listener * listener )
+{
+    RsStackMutex listenerMutex( m_listener_mutex );
+    m_listeners.remove( listener );
+}
+
+void OrderBook::notifyChanged( Order * order, bool removed )
+{
+    RsStackMutex listenerMutex( m_listener_mutex );
+    for( std::list< Listener * >::const_iterator it = m_listeners.begin(); it != m_listeners.end(); it++ ){
+        (*it)->orderChanged( this, order, removed );
+    }
+}
+
+void OrderBook::notifyFilled( const Order * order, const ZR::ZR_Number & amount )
+{
+    RsStackMutex listenerMutex( m_listener_mutex );
+    for( std::list< Listener * >::const_iterator it = m_listeners.begin(); it != m_listeners.end(); it++ ){
+        (*it)->orderFilled( order, amount );
+    }
+}
+
 OrderBook::Order * OrderBook::find( const std::string & order_id )
 {
     RsStackMutex orderMutex( m_order_mutex );
@@ -279,6 +552,16 @@ void OrderBook::Order::setOrderId()
 }
 
 
+bool OrderBook::Order::mergeInto( Order & newer ) const
+{
+    if( m_purpose != REPLACE ) return true;
+    if( newer.m_purpose != PARTLY_FILLED && newer.m_purpose != REPLACE ) return false;
+    newer.m_purpose = REPLACE;
+    newer.m_replaces = m_replaces;
+    return true;
+}
+
+
 bool OrderBook::Order::operator == ( const OrderBook::Order & other )
 {
     if( m_order_id == other.m_order_id )
@@ -27,6 +27,8 @@
 #include <QDateTime>
 #include <QList>
 #include <set>
+#include <list>
+#include <map>
 
 
 
@@ -52,16 +54,23 @@ public:
                        CANCEL,          // tell everyone I changed my mind
                        FILLED,          // tell everyone this order is gone
                        PARTLY_FILLED,   // everybody update the order book
-                       SELL             // tell the buyer through a tunnel that there is a match
+                       SELL,            // tell the buyer through a tunnel that there is a match
                                         // an ask market order will not be published
                                         // bid market orders go to execution right away.
+                       REPLACE          // new price or amount, takes the place of m_replaces
                      };
+        enum Execution { LIMIT = 0,     // rests in the book until filled or cancelled
+                         IOC,           // immediate or cancel: buys what crosses now, the rest is cancelled
+                         MARKET         // like IOC, at any price
+                       };
 
         Order( bool isMyOrder = false ) :
             m_isMyOrder( isMyOrder),
             m_commitment( 0 ),
             m_locked( false ),
-            m_ignored( false )
+            m_ignored( false ),
+            m_hops( 0 ),
+            m_execution( LIMIT )
         {}
 
         ID m_order_id; // hashed from order attributes, a secret and randomness
@@ -78,10 +87,18 @@ public:
         bool m_locked;                   // ongoing transaction on buyer side locks this order from matching
         bool m_ignored;                  // this order failed a tx and is no longer shown or matched
         std::set< ID > m_matched;            // already matched counterparty orders
+        unsigned int m_hops;                 // distance to the originator of the order, 0 for my orders
+        std::string m_gateway;               // the friend who sent us the order, empty for my orders
+        Execution m_execution;               // my orders only, IOC and MARKET are never published
+        ID m_replaces;                       // REPLACE only: the order this one was amended from
 
         bool operator == (const Order & other);
         bool operator < ( const Order & other) const;
         void setOrderId();
+        /** let newer, a later state of this order, go out in its place. A REPLACE stays one, so the
+         *  receivers learn which order it replaces
+         *  @return false if newer ends the order before the REPLACE went out - both have to go out then */
+        bool mergeInto( Order & newer ) const;
 
         static const qint64 timeout;
     };
@@ -90,6 +107,29 @@ public:
     typedef QList<Order*>::iterator OrderIterator;
     typedef QList<Order*> OrderList;
 
+    /** what the book costs us, see the MAX_ORDERS* settings */
+    class Usage
+    {
+    public:
+        Usage() : orders( 0 ), bytes( 0 ), evicted( 0 ), rejected( 0 ) {}
+        unsigned int orders;
+        unsigned long bytes;       // estimate of the heap used by the orders
+        unsigned long evicted;     // orders dropped to make room for better ones
+        unsigned long rejected;    // orders not taken because the book was full of better ones
+    };
+
+    /** gets to know every change of the books it listens to, e.g. @see ZrApiServer. Called with m_order_mutex held,
+     *  it may read the book but must not call back into it */
+    class Listener
+    {
+    public:
+        virtual ~Listener(){}
+        /** an order came into the book or left it */
+        virtual void orderChanged( OrderBook * book, const Order * order, bool removed ) = 0;
+        /** one of my orders was filled by amount, @see MyOrders::notifyFilled */
+        virtual void orderFilled( const Order * order, const ZR::ZR_Number & amount ) = 0;
+    };
+
     explicit OrderBook();
     virtual ~OrderBook();
 
@@ -112,6 +152,16 @@ public:
 
     void filterOrders(OrderList & filteredOrders , const Currency::CurrencySymbols currencySym);
 
+    /**
+     * @brief is the order close enough to the top of the book to be worth forwarding
+     * @param band maximum distance from the best price as fraction of it, 0 to ignore
+     * @param topLevels maximum number of better price levels, 0 to ignore
+     * @return true if it satisfies one of the criteria, or if both are off
+     */
+    bool isCompetitive( const Order * order, const ZR::ZR_Number & band, unsigned int topLevels );
+
+    void getUsage( Usage & usage );
+
     /** remove an order from the book
      *  @param order Template for the order to match. Relevant fields: Id, timestamp and currency
      *  @return a pointer to the removed order */
@@ -123,12 +173,24 @@ public:
 
     virtual ZR::RetVal addOrder( Order* order );
 
+    void addListener( Listener * listener );
+    void removeListener( Listener * listener );
+    /** tell the listeners that order was filled by amount. Its m_amount is what is left of it */
+    virtual void notifyFilled( const Order * order, const ZR::ZR_Number & amount );
+
     mutable RsMutex m_order_mutex;
 
 protected:
+    void notifyChanged( Order * order, bool removed );
+
+    std::list< Listener * > m_listeners;
+    RsMutex m_listener_mutex;
 
     OrderList m_orders;
     OrderList m_filteredOrders;
+    typedef std::multimap< ZR::ZR_Number, Order * > PriceIndex;
+    std::map< Currency::CurrencySymbols, PriceIndex > m_byPrice;    // m_orders per currency, for admit()
+    std::map< std::string, std::set< Order * > > m_byGateway;       // m_orders per gateway, for admit()
     Currency::CurrencySymbols m_currency;
     OrderBook * m_myOrders;
 
@@ -138,6 +200,26 @@ public slots:
 
 private:
     static bool compareOrder( const Order * left, const Order * right );
+
+    /**
+     * @brief make room for an order of someone else if the book is full
+     * When the order exceeds the cap of its gateway, its currency or the total, the worst priced
+     * order in that group is evicted - unless the new order is worse itself.
+     * @return false if the order should not be taken
+     */
+    bool admit( const Order * order );
+    /** take the order out through remove(), so listeners and the aggregator learn it is gone */
+    void evict( Order * order );
+    /** how far off the best price an order is, as a fraction of it. Comparable across currencies */
+    static ZR::ZR_Number distance( const Order * order, const ZR::ZR_Number & best );
+    /** best price of the orders of type in currency, candidate included if it is one of them. Call with m_order_mutex held */
+    ZR::ZR_Number bestPrice( Currency::CurrencySymbols currency, Order::OrderType type, const Order * candidate );
+    /** keep m_byPrice and m_byGateway in step with m_orders. Call with m_order_mutex held */
+    void indexOrder( Order * order );
+    void unindexOrder( Order * order );
+
+    unsigned long m_evicted;
+    unsigned long m_rejected;
 };
 
 #endif // ORDERBOOK_H
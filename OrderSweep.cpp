@@ -0,0 +1,142 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "OrderSweep.h"
+#include "MyOrders.h"
+#include "ZeroReservePlugin.h"
+#include "p3ZeroReserverRS.h"
+#include "zrdb.h"
+
+#include <iostream>
+#include <stdexcept>
+
+
+OrderSweep::OrderSweep( OrderBook::Order * myOrder ) :
+    m_myOrder( myOrder ),
+    m_refs( 1 ),
+    m_bought( 0 ),
+    m_mutex( "order_sweep_mutex" )
+{
+    myOrder->m_locked = true;
+}
+
+void OrderSweep::attach()
+{
+    RsStackMutex mutex( m_mutex );
+    m_refs++;
+}
+
+void OrderSweep::detach()
+{
+    {
+        RsStackMutex mutex( m_mutex );
+        if( --m_refs > 0 ) return;
+    }
+    finish();
+    delete this;
+}
+
+ZR::ZR_Number OrderSweep::available( const ZR::PeerAddress & gateway, const ZR::ZR_Number & credit )
+{
+    RsStackMutex mutex( m_mutex );
+    std::map< ZR::PeerAddress, ZR::ZR_Number >::const_iterator it = m_reserved.find( gateway );
+    if( it == m_reserved.end() ) return credit;
+    return credit - it->second;
+}
+
+void OrderSweep::reserve( const ZR::PeerAddress & gateway, const ZR::ZR_Number & fiatAmount )
+{
+    RsStackMutex mutex( m_mutex );
+    m_reserved[ gateway ] += fiatAmount;
+}
+
+void OrderSweep::unreserve( const ZR::PeerAddress & gateway, const ZR::ZR_Number & fiatAmount )
+{
+    RsStackMutex mutex( m_mutex );
+    std::map< ZR::PeerAddress, ZR::ZR_Number >::iterator it = m_reserved.find( gateway );
+    if( it == m_reserved.end() ) return;
+    it->second -= fiatAmount;
+    if( it->second <= 0 ) m_reserved.erase( it );
+}
+
+ZR::RetVal OrderSweep::filled( const ZR::ZR_Number & btcAmount )
+{
+    RsStackMutex mutex( m_mutex );
+    m_bought += btcAmount;
+    if( m_myOrder->m_amount <= btcAmount ){
+        m_myOrder->m_amount = 0;    // removed when the sweep is over
+        MyOrders::Instance()->notifyFilled( m_myOrder, btcAmount );
+        return ZR::ZR_SUCCESS;
+    }
+    if( m_myOrder->m_execution != OrderBook::Order::LIMIT ){
+        m_myOrder->m_amount -= btcAmount;   // not stored, not published
+        MyOrders::Instance()->notifyFilled( m_myOrder, btcAmount );
+        return ZR::ZR_SUCCESS;
+    }
+
+    MyOrders::Instance()->beginReset();
+    MyOrders::Instance()->getBids()->beginReset();
+
+    m_myOrder->m_amount -= btcAmount;
+    m_myOrder->m_purpose = OrderBook::Order::PARTLY_FILLED;
+    MyOrders::Instance()->notifyFilled( m_myOrder, btcAmount );
+
+    ZR::RetVal result = ZR::ZR_SUCCESS;
+    try{
+        ZrDB::Instance()->updateOrder( m_myOrder );
+    }
+    catch( std::runtime_error e ){
+        g_ZeroReservePlugin->placeMsg( std::string( "Exception caught: " ) + e.what() + " Cannot update order " + m_myOrder->m_order_id );
+        result = ZR::ZR_FAILURE;
+    }
+
+    MyOrders::Instance()->getBids()->endReset();
+    MyOrders::Instance()->endReset();
+
+    if( result == ZR::ZR_SUCCESS ){
+        p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+        p3zr->publishOrder( m_myOrder );
+    }
+    return result;
+}
+
+void OrderSweep::finish()
+{
+    if( m_bought > 0 )
+        std::cerr << "Zero Reserve: Sweep of " << m_myOrder->m_order_id << " bought " << m_bought.toStdString() << std::endl;
+
+    if( m_myOrder->m_execution != OrderBook::Order::LIMIT ){
+        // what an immediate order did not get now is cancelled
+        MyOrders::Instance()->remove( m_myOrder->m_order_id );
+        delete m_myOrder;
+        m_myOrder = NULL;
+        return;
+    }
+
+    if( m_myOrder->m_amount > 0 ){
+        m_myOrder->m_locked = false;    // rest is up for the next match
+        return;
+    }
+
+    MyOrders::Instance()->getBids()->remove( m_myOrder->m_order_id );
+    MyOrders::Instance()->remove( m_myOrder->m_order_id );
+    m_myOrder->m_purpose = OrderBook::Order::FILLED;
+    p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+    p3zr->publishOrder( m_myOrder );
+    delete m_myOrder;
+    m_myOrder = NULL;
+}
@@ -0,0 +1,73 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ORDERSWEEP_H
+#define ORDERSWEEP_H
+
+#include "zrtypes.h"
+#include "OrderBook.h"
+
+#include "util/rsthreads.h"
+
+#include <map>
+
+/**
+ * @brief Fills one of my bids from several asks at once
+ *
+ * MyOrders splits a bid across all crossing asks and starts a @see TmContractCoordinator per ask.
+ * They all run concurrently and share the sweep: it holds the bid locked while any of them runs,
+ * keeps the credit each one claims on a gateway so they do not all count on the same credit,
+ * and takes the fills off the bid one at a time. When the last of them is gone, the bid is
+ * unlocked for the next match or, if nothing is left of it, removed. IOC and MARKET bids are
+ * removed either way.
+ *
+ * The sweep deletes itself on the last detach(). Whoever creates it holds the first reference.
+ */
+
+class OrderSweep
+{
+public:
+    OrderSweep( OrderBook::Order * myOrder );
+
+    /** a coordinator joins the sweep */
+    void attach();
+    /** a coordinator is done with the sweep. Do not touch the sweep after this */
+    void detach();
+
+    /** what is left of credit on gateway after the claims of the other coordinators */
+    ZR::ZR_Number available( const ZR::PeerAddress & gateway, const ZR::ZR_Number & credit );
+    void reserve( const ZR::PeerAddress & gateway, const ZR::ZR_Number & fiatAmount );
+    void unreserve( const ZR::PeerAddress & gateway, const ZR::ZR_Number & fiatAmount );
+
+    /** a coordinator bought btcAmount, take it off the bid */
+    ZR::RetVal filled( const ZR::ZR_Number & btcAmount );
+
+    OrderBook::Order * getOrder(){ return m_myOrder; }
+
+private:
+    ~OrderSweep(){}
+    /** the last coordinator is gone */
+    void finish();
+
+    OrderBook::Order * m_myOrder;
+    unsigned int m_refs;
+    ZR::ZR_Number m_bought;
+    std::map< ZR::PeerAddress, ZR::ZR_Number > m_reserved;   // fiat claimed per gateway
+    RsMutex m_mutex;
+};
+
+#endif // ORDERSWEEP_H
@@ -21,6 +21,7 @@
 
 
 #include "serialiser/rsbaseserial.h"
+#include <algorithm>
 
 #include"ZeroReservePlugin.h"
 
@@ -122,6 +123,92 @@ RSZRRemoteTxItem::RSZRRemoteTxItem( const ZR::VirtualAddress & addr, Transaction
 
 
 
+//// Begin RSZRRemoteProbeItem Item  /////
+
+
+std::ostream& RSZRRemoteProbeItem::print(std::ostream &out, uint16_t indent)
+{
+        printRsItemBase(out, "RSZRRemoteProbeItem", indent);
+        uint16_t int_Indent = indent + 2;
+        printIndent(out, int_Indent);
+        out << "Probe   : " << m_ProbeId << std::endl;
+
+        printIndent(out, int_Indent);
+        out << "Capacity: " << m_Capacity << " " << m_Currency << std::endl;
+
+        printRsItemEnd(out, "RSZRRemoteProbeItem", indent);
+        return out;
+}
+
+uint32_t RSZRRemoteProbeItem::serial_size() const
+{
+        return  RSZRRemoteItem::serial_size()
+                + sizeof(uint8_t)   // direction
+                + m_ProbeId.length() + HOLLERITH_LEN_SPEC
+                + m_Currency.length() + HOLLERITH_LEN_SPEC
+                + m_Capacity.length() + HOLLERITH_LEN_SPEC;
+}
+
+bool RSZRRemoteProbeItem::serialise(void *data, uint32_t& pktsize)
+{
+        uint32_t tlvsize = serial_size() ;
+
+        if (pktsize < tlvsize)
+                return false; /* not enough space */
+
+        pktsize = tlvsize;
+
+        bool ok = RSZRRemoteItem::serialise( data,  pktsize);
+        ok &= setRawUInt8( data, tlvsize, &m_Offset, m_Direction );
+        ok &= setRawString( data, tlvsize, &m_Offset, m_ProbeId );
+        ok &= setRawString( data, tlvsize, &m_Offset, m_Currency );
+        ok &= setRawString( data, tlvsize, &m_Offset, m_Capacity.toStdString() );
+
+        if (m_Offset != tlvsize){
+                ok = false;
+                std::cerr << "RSZRRemoteProbeItem::serialise() Size Error! " << std::endl;
+        }
+
+        return ok;
+}
+
+RSZRRemoteProbeItem::RSZRRemoteProbeItem(void *data, uint32_t pktsize )
+        : RSZRRemoteItem( data, pktsize, ZR_REMOTE_PROBE_ITEM )
+{
+    /* get the type and size */
+    uint32_t rstype = getRsItemId( data );
+    uint32_t rssize = getRsItemSize( data );
+
+    if ((RS_PKT_VERSION_SERVICE != getRsItemVersion(rstype)) || (RS_SERVICE_TYPE_ZERORESERVE_PLUGIN != getRsItemService(rstype)) || (ZR_REMOTE_PROBE_ITEM != getRsItemSubType(rstype)))
+        throw std::runtime_error("Wrong packet type!") ;
+
+    if (pktsize < rssize)    /* check size */
+        throw std::runtime_error("Not enough size!") ;
+
+    uint8_t direction;
+    bool ok = getRawUInt8( data, rssize, &m_Offset, &direction );
+    m_Direction = ( Router::TunnelDirection ) direction;
+    ok &= getRawString( data, rssize, &m_Offset, m_ProbeId );
+    ok &= getRawString( data, rssize, &m_Offset, m_Currency );
+    std::string capacity;
+    ok &= getRawString( data, rssize, &m_Offset, capacity );
+    m_Capacity = ZR::ZR_Number::fromFractionString( capacity );
+
+    if (m_Offset != rssize || !ok )
+        throw std::runtime_error("Deserialisation error!") ;
+}
+
+RSZRRemoteProbeItem::RSZRRemoteProbeItem( const ZR::VirtualAddress & addr, Router::TunnelDirection direction, const std::string & probeId,
+                                          const std::string & currency, const ZR::ZR_Number & capacity )
+        : RSZRRemoteItem( addr, ZR_REMOTE_PROBE_ITEM ),
+          m_Direction( direction ),
+          m_ProbeId( probeId ),
+          m_Currency( currency ),
+          m_Capacity( capacity )
+{}
+
+
+
 //// Begin OrderBook Item  /////
 
 
@@ -144,6 +231,11 @@ std::ostream& RsZeroReserveOrderBookItem::print(std::ostream &out, uint16_t inde
         printIndent(out, int_Indent);
         out << "Purpose : " << m_order.m_purpose << std::endl;
 
+        if( m_order.m_purpose == OrderBook::Order::REPLACE ){
+            printIndent(out, int_Indent);
+            out << "Replaces: " << m_order.m_replaces << std::endl;
+        }
+
         printIndent(out, int_Indent);
         printRsItemEnd(out, "RsZeroReserveOrderBookItem", indent);
         return out;
@@ -159,6 +251,11 @@ uint32_t RsZeroReserveOrderBookItem::serial_size() const
         s += sizeof(uint64_t);
         s += m_order.m_order_id.length() + HOLLERITH_LEN_SPEC;
         s += sizeof( uint8_t );  // purpose
+        if( !m_extended ) return s;
+
+        s += sizeof( uint8_t );  // hops
+        if( m_order.m_purpose == OrderBook::Order::REPLACE )
+            s += m_order.m_replaces.length() + HOLLERITH_LEN_SPEC;
 
         return s;
 }
@@ -181,6 +278,12 @@ bool RsZeroReserveOrderBookItem::serialise(void *data, uint32_t& pktsize)
         ok &= setRawUInt64( data, tlvsize, &m_Offset, m_order.m_timeStamp );
         ok &= setRawString( data, tlvsize, &m_Offset, m_order.m_order_id );
         ok &= setRawUInt8( data, tlvsize, &m_Offset, m_order.m_purpose );
+        // the original layout ends here, older peers reject anything after it
+        if( m_extended ){
+            ok &= setRawUInt8( data, tlvsize, &m_Offset, std::min( m_order.m_hops, 255u ) );
+            if( m_order.m_purpose == OrderBook::Order::REPLACE )
+                ok &= setRawString( data, tlvsize, &m_Offset, m_order.m_replaces );
+        }
 
         if (m_Offset != tlvsize){
                 ok = false;
@@ -191,13 +294,15 @@ bool RsZeroReserveOrderBookItem::serialise(void *data, uint32_t& pktsize)
 }
 
 RsZeroReserveOrderBookItem::RsZeroReserveOrderBookItem(void *data, uint32_t pktsize)
-        : RSZRRemoteItem( data, pktsize, ZERORESERVE_ORDERBOOK_ITEM )
+        : RSZRRemoteItem( data, pktsize, getRsItemSubType( getRsItemId( data ) ) ),
+        m_extended( getRsItemSubType( getRsItemId( data ) ) == ZERORESERVE_ORDERBOOK_EXT_ITEM )
 {
     /* get the type and size */
     uint32_t rstype = getRsItemId(data);
     uint32_t rssize = getRsItemSize(data);
 
-    if ((RS_PKT_VERSION_SERVICE != getRsItemVersion(rstype)) || (RS_SERVICE_TYPE_ZERORESERVE_PLUGIN != getRsItemService(rstype)) || (ZERORESERVE_ORDERBOOK_ITEM != getRsItemSubType(rstype)))
+    if ((RS_PKT_VERSION_SERVICE != getRsItemVersion(rstype)) || (RS_SERVICE_TYPE_ZERORESERVE_PLUGIN != getRsItemService(rstype)) ||
+            (ZERORESERVE_ORDERBOOK_ITEM != getRsItemSubType(rstype) && ZERORESERVE_ORDERBOOK_EXT_ITEM != getRsItemSubType(rstype)))
         throw std::runtime_error("Wrong packet type!") ;
 
     if (pktsize < rssize)    /* check size */
@@ -233,13 +338,169 @@ RsZeroReserveOrderBookItem::RsZeroReserveOrderBookItem(void *data, uint32_t pkts
     ok &= getRawUInt8(data, rssize, &m_Offset, &order_purpose );
     m_order.m_purpose = (OrderBook::Order::Purpose) order_purpose;
 
+    if( m_extended ){
+        uint8_t hops;
+        ok &= getRawUInt8(data, rssize, &m_Offset, &hops );
+        m_order.m_hops = hops;
+        if( m_order.m_purpose == OrderBook::Order::REPLACE )
+            ok &= getRawString(data, rssize, &m_Offset, m_order.m_replaces );
+    }
+
+    if (m_Offset != rssize || !ok )
+        throw std::runtime_error("Deserialisation error!") ;
+}
+
+RsZeroReserveOrderBookItem::RsZeroReserveOrderBookItem( OrderBook::Order & order, bool extended )
+        : RSZRRemoteItem( order.m_order_id, extended ? ZERORESERVE_ORDERBOOK_EXT_ITEM : ZERORESERVE_ORDERBOOK_ITEM ),
+        m_order( order ),
+        m_extended( extended )
+{
+
+}
+
+
+//// Begin OrderBatch Item  /////
+
+const unsigned int RsZeroReserveOrderBatchItem::MAX_ORDERS = 100;
+
+
+std::ostream& RsZeroReserveOrderBatchItem::print(std::ostream &out, uint16_t indent)
+{
+        printRsItemBase(out, "RsZeroReserveOrderBatchItem", indent);
+        uint16_t int_Indent = indent + 2;
+        printIndent(out, int_Indent);
+        out << "Orders  : " << m_orders.size() << std::endl;
+
+        for( OrderVector::const_iterator it = m_orders.begin(); it != m_orders.end(); it++ ){
+            printIndent(out, int_Indent);
+            out << "ID      : " << (*it).m_order_id << " Purpose: " << (*it).m_purpose << std::endl;
+        }
+
+        printIndent(out, int_Indent);
+        printRsItemEnd(out, "RsZeroReserveOrderBatchItem", indent);
+        return out;
+}
+
+uint32_t RsZeroReserveOrderBatchItem::serial_size() const
+{
+        uint32_t s = RsZeroReserveItem::serial_size();
+        s += sizeof(uint32_t); // the number of orders
+        for( OrderVector::const_iterator it = m_orders.begin(); it != m_orders.end(); it++ ){
+            const OrderBook::Order & order = *it;
+            s += order.m_amount.length() + HOLLERITH_LEN_SPEC;
+            s += CURRENCY_STRLEN + HOLLERITH_LEN_SPEC;
+            s += sizeof(uint8_t); // the type (BID / ASK)
+            s += order.m_price.length() + HOLLERITH_LEN_SPEC;
+            s += sizeof(uint64_t);
+            s += order.m_order_id.length() + HOLLERITH_LEN_SPEC;
+            s += sizeof( uint8_t );  // purpose
+            s += sizeof( uint8_t );  // hops
+            if( order.m_purpose == OrderBook::Order::REPLACE )
+                s += order.m_replaces.length() + HOLLERITH_LEN_SPEC;
+        }
+
+        return s;
+}
+
+bool RsZeroReserveOrderBatchItem::serialise(void *data, uint32_t& pktsize)
+{
+        uint32_t tlvsize = serial_size() ;
+
+        if (pktsize < tlvsize)
+                return false; /* not enough space */
+
+        pktsize = tlvsize;
+
+        bool ok = RsZeroReserveItem::serialise( data, pktsize );
+
+        ok &= setRawUInt32( data, tlvsize, &m_Offset, m_orders.size() );
+        for( OrderVector::const_iterator it = m_orders.begin(); it != m_orders.end(); it++ ){
+            const OrderBook::Order & order = *it;
+            ok &= setRawString( data, tlvsize, &m_Offset, order.m_amount.toStdString() );
+            ok &= setRawString( data, tlvsize, &m_Offset, Currency::currencySymbols[ order.m_currency ] );
+            ok &= setRawUInt8( data, tlvsize, &m_Offset, order.m_orderType );
+            ok &= setRawString( data, tlvsize, &m_Offset, order.m_price.toStdString() );
+            ok &= setRawUInt64( data, tlvsize, &m_Offset, order.m_timeStamp );
+            ok &= setRawString( data, tlvsize, &m_Offset, order.m_order_id );
+            ok &= setRawUInt8( data, tlvsize, &m_Offset, order.m_purpose );
+            ok &= setRawUInt8( data, tlvsize, &m_Offset, std::min( order.m_hops, 255u ) );
+            if( order.m_purpose == OrderBook::Order::REPLACE )
+                ok &= setRawString( data, tlvsize, &m_Offset, order.m_replaces );
+        }
+
+        if (m_Offset != tlvsize){
+                ok = false;
+                std::cerr << "RsZeroReserveOrderBatchItem::serialise() Size Error! " << std::endl;
+        }
+
+        return ok;
+}
+
+RsZeroReserveOrderBatchItem::RsZeroReserveOrderBatchItem(void *data, uint32_t pktsize)
+        : RsZeroReserveItem( data, pktsize, ZERORESERVE_ORDERBATCH_ITEM )
+{
+    /* get the type and size */
+    uint32_t rstype = getRsItemId(data);
+    uint32_t rssize = getRsItemSize(data);
+
+    if ((RS_PKT_VERSION_SERVICE != getRsItemVersion(rstype)) || (RS_SERVICE_TYPE_ZERORESERVE_PLUGIN != getRsItemService(rstype)) || (ZERORESERVE_ORDERBATCH_ITEM != getRsItemSubType(rstype)))
+        throw std::runtime_error("Wrong packet type!") ;
+
+    if (pktsize < rssize)    /* check size */
+        throw std::runtime_error("Not enough size!") ;
+
+    bool ok = true;
+
+    uint32_t count;
+    ok &= getRawUInt32(data, rssize, &m_Offset, &count );
+    if( !ok || count > MAX_ORDERS )
+        throw std::runtime_error("Deserialisation error!") ;
+
+    m_orders.resize( count );
+    for( uint32_t i = 0; i < count && ok; i++ ){
+        OrderBook::Order & order = m_orders[ i ];
+
+        std::string amount;
+        ok &= getRawString(data, rssize, &m_Offset, amount);
+        order.m_amount = ZR::ZR_Number::fromFractionString( amount );
+
+        std::string currency;
+        ok &= getRawString(data, rssize, &m_Offset, currency);
+        order.m_currency = Currency::getCurrencyBySymbol( currency );
+
+        uint8_t order_type;
+        ok &= getRawUInt8(data, rssize, &m_Offset, &order_type );
+        order.m_orderType = (OrderBook::Order::OrderType) order_type;
+
+        std::string price;
+        ok &= getRawString(data, rssize, &m_Offset, price);
+        order.m_price = ZR::ZR_Number::fromFractionString( price );
+
+        uint64_t timestamp;
+        ok &= getRawUInt64(data, rssize, &m_Offset, &timestamp );
+        order.m_timeStamp = timestamp;
+
+        ok &= getRawString(data, rssize, &m_Offset, order.m_order_id);
+
+        uint8_t order_purpose;
+        ok &= getRawUInt8(data, rssize, &m_Offset, &order_purpose );
+        order.m_purpose = (OrderBook::Order::Purpose) order_purpose;
+
+        uint8_t hops;
+        ok &= getRawUInt8(data, rssize, &m_Offset, &hops );
+        order.m_hops = hops;
+
+        if( order.m_purpose == OrderBook::Order::REPLACE )
+            ok &= getRawString(data, rssize, &m_Offset, order.m_replaces );
+    }
+
     if (m_Offset != rssize || !ok )
         throw std::runtime_error("Deserialisation error!") ;
 }
 
-RsZeroReserveOrderBookItem::RsZeroReserveOrderBookItem( OrderBook::Order & order)
-        : RSZRRemoteItem( order.m_order_id, ZERORESERVE_ORDERBOOK_ITEM ),
-        m_order( order )
+RsZeroReserveOrderBatchItem::RsZeroReserveOrderBatchItem( const OrderVector & orders )
+        : RsZeroReserveItem( ZERORESERVE_ORDERBATCH_ITEM ),
+        m_orders( orders )
 {
 
 }
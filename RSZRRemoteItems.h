@@ -25,6 +25,7 @@
 #include "Payment.h"
 
 #include <string>
+#include <vector>
 
 /**
  * @brief base class of all items which go beyond friends.
@@ -69,7 +70,8 @@ class RsZeroReserveOrderBookItem: public RSZRRemoteItem
     RsZeroReserveOrderBookItem();
 public:
     RsZeroReserveOrderBookItem( void *data,uint32_t size ) ;
-    RsZeroReserveOrderBookItem( OrderBook::Order & order ) ;
+    /** @param extended also send the hop count. Only for peers which announced ORDERS_EXTENDED */
+    RsZeroReserveOrderBookItem( OrderBook::Order & order, bool extended = true ) ;
 
     virtual bool serialise( void * data, uint32_t & size ) ;
     virtual uint32_t serial_size() const ;
@@ -80,9 +82,39 @@ public:
 
 private:
     OrderBook::Order m_order;
+    bool m_extended;            // ZERORESERVE_ORDERBOOK_EXT_ITEM, else the original layout
     uint32_t m_data_size ;
 };
 
+/**
+ * @brief many of my orders in one item, as placed or cancelled in bulk by @see MyOrders
+ * @see RsZeroReserveOrderBookItem
+ *
+ * The receiver handles each order as if it came in its own item. Peers pass them on one by one.
+ */
+
+class RsZeroReserveOrderBatchItem: public RsZeroReserveItem
+{
+    RsZeroReserveOrderBatchItem();
+public:
+    typedef std::vector< OrderBook::Order > OrderVector;
+
+    RsZeroReserveOrderBatchItem( void *data,uint32_t size ) ;
+    RsZeroReserveOrderBatchItem( const OrderVector & orders ) ;
+
+    virtual bool serialise( void * data, uint32_t & size ) ;
+    virtual uint32_t serial_size() const ;
+
+    virtual ~RsZeroReserveOrderBatchItem() {}
+    virtual std::ostream& print(std::ostream &out, uint16_t indent = 0);
+    const OrderVector & getOrders(){ return m_orders; }
+
+    static const unsigned int MAX_ORDERS;   // per item, more go in more items
+
+private:
+    OrderVector m_orders;
+};
+
 /**
  * @brief follows a route from the coordinator of a transaction (payer) to the payee and back.
  * @see RSZRRemoteTxInitItem
@@ -115,5 +147,38 @@ protected:
     std::string m_Payload;
 };
 
+/**
+ * @brief measures the bottleneck credit of a route before a transaction uses it.
+ * @see CapacityProbe
+ *
+ * Travels like a @see RSZRRemoteTxItem: SERVER towards the owner of the order, CLIENT back to the prober.
+ * Every node lowers the capacity to the credit it would accept from the node it got the probe from.
+ */
+
+class RSZRRemoteProbeItem : public RSZRRemoteItem
+{
+    RSZRRemoteProbeItem();
+public:
+
+    RSZRRemoteProbeItem( void *data, uint32_t size );
+    RSZRRemoteProbeItem( const ZR::VirtualAddress & addr, Router::TunnelDirection direction, const std::string & probeId,
+                         const std::string & currency, const ZR::ZR_Number & capacity );
+
+    virtual bool serialise(void *data,uint32_t& size) ;
+    virtual uint32_t serial_size() const ;
+    virtual std::ostream & print(std::ostream &out, uint16_t indent = 0);
+
+    Router::TunnelDirection getDirection() { return m_Direction; }
+    const std::string & getProbeId(){ return m_ProbeId; }
+    const std::string & getCurrency(){ return m_Currency; }
+    const ZR::ZR_Number & getCapacity(){ return m_Capacity; }
+
+protected:
+    Router::TunnelDirection m_Direction;
+    std::string m_ProbeId;
+    std::string m_Currency;
+    ZR::ZR_Number m_Capacity;
+};
+
 
 #endif // RSZRREMOTEITEMS_H
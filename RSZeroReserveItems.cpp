@@ -48,6 +48,7 @@ RsItem* RsZeroReserveSerialiser::deserialise(void *data, uint32_t *pktsize)
         switch(getRsItemSubType(rstype))
         {
         case RsZeroReserveItem::ZERORESERVE_ORDERBOOK_ITEM:
+        case RsZeroReserveItem::ZERORESERVE_ORDERBOOK_EXT_ITEM:
             return new RsZeroReserveOrderBookItem(data, *pktsize);
         case RsZeroReserveItem::ZERORESERVE_TX_INIT_ITEM:
             return new RsZeroReserveInitTxItem(data, *pktsize);
@@ -59,6 +60,10 @@ RsItem* RsZeroReserveSerialiser::deserialise(void *data, uint32_t *pktsize)
             return new RsZeroReserveMsgItem(data, *pktsize);
         case RsZeroReserveItem::ZR_REMOTE_TX_ITEM:
             return new RSZRRemoteTxItem( data, *pktsize );
+        case RsZeroReserveItem::ZR_REMOTE_PROBE_ITEM:
+            return new RSZRRemoteProbeItem( data, *pktsize );
+        case RsZeroReserveItem::ZERORESERVE_ORDERBATCH_ITEM:
+            return new RsZeroReserveOrderBatchItem( data, *pktsize );
         default:
             return NULL;
         }
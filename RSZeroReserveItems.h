@@ -59,7 +59,10 @@ public:
         ZERORESERVE_MSG_ITEM,
 
         ZR_REMOTE_BUYREQUEST_ITEM,
-        ZR_REMOTE_TX_ITEM
+        ZR_REMOTE_TX_ITEM,
+        ZR_REMOTE_PROBE_ITEM,
+        ZERORESERVE_ORDERBATCH_ITEM,
+        ZERORESERVE_ORDERBOOK_EXT_ITEM      // an order with the fields peers before the hop count do not know
     };
 
     virtual ~RsZeroReserveItem() {};
@@ -85,6 +88,8 @@ public:
     enum MsgType {
         REQUEST_ORDERBOOK,
         SENT_ORDERBOOK,
+        SUBSCRIBE,          // the message lists the currencies the sender wants orders in, ':' separated
+        FEATURES,           // the message lists the protocol extensions the sender understands, ':' separated
         INVALID
     };
 
@@ -20,6 +20,16 @@
 
 Router * Router::instance = 0;
 
+// the cost unit is a millisecond of round trip time
+static const qint64 HOP_COST = 500;          // assumed round trip per hop as long as nothing was measured
+static const qint64 FAILURE_COST = 60000;    // a failed attempt costs a transaction timeout
+
+
+qint64 Router::Candidate::cost() const
+{
+    qint64 latency = ( m_rtt > 0 )? m_rtt : m_hops * HOP_COST;
+    return latency + m_hops * HOP_COST / 10 + (qint64)( m_failureRate * FAILURE_COST );
+}
 
 
 Router * Router::Instance()
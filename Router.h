@@ -20,8 +20,11 @@
 
 #include "zrtypes.h"
 
+#include "util/rsthreads.h"
+
 #include <map>
 #include <string>
+#include <vector>
 
 
 /**
@@ -38,38 +41,99 @@
 class Router
 {
 public:
-    typedef std::map< ZR::VirtualAddress, std::pair< std::string, std::string > > TunnelList;
+    /** tunnels are keyed by the ID of the transaction which uses them */
+    typedef std::map< ZR::TransactionId, std::pair< std::string, std::string > > TunnelList;
     enum TunnelDirection {
         SERVER = 0,
         CLIENT
     };
 
-    virtual void addRoute( const ZR::VirtualAddress & dest, const std::string & gateway ) = 0;
+    class Stats
+    {
+    public:
+        Stats() : routes( 0 ), tunnels( 0 ), expired( 0 ), evicted( 0 ) {}
+        unsigned long routes;
+        unsigned long tunnels;
+        unsigned long expired;     // routes dropped because their order timed out
+        unsigned long evicted;     // least recently used routes dropped to make room
+    };
+
+    /** one of the possible next hops towards a destination */
+    class Candidate
+    {
+    public:
+        Candidate() : m_hops( 0 ), m_rtt( 0 ), m_failureRate( 0 ), m_credit( 0 ), m_probed( 0 ) {}
+        std::string m_gateway;
+        unsigned int m_hops;         // distance to the destination through this gateway
+        qint64 m_rtt;                // smoothed QUERY -> VOTE round trip in ms, 0 if never measured
+        double m_failureRate;        // smoothed, 0 .. 1
+        ZR::ZR_Number m_credit;      // bottleneck credit of the path through this gateway, see CapacityProbe
+        qint64 m_probed;             // time m_credit was measured, 0 if never
+
+        /** lower is better */
+        qint64 cost() const;
+    };
+    typedef std::vector< Candidate > CandidateList;
+
+    Router() : m_routerMutex( "router_mutex" ) {}
+    virtual ~Router(){}
+
+    /**
+     * learn a route. Several gateways may lead to the same destination, they are all kept as candidates.
+     * @arg expires: time in ms since epoch after which the route is dropped, 0 for the default TTL
+     * @arg hops: the distance to dest through this gateway
+     */
+    virtual void addRoute( const ZR::VirtualAddress & dest, const std::string & gateway, qint64 expires = 0, unsigned int hops = 1 ) = 0;
 
-    /** Query next hop of a route */
+    /** Query next hop of a route - the candidate with the lowest cost */
     virtual const std::string nextHop( const ZR::VirtualAddress & dest ) = 0;
     virtual bool hasRoute( const ZR::VirtualAddress & dest ) = 0;
+    /** all candidates for dest, best first */
+    virtual void getRoutes( const ZR::VirtualAddress & dest, CandidateList & candidates ) = 0;
+
+    /** feed back the outcome of a transaction through gateway, to rank the candidates */
+    virtual void reportSuccess( const ZR::VirtualAddress & dest, const std::string & gateway, qint64 rtt ) = 0;
+    virtual void reportFailure( const ZR::VirtualAddress & dest, const std::string & gateway ) = 0;
+    /** the result of a @see CapacityProbe through gateway */
+    virtual void reportCapacity( const ZR::VirtualAddress & dest, const std::string & gateway, const ZR::ZR_Number & credit ) = 0;
+
+    /** drop expired routes, call this periodically */
+    virtual void timeout() = 0;
+    virtual void getStats( Stats & stats ) = 0;
 
     /**
      * adds a virtual tunnel
-     * @arg dest: the virtual address
+     * @arg txId: the transaction using the tunnel
      * @arg gateways: a pair of the IDs of the hop forward and the hop backward
      */
-    virtual void addTunnel( const ZR::VirtualAddress & dest, std::pair< ZR::PeerAddress, ZR::PeerAddress > & gateways ){ m_Tunnels[ dest ] = gateways; }
-    virtual ZR::RetVal getTunnel( const ZR::VirtualAddress & dest, std::pair< ZR::PeerAddress, ZR::PeerAddress > & gateways )
+    virtual void addTunnel( const ZR::TransactionId & txId, std::pair< ZR::PeerAddress, ZR::PeerAddress > & gateways )
     {
-        TunnelList::iterator it = m_Tunnels.find( dest );
+        RsStackMutex routerMutex( m_routerMutex );
+        m_Tunnels[ txId ] = gateways;
+    }
+    virtual ZR::RetVal getTunnel( const ZR::TransactionId & txId, std::pair< ZR::PeerAddress, ZR::PeerAddress > & gateways )
+    {
+        RsStackMutex routerMutex( m_routerMutex );
+        TunnelList::iterator it = m_Tunnels.find( txId );
         if( it == m_Tunnels.end() )
             return ZR::ZR_FAILURE;
         gateways = (*it).second;
         return ZR::ZR_SUCCESS;
     }
+    /** called when the transaction is finished */
+    virtual void removeTunnel( const ZR::TransactionId & txId )
+    {
+        RsStackMutex routerMutex( m_routerMutex );
+        m_Tunnels.erase( txId );
+    }
 
     static Router * Instance();
 
 
 protected:
     TunnelList m_Tunnels;
+    /** guards the tunnels, and the routes of the implementations */
+    RsMutex m_routerMutex;
 
     static Router * instance;
 };
@@ -0,0 +1,202 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SendQueue.h"
+#include "RSZeroReserveItems.h"
+#include "RSZRRemoteItems.h"
+
+#include "plugins/rspqiservice.h"
+
+#include <iostream>
+
+
+const unsigned int SendQueue::GOSSIP_BUDGET = 20;
+const unsigned int SendQueue::MAX_GOSSIP = 2000;
+
+
+SendQueue::SendQueue( RsPQIService * service ) :
+    m_service( service ),
+    m_queueMutex( "send_queue_mutex" )
+{
+}
+
+SendQueue::~SendQueue()
+{
+    for( PeerQueues::iterator it = m_queues.begin(); it != m_queues.end(); it++ ){
+        for( int prio = 0; prio < PRIORITY_NUMBER; prio++ ){
+            ItemQueue & queue = (*it).second.m_items[ prio ];
+            for( ItemQueue::iterator itemIt = queue.begin(); itemIt != queue.end(); itemIt++ ){
+                delete *itemIt;
+            }
+        }
+    }
+}
+
+SendQueue::Priority SendQueue::priority( RsItem * item )
+{
+    switch( item->PacketSubType() )
+    {
+    case RsZeroReserveItem::ZERORESERVE_TX_ITEM:
+    case RsZeroReserveItem::ZERORESERVE_TX_INIT_ITEM:
+    case RsZeroReserveItem::ZR_REMOTE_TX_ITEM:
+    case RsZeroReserveItem::ZR_REMOTE_PROBE_ITEM:
+        return TX_CONTROL;
+    case RsZeroReserveItem::ZERORESERVE_CREDIT_ITEM:
+        return CREDIT;
+    case RsZeroReserveItem::ZERORESERVE_MSG_ITEM:
+        switch( static_cast< RsZeroReserveMsgItem * >( item )->getType() )
+        {
+        case RsZeroReserveMsgItem::SUBSCRIBE:   // the friend filters what it sends by them
+        case RsZeroReserveMsgItem::FEATURES:
+            return TX_CONTROL;
+        default:
+            return GOSSIP;
+        }
+    default:   // orders and messages - SENT_ORDERBOOK must stay behind the order book it concludes
+        return GOSSIP;
+    }
+}
+
+std::string SendQueue::coalesceKey( RsItem * item )
+{
+    switch( item->PacketSubType() )
+    {
+    case RsZeroReserveItem::ZERORESERVE_ORDERBOOK_ITEM:
+    case RsZeroReserveItem::ZERORESERVE_ORDERBOOK_EXT_ITEM:
+        return "O" + static_cast< RsZeroReserveOrderBookItem * >( item )->getOrder()->m_order_id;
+    case RsZeroReserveItem::ZERORESERVE_CREDIT_ITEM:
+        return "C" + static_cast< RsZeroReserveCreditItem * >( item )->getCredit()->m_currency;
+    default:
+        return std::string();
+    }
+}
+
+bool SendQueue::coalesce( PeerQueue & peerQueue, const std::string & key, RsItem * item )
+{
+    PendingIndex::iterator pending = peerQueue.m_pending.find( key );
+    if( pending == peerQueue.m_pending.end() ) return false;
+
+    // a queued REPLACE keeps what it replaces, or it goes out ahead of the item that ends the order
+    if( key[ 0 ] == 'O' ){
+        OrderBook::Order * older = static_cast< RsZeroReserveOrderBookItem * >( *(*pending).second )->getOrder();
+        OrderBook::Order * newer = static_cast< RsZeroReserveOrderBookItem * >( item )->getOrder();
+        if( !older->mergeInto( *newer ) ) return false;
+    }
+
+    // the newer state wins, in the place of the older
+    delete *(*pending).second;
+    *(*pending).second = item;
+    return true;
+}
+
+void SendQueue::push( RsItem * item )
+{
+    Priority prio = priority( item );
+
+    RsStackMutex queueMutex( m_queueMutex );
+    PeerQueue & peerQueue = m_queues[ item->PeerId() ];
+    ItemQueue & queue = peerQueue.m_items[ prio ];
+
+    std::string key = ( prio != TX_CONTROL )? coalesceKey( item ) : std::string();
+    if( key.empty() ){
+        queue.push_back( item );    // messages and TX items are never dropped
+        return;
+    }
+    if( coalesce( peerQueue, key, item ) ){
+        peerQueue.m_stats.coalesced++;
+        return;
+    }
+    if( prio == GOSSIP && queue.size() >= MAX_GOSSIP ){
+        peerQueue.m_stats.dropped++;
+        delete item;
+        return;
+    }
+    peerQueue.m_pending[ key ] = queue.insert( queue.end(), item );
+}
+
+void SendQueue::flush()
+{
+    ItemQueue outgoing;
+    {
+        RsStackMutex queueMutex( m_queueMutex );
+        for( PeerQueues::iterator it = m_queues.begin(); it != m_queues.end(); it++ ){
+            PeerQueue & peerQueue = (*it).second;
+            for( int prio = 0; prio < PRIORITY_NUMBER; prio++ ){
+                ItemQueue & queue = peerQueue.m_items[ prio ];
+                unsigned int budget = ( prio == GOSSIP )? GOSSIP_BUDGET : queue.size();
+                for( ; budget > 0 && !queue.empty(); budget-- ){
+                    // a REPLACE may have been left ahead of a newer state of its order, that one stays indexed
+                    std::string key = coalesceKey( queue.front() );
+                    PendingIndex::iterator pending = ( key.empty() )? peerQueue.m_pending.end() : peerQueue.m_pending.find( key );
+                    if( pending != peerQueue.m_pending.end() && (*pending).second == queue.begin() ) peerQueue.m_pending.erase( pending );
+                    outgoing.push_back( queue.front() );
+                    queue.pop_front();
+                    peerQueue.m_stats.sent++;
+                }
+            }
+        }
+    }
+
+    // RetroShare takes ownership
+    for( ItemQueue::iterator it = outgoing.begin(); it != outgoing.end(); it++ ){
+        m_service->sendItem( *it );
+    }
+}
+
+void SendQueue::clear( const std::string & peerId )
+{
+    RsStackMutex queueMutex( m_queueMutex );
+    PeerQueues::iterator it = m_queues.find( peerId );
+    if( it == m_queues.end() ) return;
+
+    PeerQueue & peerQueue = (*it).second;
+    for( int prio = 0; prio < PRIORITY_NUMBER; prio++ ){
+        ItemQueue & queue = peerQueue.m_items[ prio ];
+        peerQueue.m_stats.dropped += queue.size();
+        for( ItemQueue::iterator itemIt = queue.begin(); itemIt != queue.end(); itemIt++ ){
+            delete *itemIt;
+        }
+        queue.clear();
+    }
+    peerQueue.m_pending.clear();
+}
+
+void SendQueue::getStats( const std::string & peerId, Stats & stats )
+{
+    RsStackMutex queueMutex( m_queueMutex );
+    PeerQueues::iterator it = m_queues.find( peerId );
+    if( it == m_queues.end() ) return;
+
+    stats = (*it).second.m_stats;
+    for( int prio = 0; prio < PRIORITY_NUMBER; prio++ ){
+        stats.depth[ prio ] = (*it).second.m_items[ prio ].size();
+    }
+}
+
+void SendQueue::getStats( Stats & stats )
+{
+    RsStackMutex queueMutex( m_queueMutex );
+    for( PeerQueues::iterator it = m_queues.begin(); it != m_queues.end(); it++ ){
+        PeerQueue & peerQueue = (*it).second;
+        stats.sent += peerQueue.m_stats.sent;
+        stats.dropped += peerQueue.m_stats.dropped;
+        stats.coalesced += peerQueue.m_stats.coalesced;
+        for( int prio = 0; prio < PRIORITY_NUMBER; prio++ ){
+            stats.depth[ prio ] += peerQueue.m_items[ prio ].size();
+        }
+    }
+}
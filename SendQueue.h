@@ -0,0 +1,105 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+
+#include "util/rsthreads.h"
+
+#include <map>
+#include <list>
+#include <string>
+
+class RsItem;
+class RsPQIService;
+
+/**
+ * @brief Outbound items per peer, in priority classes
+ *
+ * Transaction control items and subscriptions go out first, then credit updates, then order gossip. Gossip is
+ * limited to GOSSIP_BUDGET items per peer and flush(), so a big order book dump cannot hold back
+ * the phases of a contract. Queued gossip for an order that is queued again is replaced by the
+ * newer item, credit updates likewise per currency. Order items beyond MAX_GOSSIP are dropped,
+ * messages which share their class, like SENT_ORDERBOOK, never are.
+ */
+
+class SendQueue
+{
+    SendQueue();
+    SendQueue( const SendQueue & );
+public:
+    enum Priority {
+        TX_CONTROL = 0,
+        CREDIT,
+        GOSSIP,
+        PRIORITY_NUMBER
+    };
+
+    class Stats
+    {
+    public:
+        Stats() : sent( 0 ), dropped( 0 ), coalesced( 0 ) { for( int i = 0; i < PRIORITY_NUMBER; i++ ) depth[ i ] = 0; }
+        unsigned long depth[ PRIORITY_NUMBER ];   // currently queued
+        unsigned long sent;
+        unsigned long dropped;
+        unsigned long coalesced;
+    };
+
+    SendQueue( RsPQIService * service );
+    ~SendQueue();
+
+    /** takes ownership of the item */
+    void push( RsItem * item );
+    /** hand queued items to RetroShare, call this every tick */
+    void flush();
+    /** forget everything queued for a peer that went offline */
+    void clear( const std::string & peerId );
+
+    /** stats of all peers */
+    void getStats( Stats & stats );
+    void getStats( const std::string & peerId, Stats & stats );
+
+    static Priority priority( RsItem * item );
+
+    static const unsigned int GOSSIP_BUDGET;
+    static const unsigned int MAX_GOSSIP;
+
+private:
+    typedef std::list< RsItem * > ItemQueue;
+
+    typedef std::map< std::string, ItemQueue::iterator > PendingIndex;
+
+    class PeerQueue
+    {
+    public:
+        ItemQueue m_items[ PRIORITY_NUMBER ];
+        PendingIndex m_pending;     // queued items which a newer one replaces, by coalesceKey()
+        Stats m_stats;
+    };
+    typedef std::map< std::string, PeerQueue > PeerQueues;
+
+    /** @return true if the item replaced a queued one */
+    bool coalesce( PeerQueue & peerQueue, const std::string & key, RsItem * item );
+    /** the order ID of order items, the currency of credit items, else empty */
+    static std::string coalesceKey( RsItem * item );
+
+    RsPQIService * m_service;
+    PeerQueues m_queues;
+    RsMutex m_queueMutex;
+};
+
+#endif // SENDQUEUE_H
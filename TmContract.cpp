@@ -25,39 +25,122 @@
 #include "OrderBook.h"
 #include "MyOrders.h"
 #include "ZRBitcoin.h"
+#include "Credit.h"
+#include "CapacityProbe.h"
+#include "OrderAggregator.h"
+#include "TmJournal.h"
+#include "OrderSweep.h"
+
+#include <QDateTime>
+
+#include <sstream>
 
 
 
 TmContract::TmContract( const ZR::VirtualAddress & addr, const std::string & myId ) :
-    TransactionManager( addr + ':' + myId )
+    TransactionManager( addr + ':' + myId ),
+    m_journaled( false )
+{
+}
+
+TmContract::~TmContract()
+{
+    if( m_journaled ) TmJournal::Instance()->end( m_TxId );
+}
+
+void TmContract::journalAllocation( BtcContract * payee )
 {
+    TmJournal::Instance()->allocate( m_TxId, payee->getCounterParty(), payee->getCurrencySym(), payee->getFiatAmount() );
+    m_journaled = true;
+}
+
+void TmContract::journalCommit( BtcContract * payee )
+{
+    TmJournal::Instance()->commit( m_TxId, payee->getBtcTxId() );
+}
+
+void TmContract::journalRollback()
+{
+    if( !m_journaled ) return;
+    TmJournal::Instance()->end( m_TxId );
+    m_journaled = false;
 }
 
 
 ///////////////////// TmContractCoordinator /////////////////////////////
 
-TmContractCoordinator::TmContractCoordinator( OrderBook::Order * other, OrderBook::Order *myOrder, const ZR::ZR_Number & amount ) :
-    TmContract( other->m_order_id , myOrder->m_order_id ),
+const unsigned int TmContractCoordinator::MAX_ATTEMPTS = 3;
+
+
+TmContractCoordinator::TmContractCoordinator( OrderBook::Order * other, OrderSweep * sweep, const ZR::ZR_Number & amount,
+                                              unsigned int attempt, const GatewaySet & tried ) :
+    TmContract( other->m_order_id , payerId( sweep->getOrder(), attempt ) ),
     m_otherOrder( other ),
-    m_myOrder( myOrder ),
-    m_payer( NULL )
+    m_sweep( sweep ),
+    m_payer( NULL ),
+    m_amount( amount ),
+    m_attempt( attempt ),
+    m_payerId( payerId( sweep->getOrder(), attempt ) ),
+    m_tried( tried ),
+    m_queryTime( 0 )
 {
-    ZR::PeerAddress addr = Router::Instance()->nextHop( m_otherOrder->m_order_id );
-    if( !addr.empty() ){
+    m_sweep->attach();
+    m_gateway = selectGateway( amount );
+    if( !m_gateway.empty() ){
+        m_tried.insert( m_gateway );
+        m_reserved = amount * other->m_price;
+        m_sweep->reserve( m_gateway, m_reserved );
         try{
             // FIXME: no exception in constructor, dito all other occurrances
-            m_payer = new BtcContract( amount, 0, other->m_price, Currency::currencySymbols[ other->m_currency ], BtcContract::SENDER, addr );
+            m_payer = new BtcContract( amount, 0, other->m_price, Currency::currencySymbols[ other->m_currency ], BtcContract::SENDER, m_gateway );
         }
         catch( std::runtime_error e ){
             g_ZeroReservePlugin->placeMsg( std::string(  __func__ ) + ": Exception caught: " + e.what() + "Cannot create contract object." );
         }
     }
-    myOrder->m_locked = true;
+}
+
+
+std::string TmContractCoordinator::payerId( OrderBook::Order * myOrder, unsigned int attempt )
+{
+    if( attempt == 0 ) return myOrder->m_order_id;
+    std::ostringstream id;
+    id << myOrder->m_order_id << '#' << attempt;
+    return id.str();
+}
+
+
+ZR::PeerAddress TmContractCoordinator::selectGateway( const ZR::ZR_Number & amount )
+{
+    Router::CandidateList candidates;
+    Router::Instance()->getRoutes( m_otherOrder->m_order_id, candidates );
+    ZR::ZR_Number fiatAmount = amount * m_otherOrder->m_price;
+
+    // candidates come best first - take the first one that can carry the whole amount,
+    // else the first one that can carry some of it
+    Router::Candidate * partial = NULL;
+    for( Router::CandidateList::iterator it = candidates.begin(); it != candidates.end(); it++ ){
+        Router::Candidate & candidate = *it;
+        if( m_tried.find( candidate.m_gateway ) != m_tried.end() ) continue;
+        if( candidate.m_probed == 0 || QDateTime::currentMSecsSinceEpoch() - candidate.m_probed > CapacityProbe::PROBE_TTL ){
+            // no recent probe of the whole route, we know the first hop at least
+            Credit c( candidate.m_gateway, Currency::currencySymbols[ m_otherOrder->m_currency ] );
+            c.loadPeer();
+            candidate.m_credit = c.getMyAvailable();
+        }
+        candidate.m_credit = m_sweep->available( candidate.m_gateway, candidate.m_credit );   // the other legs of the sweep
+        if( candidate.m_credit >= fiatAmount ) return candidate.m_gateway;
+        if( partial == NULL && candidate.m_credit > 0 ) partial = &candidate;
+    }
+    return ( partial )? partial->m_gateway : ZR::PeerAddress();
 }
 
 
 TmContractCoordinator::~TmContractCoordinator()
 {
+    if( !m_gateway.empty() )
+        m_sweep->unreserve( m_gateway, m_reserved );
+    m_sweep->detach();
 }
 
 
@@ -66,8 +149,18 @@ ZR::RetVal TmContractCoordinator::init()
     std::cerr << "Zero Reserve: Setting Contract TX manager up as coordinator" << std::endl;
     if( m_payer == NULL) return ZR::ZR_FAILURE;
 
-    ZR::BitcoinAddress btcAddr = ZR::Bitcoin::Instance()->newAddress();
-    if( btcAddr.empty() ){
+    // the QUERY goes out in walletDone()
+    AsyncWallet::Instance()->submit( WalletRequest( WalletRequest::NEW_ADDRESS, m_TxId ) );
+    return ZR::ZR_SUCCESS;
+}
+
+
+ZR::RetVal TmContractCoordinator::walletDone( const WalletRequest & request )
+{
+    if( m_Phase != INIT || request.m_op != WalletRequest::NEW_ADDRESS ) return ZR::ZR_SUCCESS;
+
+    ZR::BitcoinAddress btcAddr = request.m_recvAddr;
+    if( request.m_result != ZR::ZR_SUCCESS ){
         g_ZeroReservePlugin->placeMsg( "ERROR getting Bitcoin Address" );
         return ZR::ZR_FAILURE;
     }
@@ -75,12 +168,13 @@ ZR::RetVal TmContractCoordinator::init()
     ZR::ZR_Number fees = 0;
 
     p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
-    RSZRRemoteTxItem * item = new RSZRRemoteTxItem( m_otherOrder->m_order_id, QUERY, Router::SERVER, m_myOrder->m_order_id );
+    RSZRRemoteTxItem * item = new RSZRRemoteTxItem( m_otherOrder->m_order_id, QUERY, Router::SERVER, m_payerId );
     std::string payload = m_payer->getFiatAmount().toStdString() + ':' + m_payer->getCurrencySym() + ':' +
             btcAddr + ':' + m_payer->getBtcAmount().toStdString() + ':' + fees.toStdString();
     item->setPayload( payload );
     item->PeerId( m_payer->getCounterParty() );
     p3zr->sendItem( item );
+    m_queryTime = QDateTime::currentMSecsSinceEpoch();
     return ZR::ZR_SUCCESS;
 }
 
@@ -121,16 +215,17 @@ ZR::RetVal TmContractCoordinator::doTx( RSZRRemoteTxItem *item )
     if( btcAmount > m_payer->getBtcAmount() ) // seller can't just increase amount I am buying
         return abortTx( item );
 
+    Router::Instance()->reportSuccess( m_otherOrder->m_order_id, m_gateway, QDateTime::currentMSecsSinceEpoch() - m_queryTime );
+
+    // a partial fill leaves the rest of my order open for matching, possibly over another route
     if( btcAmount < m_payer->getBtcAmount() ){
         m_payer->setBtcAmount( btcAmount );
-        m_otherOrder->m_ignored = true;  // as we currently have no alternative routes to seller, ignore from matching for now
-                                         // TODO: remove this as more sophisticated routing is implemented
     }
 
     m_payer->setBtcTxId( btcTxId );
 
     p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
-    RSZRRemoteTxItem * resendItem = new RSZRRemoteTxItem( m_otherOrder->m_order_id, COMMIT, Router::SERVER, m_myOrder->m_order_id );
+    RSZRRemoteTxItem * resendItem = new RSZRRemoteTxItem( m_otherOrder->m_order_id, COMMIT, Router::SERVER, m_payerId );
     resendItem->setPayload( "" );
     resendItem->PeerId( m_payer->getCounterParty() );
 
@@ -145,36 +240,9 @@ ZR::RetVal TmContractCoordinator::doTx( RSZRRemoteTxItem *item )
 
     p3zr->sendItem( resendItem );
 
-    // updating orders
-    if( m_myOrder->m_amount > btcAmount ){
-        MyOrders::Instance()->beginReset();
-        MyOrders::Instance()->getBids()->beginReset();
-
-        m_myOrder->m_amount -= btcAmount;
-        m_myOrder->m_purpose = OrderBook::Order::PARTLY_FILLED;
-        m_myOrder->m_locked = false;
-
-        try{
-            ZrDB::Instance()->updateOrder( m_myOrder );
-        }
-        catch( std::runtime_error e ){
-            g_ZeroReservePlugin->placeMsg( std::string( "Exception caught: " ) + e.what() + " Aborting Transaction " + m_TxId );
-            return abortTx( item );
-        }
-
-        MyOrders::Instance()->getBids()->endReset();
-        MyOrders::Instance()->endReset();
-
-        p3zr->publishOrder( m_myOrder );
-    }
-    else{
-        MyOrders::Instance()->getBids()->remove( m_myOrder->m_order_id );
-        MyOrders::Instance()->remove( m_myOrder->m_order_id );
-        m_myOrder->m_purpose = OrderBook::Order::FILLED;
-        p3zr->publishOrder( m_myOrder );
-        delete m_myOrder;
-        m_myOrder = NULL;
-    }
+    // the other legs of the sweep may be filling my order at the same time
+    if( m_sweep->filled( btcAmount ) == ZR::ZR_FAILURE )
+        return abortTx( item );
 
     return ZR::ZR_FINISH;
 }
@@ -184,22 +252,40 @@ void TmContractCoordinator::rollback()
     std::cerr << "Zero Reserve: Rolling back " << m_TxId << std::endl;
     if( m_payer )
         BtcContract::rmContract( m_payer );
+    if( !m_gateway.empty() )
+        Router::Instance()->reportFailure( m_otherOrder->m_order_id, m_gateway );
+
+    if( failover() ) return;
+
+    // no route left to the seller
     m_otherOrder->m_ignored = true;
     MyOrders::Instance()->getAsks()->remove( m_otherOrder->m_order_id );
 }
 
 
+bool TmContractCoordinator::failover()
+{
+    if( m_attempt + 1 >= MAX_ATTEMPTS ) return false;
+
+    TmContractCoordinator * tm = new TmContractCoordinator( m_otherOrder, m_sweep, m_amount, m_attempt + 1, m_tried );
+    if( tm->m_gateway.empty() ){
+        retire( tm );
+        return false;
+    }
+    std::cerr << "Zero Reserve: " << m_TxId << " failing over to " << tm->m_gateway << " as " << tm->m_TxId << std::endl;
+    return start( tm ) != ZR::ZR_FAILURE;   // tm may be gone after this
+}
+
+
 ZR::RetVal TmContractCoordinator::abortTx( RSZRRemoteTxItem * )
 {
     std::cerr << "Zero Reserve: TmContractCoordinator: Commanding ABORT of " << m_TxId << std::endl;
 
     p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
-    RSZRRemoteTxItem * resendItem = new RSZRRemoteTxItem( m_otherOrder->m_order_id, ABORT, Router::SERVER, m_myOrder->m_order_id );
-    ZR::PeerAddress addr = Router::Instance()->nextHop( m_otherOrder->m_order_id );
-    if( addr.empty() )
+    if( m_gateway.empty() )
         return ZR::ZR_FAILURE;
-
-    resendItem->PeerId( addr );
+    RSZRRemoteTxItem * resendItem = new RSZRRemoteTxItem( m_otherOrder->m_order_id, ABORT, Router::SERVER, m_payerId );
+    resendItem->PeerId( m_gateway );
     p3zr->sendItem( resendItem );
     return ZR::ZR_FAILURE;
 }
@@ -249,6 +335,7 @@ ZR::RetVal TmContractCohortePayee::doQuery( RSZRRemoteTxItem * item )
 
     try{
         m_payee = new BtcContract( btcAmount, fee, price, currencySym, BtcContract::RECEIVER, item->PeerId() );
+        journalAllocation( m_payee );
         btcAmount = m_payee->getBtcAmount();
     }
     catch( std::runtime_error e ){
@@ -260,37 +347,52 @@ ZR::RetVal TmContractCohortePayee::doQuery( RSZRRemoteTxItem * item )
     if( price < m_myOrder->m_price )
         return voteNo( item ); // Do they want to cheat us?
 
-    std::string outTxId;
     ZR::ZR_Number leftover = m_myOrder->m_amount - m_myOrder->m_commitment;
     if( leftover == 0 ){
         return voteNo( item ); // nothing left in this order
     }
-    else{
-        if( btcAmount > leftover ){
-            m_myOrder->m_commitment = m_myOrder->m_amount;
-            btcAmount = leftover;
-            m_payee->setBtcAmount( btcAmount );
-        }
-        else {
-            m_myOrder->m_commitment += btcAmount;
-        }
+    if( btcAmount > leftover ){
+        m_myOrder->m_commitment = m_myOrder->m_amount;
+        btcAmount = leftover;
+        m_payee->setBtcAmount( btcAmount );
+        journalAllocation( m_payee );
+    }
+    else {
+        m_myOrder->m_commitment += btcAmount;
+    }
+    m_payee->setBtcAddress( destinationBtcAddr );
+    m_payerId = item->getPayerId();
+    m_replyTo = item->PeerId();
+
+    // the vote goes out in walletDone() when the Bitcoin TX is signed
+    WalletRequest request( WalletRequest::MK_RAW_TX, m_TxId );
+    request.m_btcAmount = btcAmount;
+    request.m_sendAddr = m_myOrder->m_btcAddr;
+    request.m_recvAddr = destinationBtcAddr;
+    AsyncWallet::Instance()->submit( request );
+    return ZR::ZR_SUCCESS;
+}
 
-        if( ZR::Bitcoin::Instance()->mkRawTx( btcAmount, m_myOrder->m_btcAddr, destinationBtcAddr, m_txHex, outTxId ) != ZR::ZR_SUCCESS ){
-            return abortTx( item );
-        }
 
-        std::cerr << "Zero Reserve: Order execution; TX: " << m_txHex << std::endl;
+ZR::RetVal TmContractCohortePayee::walletDone( const WalletRequest & request )
+{
+    if( m_Phase != QUERY || request.m_op != WalletRequest::MK_RAW_TX ) return ZR::ZR_SUCCESS;
+
+    if( request.m_result != ZR::ZR_SUCCESS ){
+        return abortTx( m_payerId, m_replyTo );
     }
+    m_myOrder->m_btcAddr = request.m_sendAddr;
+    m_txHex = request.m_txHex;
+    std::cerr << "Zero Reserve: Order execution; TX: " << m_txHex << std::endl;
 
-    m_payee->setBtcAddress( destinationBtcAddr );
-    m_payee->setBtcTxId( outTxId );
+    m_payee->setBtcTxId( request.m_btcTxId );
 
     p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
-    RSZRRemoteTxItem * resendItem = new RSZRRemoteTxItem( m_myOrder->m_order_id, VOTE_YES, Router::CLIENT, item->getPayerId() );
+    RSZRRemoteTxItem * resendItem = new RSZRRemoteTxItem( m_myOrder->m_order_id, VOTE_YES, Router::CLIENT, m_payerId );
 
     // return the final Bitcoin amount and the TX ID of the signed TX to the Hops and the payers. They already have the receiving address.
-    resendItem->setPayload( m_payee->getBtcAmount().toStdString() + ':' + outTxId );
-    resendItem->PeerId( item->PeerId() );
+    resendItem->setPayload( m_payee->getBtcAmount().toStdString() + ':' + request.m_btcTxId );
+    resendItem->PeerId( m_replyTo );
     p3zr->sendItem( resendItem );
 
     return ZR::ZR_SUCCESS;
@@ -307,6 +409,7 @@ ZR::RetVal TmContractCohortePayee::doCommit( RSZRRemoteTxItem * item )
 
     try{
         m_payee->activate();
+        journalCommit( m_payee );
         m_payee->persist();
     }
     catch( std::runtime_error e ){
@@ -323,6 +426,8 @@ ZR::RetVal TmContractCohortePayee::doCommit( RSZRRemoteTxItem * item )
         m_myOrder->m_purpose = OrderBook::Order::PARTLY_FILLED;
         m_myOrder->m_amount -= m_payee->getBtcAmount();
         m_myOrder->m_commitment -= m_payee->getBtcAmount();
+        TmJournal::Instance()->fill( m_TxId, m_myOrder->m_order_id, m_myOrder->m_amount );
+        MyOrders::Instance()->notifyFilled( m_myOrder, m_payee->getBtcAmount() );
 
         try{
             ZrDB::Instance()->updateOrder( m_myOrder );
@@ -339,12 +444,19 @@ ZR::RetVal TmContractCohortePayee::doCommit( RSZRRemoteTxItem * item )
     }
     else {  // completely filled
         m_myOrder->m_purpose = OrderBook::Order::FILLED;
+        TmJournal::Instance()->fill( m_TxId, m_myOrder->m_order_id, 0 );
+        OrderBook::Order filled( *m_myOrder );
+        filled.m_amount = 0;
+        MyOrders::Instance()->notifyFilled( &filled, m_payee->getBtcAmount() );
         MyOrders::Instance()->remove( m_myOrder->m_order_id );
         MyOrders::Instance()->getAsks()->remove( m_myOrder->m_order_id );
         p3zr->publishOrder( m_myOrder );
         delete m_myOrder;
     }
-    ZR::Bitcoin::Instance()->sendRaw( m_txHex );
+    // nobody waits for the broadcast, the contract watches the blockchain
+    WalletRequest request( WalletRequest::SEND_RAW, m_TxId );
+    request.m_txHex = m_txHex;
+    AsyncWallet::Instance()->submit( request );
 
     return ZR::ZR_FINISH;
 }
@@ -371,13 +483,18 @@ ZR::RetVal TmContractCohortePayee::processItem( RsZeroReserveItem * baseItem )
 
 
 ZR::RetVal TmContractCohortePayee::abortTx( RSZRRemoteTxItem *item )
+{
+    return abortTx( item->getPayerId(), item->PeerId() );
+}
+
+ZR::RetVal TmContractCohortePayee::abortTx( const std::string & payerId, const ZR::PeerAddress & peer )
 {
     std::cerr << "Zero Reserve: TmContractCohortePayee: Requesting ABORT for " << m_TxId << std::endl;
 
     m_Phase = ABORT_REQUEST;
     p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
-    RSZRRemoteTxItem * resendItem = new RSZRRemoteTxItem( m_myOrder->m_order_id, ABORT_REQUEST, Router::CLIENT, item->getPayerId() );
-    resendItem->PeerId( item->PeerId() );
+    RSZRRemoteTxItem * resendItem = new RSZRRemoteTxItem( m_myOrder->m_order_id, ABORT_REQUEST, Router::CLIENT, payerId );
+    resendItem->PeerId( peer );
     p3zr->sendItem( resendItem );
     return ZR::ZR_SUCCESS;
 }
@@ -388,6 +505,7 @@ void TmContractCohortePayee::rollback()
     std::cerr << "Zero Reserve: Rolling buyer back " << m_myOrder->m_order_id << std::endl;
 
     m_myOrder->m_commitment -= m_payee->getBtcAmount();
+    journalRollback();
     BtcContract::rmContract( m_payee );
 }
 
@@ -410,11 +528,18 @@ ZR::RetVal TmContractCohortePayee::voteNo( RSZRRemoteTxItem * item )
 TmContractCohorteHop::TmContractCohorteHop( const ZR::VirtualAddress & addr, const std::string & myId ) :
     TmContract( addr, myId ),
     m_payer( NULL ),
-    m_payee( NULL )
+    m_payee( NULL ),
+    m_downstream( addr ),
+    m_upstream( addr )
 {
 
 }
 
+TmContractCohorteHop::~TmContractCohorteHop()
+{
+    Router::Instance()->removeTunnel( m_TxId );
+}
+
 
 ZR::RetVal TmContractCohorteHop::init()
 {
@@ -431,8 +556,6 @@ ZR::RetVal TmContractCohorteHop::doQuery( RSZRRemoteTxItem * item )
         return abortTx( item );
     m_Phase = QUERY;
 
-    mkTunnel( item );
-
     std::vector< std::string > v_payload;
     split( item->getPayload(), v_payload );
     if( v_payload.size() < 5 ){
@@ -446,14 +569,23 @@ ZR::RetVal TmContractCohorteHop::doQuery( RSZRRemoteTxItem * item )
     ZR::ZR_Number fee = ZR::ZR_Number::fromFractionString( v_payload[4] );
     ZR::ZR_Number price = fiatAmount / btcAmount;
 
+    // a QUERY for one of my price levels goes on to a concrete order behind it
+    OrderBook::Order::ID concrete;
+    if( OrderAggregator::Instance()->resolve( m_downstream, btcAmount, concrete ) ){
+        m_upstream = concrete;
+        addAlias( m_upstream + ':' + item->getPayerId() );
+    }
+    mkTunnel( item );
+
     // TODO: Check if amount needs to be reduced
 
     std::pair< ZR::PeerAddress, ZR::PeerAddress > route;
-    if( Router::Instance()->getTunnel( item->getAddress(), route ) == ZR::ZR_FAILURE )
+    if( Router::Instance()->getTunnel( m_TxId, route ) == ZR::ZR_FAILURE )
         return abortTx( item );
 
     try{
         m_payee = new BtcContract( btcAmount, fee, price, currencySym, BtcContract::RECEIVER, route.first );
+        journalAllocation( m_payee );
         m_payer = new BtcContract( btcAmount, fee, price, currencySym, BtcContract::SENDER, route.second );
     }
     catch( std::runtime_error e ){
@@ -496,6 +628,7 @@ ZR::RetVal TmContractCohorteHop::doCommit( RSZRRemoteTxItem * item )
     try{
         m_payer->activate();
         m_payee->activate();
+        journalCommit( m_payee );
         m_payer->persist();
         m_payee->persist();
     }
@@ -535,6 +668,7 @@ ZR::RetVal TmContractCohorteHop::doVote( RSZRRemoteTxItem * item )
 
     m_payer->setBtcAmount( btcAmount );
     m_payee->setBtcAmount( btcAmount );
+    journalAllocation( m_payee );
     // TODO: FEES
 
     forwardItem( item, item->getPayload() );
@@ -569,6 +703,7 @@ ZR::RetVal TmContractCohorteHop::processItem( RsZeroReserveItem * baseItem )
 
 void TmContractCohorteHop::rollback()
 {
+    journalRollback();
     if( m_payer )
         BtcContract::rmContract( m_payer );
 
@@ -576,24 +711,25 @@ void TmContractCohorteHop::rollback()
         BtcContract::rmContract( m_payee );
 }
 
-// TODO: Should this be stored in the transaction so it would go away when the TX is finished?
+// the tunnel lives as long as this transaction, see the destructor
 void TmContractCohorteHop::mkTunnel( RSZRRemoteTxItem * item )
 {
-    ZR::PeerAddress nextAddr = Router::Instance()->nextHop( item->getAddress() );
+    ZR::PeerAddress nextAddr = Router::Instance()->nextHop( m_upstream );
     ZR::PeerAddress prevAddr = item->PeerId();
     std::pair< ZR::PeerAddress, ZR::PeerAddress > route( prevAddr, nextAddr );
-    Router::Instance()->addTunnel( item->getAddress(), route );
+    Router::Instance()->addTunnel( m_TxId, route );
 }
 
 
 ZR::RetVal TmContractCohorteHop::forwardItem( RSZRRemoteTxItem * item, const std::string & payload )
 {
     p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
-    RSZRRemoteTxItem * resendItem = new RSZRRemoteTxItem( item->getAddress() , item->getTxPhase(), item->getDirection(), item->getPayerId() );
+    const ZR::VirtualAddress & addr = ( item->getDirection() == Router::SERVER )? m_upstream : m_downstream;
+    RSZRRemoteTxItem * resendItem = new RSZRRemoteTxItem( addr, item->getTxPhase(), item->getDirection(), item->getPayerId() );
     resendItem->setPayload( payload );
 
     std::pair< ZR::PeerAddress, ZR::PeerAddress > route;
-    if( Router::Instance()->getTunnel( item->getAddress(), route ) == ZR::ZR_FAILURE )
+    if( Router::Instance()->getTunnel( m_TxId, route ) == ZR::ZR_FAILURE )
         return ZR::ZR_FAILURE;
     if( item->getDirection() == Router::SERVER )
         resendItem->PeerId( route.second );
@@ -22,9 +22,13 @@
 #include "TransactionManager.h"
 #include "OrderBook.h"
 #include "zrtypes.h"
+#include "AsyncWallet.h"
+
+#include <set>
 
 class RSZRRemoteTxItem;
 class BtcContract;
+class OrderSweep;
 
 /**
  * @brief Remote contract transaction.
@@ -42,11 +46,21 @@ class TmContract : public TransactionManager
 {
 public:
     TmContract( const ZR::VirtualAddress & addr, const std::string & myId );
-    virtual ~TmContract(){}
+    virtual ~TmContract();
 
     virtual ZR::RetVal init() = 0;
     virtual void rollback() = 0;
 
+protected:
+    /** record the funds the receiving contract holds, so a crash before the commit can release them */
+    void journalAllocation( BtcContract * payee );
+    /** record the commit ahead of persisting the contracts, replay() checks whether they made it */
+    void journalCommit( BtcContract * payee );
+    /** close the record ahead of releasing the funds, so replay() cannot release them again */
+    void journalRollback();
+
+private:
+    bool m_journaled;
 };
 
 /**
@@ -59,23 +73,34 @@ public:
  * Phase QUERY:    Submit relevant TX data for both hops and payee
  * Phase VOTE_YES: Nodes indicate that they are OK with the TX, maybe with some changes, like lowering the amount
  * Phase COMMIT:   Commit to the contract as implemented in @see BtcContract
+ *
+ * The TX goes through the best gateway the @see Router knows. If that route votes no or times out,
+ * the coordinator hands over to a new one on the next untried gateway, up to MAX_ATTEMPTS times.
+ * Coordinators buying for the same bid run concurrently as part of an @see OrderSweep, which owns the bid.
  */
 
 class TmContractCoordinator : public TmContract
 {
 public:
+    typedef std::set< ZR::PeerAddress > GatewaySet;
+
     /**
      * @brief TmContractCoordinator
      * @param order the seller's order
+     * @param sweep the sweep of my order this is part of
      * @param amount Bitcoin amount to buy as part of the seller's order
-     * @param myId my order id
+     * @param attempt number of routes tried before
+     * @param tried gateways which failed before
      */
-    TmContractCoordinator( OrderBook::Order * other, OrderBook::Order * myOrder, const ZR::ZR_Number & amount );
+    TmContractCoordinator( OrderBook::Order * other, OrderSweep * sweep, const ZR::ZR_Number & amount,
+                           unsigned int attempt = 0, const GatewaySet & tried = GatewaySet() );
     virtual ~TmContractCoordinator();
 
     virtual ZR::RetVal init();
     virtual void rollback();
     virtual ZR::RetVal processItem( RsZeroReserveItem *item );
+    /** the receiving address arrived, send the QUERY */
+    virtual ZR::RetVal walletDone( const WalletRequest & request );
 
 
 private:
@@ -84,9 +109,25 @@ private:
     // unlike the other TM, which request an abort on calling this function, a coordinator aborts.
     ZR::RetVal abortTx( RSZRRemoteTxItem * );
 
+    /** pick the cheapest gateway to the seller which was not tried yet and has enough credit */
+    ZR::PeerAddress selectGateway( const ZR::ZR_Number & amount );
+    /** hand the TX over to a new coordinator on the next route. @return false if there is none */
+    bool failover();
+    /** each attempt runs under its own TX ID, so it does not collide with the remains of the last one */
+    static std::string payerId( OrderBook::Order * myOrder, unsigned int attempt );
+
     OrderBook::Order * m_otherOrder;
-    OrderBook::Order * m_myOrder;
+    OrderSweep * m_sweep;
     BtcContract * m_payer;
+    ZR::ZR_Number m_amount;
+    ZR::ZR_Number m_reserved;   // fiat claimed on m_gateway in the sweep
+    unsigned int m_attempt;
+    std::string m_payerId;
+    ZR::PeerAddress m_gateway;
+    GatewaySet m_tried;
+    qint64 m_queryTime;
+
+    static const unsigned int MAX_ATTEMPTS;
 };
 
 
@@ -99,6 +140,8 @@ public:
     virtual ZR::RetVal processItem( RsZeroReserveItem * baseItem );
     virtual ZR::RetVal init();
     virtual void rollback();
+    /** the Bitcoin TX is signed, vote */
+    virtual ZR::RetVal walletDone( const WalletRequest & request );
 
 private:
     ZR::RetVal doQuery( RSZRRemoteTxItem * item );
@@ -106,11 +149,14 @@ private:
 
     // request an abort
     ZR::RetVal abortTx( RSZRRemoteTxItem *item );
+    ZR::RetVal abortTx( const std::string & payerId, const ZR::PeerAddress & peer );
     ZR::RetVal voteNo( RSZRRemoteTxItem * item );
 
     BtcContract * m_payee;
     ZR::BitcoinTxHex m_txHex;
     OrderBook::Order * m_myOrder;
+    std::string m_payerId;      // where the vote goes, while the wallet signs
+    ZR::PeerAddress m_replyTo;
 };
 
 
@@ -118,7 +164,7 @@ class TmContractCohorteHop : public TmContract
 {
 public:
     TmContractCohorteHop( const ZR::VirtualAddress & addr, const std::string & myId );
-    virtual ~TmContractCohorteHop(){}
+    virtual ~TmContractCohorteHop();
 
     virtual ZR::RetVal processItem( RsZeroReserveItem * baseItem );
     virtual ZR::RetVal init();
@@ -137,6 +183,8 @@ private:
 
     BtcContract * m_payer;
     BtcContract * m_payee;
+    ZR::VirtualAddress m_downstream;   // the address the payer knows
+    ZR::VirtualAddress m_upstream;     // the order behind it if that is one of my price levels
 };
 
 #endif // TMCONTRACT_H
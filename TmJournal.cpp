@@ -0,0 +1,259 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TmJournal.h"
+#include "TxJournal.h"
+#include "Credit.h"
+#include "BtcContract.h"
+#include "OrderBook.h"
+#include "zrdb.h"
+#include "ZeroReservePlugin.h"
+#include "p3ZeroReserverRS.h"
+
+#include "retroshare/rsinit.h"
+
+#include <QDateTime>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <map>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <stdlib.h>
+
+
+const char * const TmJournal::FILENAME = "contracts.wal";
+
+TmJournal * TmJournal::instance = 0;
+RsMutex TmJournal::creation_mutex( "tm_journal_creation_mutex" );
+
+
+TmJournal * TmJournal::Instance()
+{
+    RsStackMutex creationMutex( creation_mutex );
+    if( !TmJournal::instance ){
+        TmJournal::instance = new TmJournal();
+    }
+    return TmJournal::instance;
+}
+
+TmJournal::TmJournal() :
+    m_mutex( "tm_journal_mutex" )
+{
+    p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+    m_path = RsInit::RsConfigDirectory() + "/" + p3zr->getOwnId() + "/zeroreserve/" + FILENAME;
+    m_file.setFileName( QString::fromStdString( m_path ) );
+}
+
+void TmJournal::open()
+{
+    if( m_file.isOpen() ) return;
+    if( !m_file.open( QFile::WriteOnly | QFile::Append ) ){
+        throw std::runtime_error( std::string( "Cannot open contract journal " ) + m_path );
+    }
+}
+
+std::string TmJournal::record( Event event, const ZR::TransactionId & txId, const std::string & fields )
+{
+    std::string payload = std::string( 1, (char)event ) + '\t' + txId;
+    if( !fields.empty() ) payload += '\t' + fields;
+    std::ostringstream line;
+    line << std::hex << std::setw( 8 ) << std::setfill( '0' )
+         << TxJournal::checksum( reinterpret_cast< const unsigned char * >( payload.c_str() ), payload.length() )
+         << ' ' << payload << '\n';
+    return line.str();
+}
+
+void TmJournal::append( const std::string & record )
+{
+    open();
+    if( m_file.write( record.c_str(), record.length() ) != (qint64)record.length() ){
+        throw std::runtime_error( std::string( "Cannot append to contract journal " ) + m_path );
+    }
+    // ahead of the effect it describes, so it has to be on disk
+    m_file.flush();
+#ifdef WIN32
+    _commit( m_file.handle() );
+#else
+    fsync( m_file.handle() );
+#endif
+}
+
+void TmJournal::write( Event event, const ZR::TransactionId & txId, const std::string & fields )
+{
+    std::string line = record( event, txId, fields );
+
+    RsStackMutex mutex( m_mutex );
+    try{
+        open();
+        if( event == END ){
+            m_open.erase( txId );
+            if( m_open.empty() ){
+                m_file.resize( 0 );   // nothing left to recover
+                return;
+            }
+        }
+        else {
+            m_open.insert( txId );
+        }
+        append( line );
+    }
+    catch( std::runtime_error & e ){
+        std::cerr << "Zero Reserve: " << e.what() << std::endl;
+    }
+}
+
+void TmJournal::allocate( const ZR::TransactionId & txId, const std::string & counterParty, const std::string & currency, const ZR::ZR_Number & amount )
+{
+    write( ALLOCATE, txId, counterParty + '\t' + currency + '\t' + amount.toStdString() );
+}
+
+void TmJournal::commit( const ZR::TransactionId & txId, const ZR::TransactionId & btcTxId )
+{
+    write( COMMIT, txId, btcTxId );
+}
+
+void TmJournal::fill( const ZR::TransactionId & txId, const std::string & orderId, const ZR::ZR_Number & remaining )
+{
+    write( FILL, txId, orderId + '\t' + remaining.toStdString() );
+}
+
+void TmJournal::end( const ZR::TransactionId & txId )
+{
+    {
+        RsStackMutex mutex( m_mutex );
+        if( m_open.find( txId ) == m_open.end() ) return;   // never wrote anything
+    }
+    write( END, txId );
+}
+
+void TmJournal::replay()
+{
+    qint64 start = QDateTime::currentMSecsSinceEpoch();
+    RsStackMutex mutex( m_mutex );
+    m_file.close();
+
+    QFile file( QString::fromStdString( m_path ) );
+    if( !QFile::exists( QString::fromStdString( m_path ) ) || !file.open( QFile::ReadOnly ) ) return;
+    QByteArray raw = file.readAll();
+    file.close();
+    std::string records( raw.constData(), raw.size() );
+
+    std::map< ZR::TransactionId, Recovery > txs;
+    std::string::size_type pos = 0;
+    for( std::string::size_type end; ( end = records.find( '\n', pos ) ) != std::string::npos; pos = end + 1 ){
+        std::string line = records.substr( pos, end - pos );
+        if( line.length() < 10 ) break;
+
+        std::string payload = line.substr( 9 );
+        uint32_t crc = strtoul( line.substr( 0, 8 ).c_str(), NULL, 16 );
+        if( crc != TxJournal::checksum( reinterpret_cast< const unsigned char * >( payload.c_str() ), payload.length() ) ){
+            std::cerr << "Zero Reserve: Bad record in " << m_path << ", stopping replay there" << std::endl;   // torn write
+            break;
+        }
+
+        std::vector< std::string > fields;
+        std::istringstream ss( payload );
+        std::string field;
+        while( std::getline( ss, field, '\t' ) ) fields.push_back( field );
+        if( fields.size() < 2 ) continue;
+
+        Recovery & tx = txs[ fields[ 1 ] ];
+        try{
+            switch( fields[ 0 ][ 0 ] ){
+            case ALLOCATE:
+                if( fields.size() != 5 ) continue;
+                tx.m_allocated = true;
+                tx.m_counterParty = fields[ 2 ];
+                tx.m_currency = fields[ 3 ];
+                tx.m_amount = ZR::ZR_Number::fromFractionString( fields[ 4 ] );
+                break;
+            case COMMIT:
+                if( fields.size() != 3 ) continue;
+                tx.m_committed = true;
+                tx.m_btcTxId = fields[ 2 ];
+                break;
+            case FILL:
+                if( fields.size() != 4 ) continue;
+                tx.m_filled = true;
+                tx.m_orderId = fields[ 2 ];
+                tx.m_remaining = ZR::ZR_Number::fromFractionString( fields[ 3 ] );
+                break;
+            case END:
+                tx.m_ended = true;
+                break;
+            default:
+                break;
+            }
+        }
+        catch( std::exception & e ){
+            std::cerr << "Zero Reserve: Bad record in " << m_path << ": " << e.what() << std::endl;
+        }
+    }
+
+    unsigned int rolledBack = 0, completed = 0;
+    for( std::map< ZR::TransactionId, Recovery >::const_iterator it = txs.begin(); it != txs.end(); it++ ){
+        const Recovery & tx = (*it).second;
+        if( tx.m_ended ) continue;
+        try{
+            // COMMIT goes ahead of persisting the contracts - did they make it?
+            bool persisted = tx.m_committed && ZrDB::Instance()->btcContractExists( tx.m_btcTxId, BtcContract::RECEIVER );
+            if( !persisted ){
+                // the funds were held for a contract which never came to be. End it first, so a
+                // crash during the replay does not release them again
+                append( record( END, (*it).first ) );
+                if( tx.m_allocated ){
+                    Credit c( tx.m_counterParty, tx.m_currency );
+                    c.loadPeer();
+                    c.deallocate( tx.m_amount );
+                }
+                rolledBack++;
+            }
+            else {
+                // the contracts are persisted, they take it from here. Only my order may lag behind
+                if( tx.m_filled ){
+                    OrderBook::Order order( true );
+                    order.m_order_id = tx.m_orderId;
+                    order.m_amount = tx.m_remaining;
+                    if( tx.m_remaining > 0 )
+                        ZrDB::Instance()->updateOrder( &order );
+                    else
+                        ZrDB::Instance()->deleteOrder( &order );
+                }
+                completed++;
+            }
+        }
+        catch( std::exception & e ){
+            g_ZeroReservePlugin->placeMsg( std::string( "Exception caught: " ) + e.what() + " Cannot recover TX " + (*it).first );
+        }
+    }
+
+    m_file.close();
+    QFile::remove( QString::fromStdString( m_path ) );
+    m_open.clear();
+    if( rolledBack + completed > 0 ){
+        std::cerr << "Zero Reserve: Recovered from crash: " << rolledBack << " TX rolled back, " << completed << " completed in "
+                  << QDateTime::currentMSecsSinceEpoch() - start << " ms" << std::endl;
+    }
+}
@@ -0,0 +1,100 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TMJOURNAL_H
+#define TMJOURNAL_H
+
+#include "zrtypes.h"
+
+#include "util/rsthreads.h"
+
+#include <QFile>
+
+#include <set>
+#include <string>
+
+/**
+ * @brief Write-ahead log of the contract TX in flight
+ *
+ * Persisted contracts survive a crash, the negotiation before them does not. The journal records
+ * the funds a TX allocated to a RECEIVER contract, that its contracts are about to be persisted and
+ * what is left of my order it filled. replay() at startup finishes the TX a crash left open:
+ * allocations of TX whose receiving contract is not in the DB are released, fills of committed TX
+ * are written to my orders. A rollback ends the TX before it releases the funds, so they are never
+ * released twice.
+ *
+ * One checksummed text line per record; a torn line at the end is ignored. The file is emptied
+ * whenever no TX is open any more.
+ */
+
+class TmJournal
+{
+    TmJournal();
+    TmJournal( const TmJournal & );
+public:
+    static TmJournal * Instance();
+
+    /** the funds allocated for the TX, the last record counts */
+    void allocate( const ZR::TransactionId & txId, const std::string & counterParty, const std::string & currency, const ZR::ZR_Number & amount );
+    /** the contracts of the TX are about to be persisted, btcTxId keys the receiving one */
+    void commit( const ZR::TransactionId & txId, const ZR::TransactionId & btcTxId );
+    /** the TX filled my order, remaining is what is left of it */
+    void fill( const ZR::TransactionId & txId, const std::string & orderId, const ZR::ZR_Number & remaining );
+    /** nothing left to recover for this TX */
+    void end( const ZR::TransactionId & txId );
+
+    /** recover from the last crash. Call once at startup, before my orders are loaded */
+    void replay();
+
+    static const char * const FILENAME;
+
+private:
+    enum Event { ALLOCATE = 'A', COMMIT = 'C', FILL = 'F', END = 'E' };
+
+    /** what the journal knows about one TX */
+    class Recovery
+    {
+    public:
+        Recovery() : m_allocated( false ), m_committed( false ), m_filled( false ), m_ended( false ) {}
+        bool m_allocated;
+        std::string m_counterParty;
+        std::string m_currency;
+        ZR::ZR_Number m_amount;
+        bool m_committed;
+        ZR::TransactionId m_btcTxId;
+        bool m_filled;
+        std::string m_orderId;
+        ZR::ZR_Number m_remaining;
+        bool m_ended;
+    };
+
+    void write( Event event, const ZR::TransactionId & txId, const std::string & fields = std::string() );
+    static std::string record( Event event, const ZR::TransactionId & txId, const std::string & fields = std::string() );
+    /** write a record through to disk, call with m_mutex held */
+    void append( const std::string & record );
+    void open();
+
+    std::string m_path;
+    QFile m_file;
+    std::set< ZR::TransactionId > m_open;   // TX with records and no END
+    RsMutex m_mutex;
+
+    static TmJournal * instance;
+    static RsMutex creation_mutex;
+};
+
+#endif // TMJOURNAL_H
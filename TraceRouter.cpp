@@ -16,31 +16,233 @@
 */
 
 #include "TraceRouter.h"
+#include "OrderBook.h"
+#include "ZrConfig.h"
+#include "zrdb.h"
+
+#include "util/radix64.h"
+
+#include <openssl/sha.h>
+#include <QDateTime>
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+
+
+const qint64 TraceRouter::DEFAULT_TTL = OrderBook::Order::timeout;
+
+static const double FAILURE_WEIGHT = 0.3;   // weight of the latest outcome in the failure rate
+
+
+bool TraceRouter::RouteKey::operator == ( const RouteKey & other ) const
+{
+    return memcmp( m_bytes, other.m_bytes, KEY_LEN ) == 0;
+}
+
+std::size_t TraceRouter::RouteKeyHash::operator () ( const RouteKey & key ) const
+{
+    // the keys are digests already, any part of them is a good hash
+    std::size_t hash;
+    memcpy( &hash, key.m_bytes, sizeof( hash ) );
+    return hash;
+}
+
 
 TraceRouter::TraceRouter()
 {
 }
 
-void TraceRouter::addRoute( const ZR::VirtualAddress &dest, const std::string & gateway )
+TraceRouter::RouteKey TraceRouter::makeKey( const ZR::VirtualAddress & dest )
+{
+    RouteKey key;
+    char * decoded = NULL;
+    size_t len = 0;
+    Radix64::decode( dest, decoded, len );
+    if( decoded != NULL && len == KEY_LEN ){
+        memcpy( key.m_bytes, decoded, KEY_LEN );
+    }
+    else {
+        // not an order ID, hash it down to the key size
+        SHA256( reinterpret_cast< const unsigned char * >( dest.c_str() ), dest.length(), key.m_bytes );
+    }
+    delete [] decoded;
+    return key;
+}
+
+void TraceRouter::addRoute( const ZR::VirtualAddress &dest, const std::string & gateway, qint64 expires, unsigned int hops )
+{
+    if( expires == 0 ){
+        expires = QDateTime::currentMSecsSinceEpoch() + DEFAULT_TTL;
+    }
+    RouteKey key = makeKey( dest );
+
+    RsStackMutex routerMutex( m_routerMutex );
+    RoutingTable::iterator it = routingTable.find( key );
+    if( it == routingTable.end() ){
+        qint64 capacity = ZrConfig::Instance()->getInteger( ZrDB::ROUTING_TABLE_SIZE );
+        while( capacity > 0 && routingTable.size() >= (unsigned long)capacity && !m_lru.empty() ){
+            erase( routingTable.find( m_lru.back() ) );
+            m_stats.evicted++;
+        }
+
+        m_lru.push_front( key );
+        Route & route = routingTable[ key ];
+        route.m_expires = expires;
+        route.m_lru = m_lru.begin();
+        it = routingTable.find( key );
+    }
+    else {
+        m_lru.splice( m_lru.begin(), m_lru, (*it).second.m_lru );
+    }
+
+    Route & route = (*it).second;
+    route.m_expires = std::max( route.m_expires, expires );
+    Candidate * candidate = route.find( gateway );
+    if( candidate ){
+        candidate->m_hops = std::min( candidate->m_hops, hops );
+    }
+    else {
+        Candidate c;
+        c.m_gateway = gateway;
+        c.m_hops = hops;
+        route.m_candidates.push_back( c );
+    }
+    route.rank();
+    if( route.m_candidates.size() > MAX_CANDIDATES ){
+        route.m_candidates.pop_back();
+    }
+}
+
+TraceRouter::Candidate * TraceRouter::Route::find( const std::string & gateway )
+{
+    for( CandidateList::iterator it = m_candidates.begin(); it != m_candidates.end(); it++ ){
+        if( (*it).m_gateway == gateway ) return &(*it);
+    }
+    return NULL;
+}
+
+static bool cheaper( const Router::Candidate & a, const Router::Candidate & b )
 {
-    routingTable[ dest ] = gateway;
+    return a.cost() < b.cost();
 }
 
+void TraceRouter::Route::rank()
+{
+    std::stable_sort( m_candidates.begin(), m_candidates.end(), cheaper );
+}
+
+void TraceRouter::erase( RoutingTable::iterator it )
+{
+    m_lru.erase( (*it).second.m_lru );
+    routingTable.erase( it );
+}
+
+TraceRouter::Route * TraceRouter::findRoute( const ZR::VirtualAddress & dest )
+{
+    RoutingTable::iterator it = routingTable.find( makeKey( dest ) );
+    if( it == routingTable.end() ) return NULL;
+
+    Route & route = (*it).second;
+    if( route.m_expires < QDateTime::currentMSecsSinceEpoch() ){
+        erase( it );
+        m_stats.expired++;
+        return NULL;
+    }
+    m_lru.splice( m_lru.begin(), m_lru, route.m_lru );
+    return &route;
+}
 
 const std::string TraceRouter::nextHop( const ZR::VirtualAddress &dest )
 {
-    RoutingTable::const_iterator it = routingTable.find( dest );
-    if( it != routingTable.end() ){
-        return (*it).second;
+    RsStackMutex routerMutex( m_routerMutex );
+    Route * route = findRoute( dest );
+    if( route && !route->m_candidates.empty() ){
+        return route->m_candidates.front().m_gateway;
     }
 
     return std::string();
 }
 
+void TraceRouter::getRoutes( const ZR::VirtualAddress & dest, CandidateList & candidates )
+{
+    RsStackMutex routerMutex( m_routerMutex );
+    Route * route = findRoute( dest );
+    if( route ){
+        candidates = route->m_candidates;
+    }
+}
+
+void TraceRouter::reportSuccess( const ZR::VirtualAddress & dest, const std::string & gateway, qint64 rtt )
+{
+    RsStackMutex routerMutex( m_routerMutex );
+    Route * route = findRoute( dest );
+    if( !route ) return;
+    Candidate * candidate = route->find( gateway );
+    if( !candidate ) return;
+
+    candidate->m_rtt = ( candidate->m_rtt == 0 )? rtt : ( 7 * candidate->m_rtt + rtt ) / 8;
+    candidate->m_failureRate *= 1 - FAILURE_WEIGHT;
+    route->rank();
+}
+
+void TraceRouter::reportFailure( const ZR::VirtualAddress & dest, const std::string & gateway )
+{
+    RsStackMutex routerMutex( m_routerMutex );
+    Route * route = findRoute( dest );
+    if( !route ) return;
+    Candidate * candidate = route->find( gateway );
+    if( !candidate ) return;
+
+    candidate->m_failureRate = candidate->m_failureRate * ( 1 - FAILURE_WEIGHT ) + FAILURE_WEIGHT;
+    route->rank();
+    std::cerr << "Zero Reserve: Router: Gateway " << gateway << " failed, failure rate " << candidate->m_failureRate << std::endl;
+}
+
 bool TraceRouter::hasRoute( const ZR::VirtualAddress & dest )
 {
-    if( routingTable.find( dest ) == routingTable.end() ){
-        return false;
+    RsStackMutex routerMutex( m_routerMutex );
+    return findRoute( dest ) != NULL;
+}
+
+void TraceRouter::reportCapacity( const ZR::VirtualAddress & dest, const std::string & gateway, const ZR::ZR_Number & credit )
+{
+    RsStackMutex routerMutex( m_routerMutex );
+    Route * route = findRoute( dest );
+    if( !route ) return;
+    Candidate * candidate = route->find( gateway );
+    if( !candidate ) return;
+
+    candidate->m_credit = credit;
+    candidate->m_probed = QDateTime::currentMSecsSinceEpoch();
+}
+
+void TraceRouter::timeout()
+{
+    RsStackMutex routerMutex( m_routerMutex );
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    unsigned long expired = 0;
+    for( RoutingTable::iterator it = routingTable.begin(); it != routingTable.end(); ){
+        if( (*it).second.m_expires < now ){
+            m_lru.erase( (*it).second.m_lru );
+            it = routingTable.erase( it );
+            expired++;
+        }
+        else {
+            it++;
+        }
     }
-    return true;
+    m_stats.expired += expired;
+    if( expired > 0 ){
+        std::cerr << "Zero Reserve: Router: " << routingTable.size() << " routes, " << m_Tunnels.size() << " tunnels, expired "
+                  << m_stats.expired << ", evicted " << m_stats.evicted << std::endl;
+    }
+}
+
+void TraceRouter::getStats( Stats & stats )
+{
+    RsStackMutex routerMutex( m_routerMutex );
+    stats = m_stats;
+    stats.routes = routingTable.size();
+    stats.tunnels = m_Tunnels.size();
 }
@@ -21,11 +21,20 @@
 #include "Router.h"
 #include "zrtypes.h"
 
+#include "util/rsthreads.h"
+
+#include <boost/unordered_map.hpp>
+
 #include <string>
-#include <map>
+#include <list>
 
 /**
  * @brief Very simple router class, gathering routing information from items that propagate through the net
+ *
+ * Routes are hashed by the binary form of the destination. Each route expires with the order it was
+ * learned from, and the least recently used routes are evicted if the table exceeds ROUTING_TABLE_SIZE.
+ * A route keeps up to MAX_CANDIDATES gateways, ranked by hop count and the round trip times and
+ * failures reported by the transactions that used them.
  */
 
 class TraceRouter : public Router
@@ -33,15 +42,60 @@ class TraceRouter : public Router
 public:
     TraceRouter();
 
-    typedef std::map< ZR::VirtualAddress, std::string > RoutingTable;
-
-    virtual void addRoute( const ZR::VirtualAddress & dest, const std::string & gateway );
+    virtual void addRoute( const ZR::VirtualAddress & dest, const std::string & gateway, qint64 expires = 0, unsigned int hops = 1 );
     virtual const std::string nextHop( const ZR::VirtualAddress & dest );
     virtual bool hasRoute(const ZR::VirtualAddress &dest );
+    virtual void getRoutes( const ZR::VirtualAddress & dest, CandidateList & candidates );
+
+    virtual void reportSuccess( const ZR::VirtualAddress & dest, const std::string & gateway, qint64 rtt );
+    virtual void reportFailure( const ZR::VirtualAddress & dest, const std::string & gateway );
+    virtual void reportCapacity( const ZR::VirtualAddress & dest, const std::string & gateway, const ZR::ZR_Number & credit );
+
+    virtual void timeout();
+    virtual void getStats( Stats & stats );
+
+    static const unsigned int KEY_LEN = 32;   // a SHA256 digest, like the order IDs
+    static const qint64 DEFAULT_TTL;
+    static const unsigned int MAX_CANDIDATES = 4;
 
 protected:
+    class RouteKey
+    {
+    public:
+        unsigned char m_bytes[ KEY_LEN ];
+        bool operator == ( const RouteKey & other ) const;
+    };
+
+    class RouteKeyHash
+    {
+    public:
+        std::size_t operator () ( const RouteKey & key ) const;
+    };
+
+    typedef std::list< RouteKey > LruList;    // most recently used first
+
+    class Route
+    {
+    public:
+        CandidateList m_candidates;   // best first
+        qint64 m_expires;
+        LruList::iterator m_lru;
+
+        Candidate * find( const std::string & gateway );
+        void rank();
+    };
+
+    typedef boost::unordered_map< RouteKey, Route, RouteKeyHash > RoutingTable;
+
+    static RouteKey makeKey( const ZR::VirtualAddress & dest );
+    /** @return the live route to dest or NULL. Marks it as used */
+    Route * findRoute( const ZR::VirtualAddress & dest );
+    void erase( RoutingTable::iterator it );
+
     /** map destinions to gateways */
     RoutingTable routingTable;
+    LruList m_lru;
+    Stats m_stats;
 };
 
 #endif // TRACEROUTER_H
@@ -26,13 +26,14 @@
 #include "zrtypes.h"
 #include "Router.h"
 #include "MyOrders.h"
+#include "AsyncWallet.h"
 
 #include <stdexcept>
 #include <sstream>
 
 
 
-TransactionManager::TxManagers TransactionManager::currentTX;
+TransactionManager::Shard TransactionManager::shards[ TransactionManager::SHARDS ];
 
 
 /**
@@ -43,37 +44,27 @@ TransactionManager::TxManagers TransactionManager::currentTX;
 
 int TransactionManager::handleTxItem( RSZRRemoteTxItem *item )
 {
-    ZR::RetVal retVal;
     std::cerr << "Zero Reserve: TX Manger handling incoming item - Destination: " << item->getAddress() << std::endl;
 
     ZR::VirtualAddress addr = item->getAddress();
     ZR::TransactionId txId = addr + ":" + item->getPayerId();
     std::cerr << "Zero Reserve: TransactionManager: TX ID = " << txId << std::endl;
-    TransactionManager * tm;
-    TxManagers::iterator it = currentTX.find( txId );
-    if( it == currentTX.end() ){
-        if( MyOrders::Instance()->find( addr ) != NULL ){
-            tm = new TmContractCohortePayee( addr, item->getPayerId() );
-        }
-        else {
-            tm = new TmContractCohorteHop( addr, item->getPayerId() );
+    TransactionManager * tm = acquire( txId );
+    if( !tm ){
+        RsStackMutex creationMutex( shard( txId ).m_creation_mutex );
+        tm = acquire( txId );
+        if( !tm ){
+            if( MyOrders::Instance()->find( addr ) != NULL ){
+                new TmContractCohortePayee( addr, item->getPayerId() );
+            }
+            else {
+                new TmContractCohorteHop( addr, item->getPayerId() );
+            }
+            tm = acquire( txId );
+            if( !tm ) return ZR::ZR_FAILURE;
         }
     }
-    else {
-        tm = (*it).second;
-    }
-    try{
-        retVal = tm->processItem( item );
-    }
-    catch( std::runtime_error e){
-        std::cerr << "Zero Reserve: Exception caught: " << e.what() << std::endl;
-        return ZR::ZR_FAILURE;
-    }
-
-    if( retVal != ZR::ZR_SUCCESS ){
-        delete tm;
-    }
-    return retVal;
+    return process( tm, item );
 }
 
 void TransactionManager::split(const std::string & s, std::vector< std::string > & v, const char sep )
@@ -96,38 +87,190 @@ int TransactionManager::handleTxItem( RsZeroReserveTxItem * item )
 {
     std::cerr << "Zero Reserve: TX Manger handling incoming item id = " << item->getTxId() << std::endl;
     ZR::TransactionId txId = item->getTxId();
-    TransactionManager * tm;
-    TxManagers::iterator it = currentTX.find( txId );
-    if( it == currentTX.end() ){
-        tm = new TmLocalCohorte( txId );
+    TransactionManager * tm = acquire( txId );
+    if( !tm ){
+        RsStackMutex creationMutex( shard( txId ).m_creation_mutex );
+        tm = acquire( txId );
+        if( !tm ){
+            new TmLocalCohorte( txId );
+            tm = acquire( txId );
+            if( !tm ) return ZR::ZR_FAILURE;
+        }
     }
-    else {
-        tm = (*it).second;
+    return process( tm, item );
+}
+
+
+void TransactionManager::resume( const WalletRequest & request )
+{
+    TransactionManager * tm = acquire( request.m_txId );
+    if( !tm ){
+        std::cerr << "Zero Reserve: TX " << request.m_txId << " ended while waiting for the wallet" << std::endl;
+        return;
     }
-    ZR::RetVal retVal = tm->processItem( item );
-    if( retVal != ZR::ZR_SUCCESS ){
-        delete tm;
+    process( tm, NULL, &request );
+}
+
+ZR::RetVal TransactionManager::walletDone( const WalletRequest & )
+{
+    return ZR::ZR_SUCCESS;
+}
+
+
+ZR::RetVal TransactionManager::process( TransactionManager * tm, RsZeroReserveItem * item, const WalletRequest * request )
+{
+    ZR::RetVal retVal = ZR::ZR_FAILURE;
+    {
+        RsStackMutex strand( tm->m_strand );
+        bool retired;
+        {
+            RsStackMutex refMutex( tm->m_ref_mutex );
+            retired = tm->m_retired;
+        }
+        if( retired ){
+            std::cerr << "Zero Reserve: TX " << tm->m_TxId << " ended while an item was waiting for it" << std::endl;
+        }
+        else {
+            try{
+                retVal = ( request )? tm->walletDone( *request ) : tm->processItem( item );
+                if( retVal != ZR::ZR_SUCCESS ){
+                    retire( tm );
+                }
+            }
+            catch( std::runtime_error e){
+                std::cerr << "Zero Reserve: Exception caught: " << e.what() << std::endl;
+                retVal = ZR::ZR_FAILURE;
+            }
+        }
     }
+    release( tm );
     return retVal;
 }
 
 
 void TransactionManager::timeout()
 {
-    for( TxManagers::iterator it = currentTX.begin(); it != currentTX.end(); it++ ){
-        TransactionManager * tm = (*it).second;
-        if( tm->isTimedOut() ){
-            tm->rollback();
-            delete tm;
+    std::vector< TransactionManager * > managers;
+    for( unsigned int i = 0; i < SHARDS; i++ ){
+        RsStackMutex shardMutex( shards[ i ].m_mutex );
+        for( TxManagers::iterator it = shards[ i ].m_managers.begin(); it != shards[ i ].m_managers.end(); it++ ){
+            TransactionManager * tm = (*it).second;
+            if( (*it).first != tm->m_TxId ) continue;   // an alias
+            RsStackMutex refMutex( tm->m_ref_mutex );
+            tm->m_refs++;
+            managers.push_back( tm );
         }
     }
+
+    // a rollback may start a new TM, so no shard is locked here
+    for( std::vector< TransactionManager * >::iterator it = managers.begin(); it != managers.end(); it++ ){
+        TransactionManager * tm = *it;
+        {
+            RsStackMutex strand( tm->m_strand );
+            bool retired;
+            {
+                RsStackMutex refMutex( tm->m_ref_mutex );
+                retired = tm->m_retired;
+            }
+            if( !retired && tm->isTimedOut() ){
+                tm->rollback();
+                retire( tm );
+            }
+        }
+        release( tm );
+    }
+}
+
+
+ZR::RetVal TransactionManager::start( TransactionManager * tm )
+{
+    ZR::RetVal retVal;
+    {
+        RsStackMutex strand( tm->m_strand );
+        retVal = tm->init();
+    }
+    if( retVal == ZR::ZR_FAILURE ){
+        retire( tm );
+    }
+    return retVal;
+}
+
+void TransactionManager::retire( TransactionManager * tm )
+{
+    unregisterTx( tm->m_TxId, tm );
+    for( std::vector< ZR::TransactionId >::const_iterator it = tm->m_aliases.begin(); it != tm->m_aliases.end(); it++ ){
+        unregisterTx( *it, tm );
+    }
+
+    bool unused;
+    {
+        RsStackMutex refMutex( tm->m_ref_mutex );
+        tm->m_retired = true;
+        unused = ( tm->m_refs == 0 );
+    }
+    if( unused ) delete tm;
+}
+
+TransactionManager::Shard & TransactionManager::shard( const ZR::TransactionId & txId )
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for( std::string::const_iterator it = txId.begin(); it != txId.end(); it++ ){
+        hash = ( hash ^ (unsigned char)*it ) * 16777619u;
+    }
+    return shards[ hash % SHARDS ];
+}
+
+void TransactionManager::registerTx( const ZR::TransactionId & txId, TransactionManager * tm )
+{
+    Shard & s = shard( txId );
+    RsStackMutex shardMutex( s.m_mutex );
+    s.m_managers[ txId ] = tm;
+}
+
+void TransactionManager::unregisterTx( const ZR::TransactionId & txId, TransactionManager * tm )
+{
+    Shard & s = shard( txId );
+    RsStackMutex shardMutex( s.m_mutex );
+    TxManagers::iterator it = s.m_managers.find( txId );
+    if( it != s.m_managers.end() && (*it).second == tm ){
+        s.m_managers.erase( it );
+    }
+}
+
+TransactionManager * TransactionManager::acquire( const ZR::TransactionId & txId )
+{
+    Shard & s = shard( txId );
+    RsStackMutex shardMutex( s.m_mutex );
+    TxManagers::iterator it = s.m_managers.find( txId );
+    if( it == s.m_managers.end() ) return NULL;
+
+    TransactionManager * tm = (*it).second;
+    RsStackMutex refMutex( tm->m_ref_mutex );
+    tm->m_refs++;
+    return tm;
+}
+
+void TransactionManager::release( TransactionManager * tm )
+{
+    bool unused;
+    {
+        RsStackMutex refMutex( tm->m_ref_mutex );
+        tm->m_refs--;
+        unused = ( tm->m_refs == 0 && tm->m_retired );
+    }
+    if( unused ) delete tm;
 }
 
 
 TransactionManager::TransactionManager( const ZR::TransactionId & txId ) :
     m_TxId( txId ),
     m_Phase( INIT ),
-    m_startOfPhase( QDateTime::currentMSecsSinceEpoch() )
+    m_startOfPhase( QDateTime::currentMSecsSinceEpoch() ),
+    m_strand( "tx_strand_mutex" ),
+    m_ref_mutex( "tx_ref_mutex" ),
+    m_refs( 0 ),
+    m_retired( false )
 {
     static const unsigned int defaultTimeOut = 60000; // one minute
 
@@ -142,13 +285,23 @@ TransactionManager::TransactionManager( const ZR::TransactionId & txId ) :
     m_maxTime[ ABORT ]         = defaultTimeOut;
     m_maxTime[ ABORT_REQUEST ] = defaultTimeOut;
 
-    currentTX[ txId ] = this;
+    registerTx( txId, this );
 }
 
 TransactionManager::~TransactionManager()
 {
     std::cerr << "Zero Reserve: TX Manager: Cleaning up: " << m_TxId << std::endl;
-    currentTX.erase( m_TxId );
+    unregisterTx( m_TxId, this );
+    for( std::vector< ZR::TransactionId >::const_iterator it = m_aliases.begin(); it != m_aliases.end(); it++ ){
+        unregisterTx( *it, this );
+    }
+}
+
+void TransactionManager::addAlias( const ZR::TransactionId & alias )
+{
+    std::cerr << "Zero Reserve: TX Manager: " << m_TxId << " also known as " << alias << std::endl;
+    m_aliases.push_back( alias );
+    registerTx( alias, this );
 }
 
 bool TransactionManager::isTimedOut()
@@ -21,6 +21,8 @@
 
 #include <zrtypes.h>
 
+#include "util/rsthreads.h"
+
 #include <map>
 #include <string>
 #include <vector>
@@ -28,11 +30,16 @@
 class RsZeroReserveItem;
 class RsZeroReserveTxItem;
 class RSZRRemoteTxItem;
+class WalletRequest;
 
 /**
   Manage multi hop transaction. The payer is the coordiantor, all in between
   nodes and the payee are cohorts. Cancel TX if an in-between node tries to
   cheat or if an in-between node goes away during the TX
+
+  The registry of running TX is split in SHARDS by TX ID, each with its own lock. A TM handles
+  one item at a time, under its strand mutex. TMs end with retire() and are deleted once the
+  last thread working on them lets go, so do not delete them directly.
   */
 
 class TransactionManager
@@ -68,23 +75,63 @@ public:
 
     static void timeout();
 
+    /** continue the TX which waited for a wallet operation, see @see AsyncWallet */
+    static void resume( const WalletRequest & request );
+
+    /** run init() of a new TM in its strand, retire it if that fails */
+    static ZR::RetVal start( TransactionManager * tm );
+    /** take a TM out of the registry. It gets deleted when no thread works on it any more */
+    static void retire( TransactionManager * tm );
+
 protected:
 
     virtual ZR::RetVal processItem( RsZeroReserveItem * item ) = 0;
+    /** the result of a wallet operation this TX submitted. Same return values as processItem() */
+    virtual ZR::RetVal walletDone( const WalletRequest & request );
 
     virtual void rollback() = 0;
     virtual bool isTimedOut();
 
+    /** let items under another TX ID reach this TM as well, until it is destroyed */
+    void addAlias( const ZR::TransactionId & alias );
+
 
     const ZR::TransactionId m_TxId;
     TxPhase m_Phase;
     qint64 m_startOfPhase;
     /** maximum time of each phase */
     qint64 m_maxTime[ PHASE_NUMBER ];
-
-    static TxManagers currentTX;
+    std::vector< ZR::TransactionId > m_aliases;
 
     static void split(const std::string & s, std::vector< std::string > & v, const char sep = ':' );
+
+private:
+    class Shard
+    {
+    public:
+        Shard() : m_mutex( "tx_shard_mutex" ), m_creation_mutex( "tx_creation_mutex" ) {}
+        TxManagers m_managers;
+        RsMutex m_mutex;
+        RsMutex m_creation_mutex;   // one new TM at a time, so an ID is not set up twice
+    };
+
+    static Shard & shard( const ZR::TransactionId & txId );
+    static void registerTx( const ZR::TransactionId & txId, TransactionManager * tm );
+    /** remove the entry if it still belongs to tm */
+    static void unregisterTx( const ZR::TransactionId & txId, TransactionManager * tm );
+    /** find a TM and hold on to it, NULL if there is none */
+    static TransactionManager * acquire( const ZR::TransactionId & txId );
+    static void release( TransactionManager * tm );
+    /** hand an item or a wallet result to a TM in its strand and end the TM if it is done */
+    static ZR::RetVal process( TransactionManager * tm, RsZeroReserveItem * item, const WalletRequest * request = NULL );
+
+    RsMutex m_strand;          // serialises the items of this TX
+    RsMutex m_ref_mutex;
+    unsigned int m_refs;       // threads working on this TM
+    bool m_retired;
+
+    static const unsigned int SHARDS = 16;
+    static Shard shards[ SHARDS ];
 };
 
 #endif // TRANSACTIONMANAGER_H
@@ -0,0 +1,361 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TxJournal.h"
+
+#include <QDateTime>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string.h>
+
+
+const char * const TxJournal::SUFFIX = ".txj";
+const unsigned int TxJournal::HEADER_SIZE = 16;
+const unsigned int TxJournal::RECORD_SIZE = 72;
+const unsigned int TxJournal::SYNC_BATCH = 16;
+const qint64 TxJournal::SYNC_INTERVAL = 1000;  // one second
+
+const unsigned int TxJournalReader::INDEX_STRIDE = 256;
+
+// Record layout, all integers little endian:
+//  0 peer id, 32 bytes, zero padded
+// 32 currency symbol, 4 bytes, zero padded
+// 36 amount numerator, int64
+// 44 amount denominator, int64, exact like the amounts in the DB
+// 52 timestamp, int64, ms since epoch
+// 60 sequence number, uint64
+// 68 CRC32 of bytes 0 - 67
+static const unsigned int PEER_LEN = 32;
+static const unsigned int CURRENCY_LEN = 4;
+static const unsigned int CRC_OFFSET = 68;
+
+static const char JOURNAL_MAGIC[] = "ZRTXJRN";  // 7 bytes + format version
+static const unsigned char JOURNAL_VERSION = 2;   // 1 had fixed point amounts, cut at one Satoshi
+
+
+static uint32_t crc32( const unsigned char * data, unsigned int len )
+{
+    static uint32_t table[ 256 ];
+    static bool initialized = false;
+    if( !initialized ){
+        for( uint32_t i = 0; i < 256; i++ ){
+            uint32_t c = i;
+            for( int k = 0; k < 8; k++ )
+                c = ( c & 1 ) ? 0xEDB88320 ^ ( c >> 1 ) : c >> 1;
+            table[ i ] = c;
+        }
+        initialized = true;
+    }
+    uint32_t crc = 0xFFFFFFFF;
+    for( unsigned int i = 0; i < len; i++ )
+        crc = table[ ( crc ^ data[ i ] ) & 0xFF ] ^ ( crc >> 8 );
+    return crc ^ 0xFFFFFFFF;
+}
+
+static void putUInt64( unsigned char * out, uint64_t val )
+{
+    for( int i = 0; i < 8; i++ ){
+        out[ i ] = val & 0xFF;
+        val >>= 8;
+    }
+}
+
+static uint64_t getUInt64( const unsigned char * in )
+{
+    uint64_t val = 0;
+    for( int i = 7; i >= 0; i-- ){
+        val = ( val << 8 ) | in[ i ];
+    }
+    return val;
+}
+
+static void putUInt32( unsigned char * out, uint32_t val )
+{
+    for( int i = 0; i < 4; i++ ){
+        out[ i ] = val & 0xFF;
+        val >>= 8;
+    }
+}
+
+static uint32_t getUInt32( const unsigned char * in )
+{
+    return in[ 0 ] | ( in[ 1 ] << 8 ) | ( in[ 2 ] << 16 ) | ( (uint32_t)in[ 3 ] << 24 );
+}
+
+static std::string getFixedString( const unsigned char * in, unsigned int len )
+{
+    const char * s = reinterpret_cast< const char * >( in );
+    return std::string( s, strnlen( s, len ) );
+}
+
+
+///////////////////// TxJournal /////////////////////////////
+
+
+uint32_t TxJournal::checksum( const unsigned char * data, unsigned int len )
+{
+    return crc32( data, len );
+}
+
+bool TxJournal::isJournal( const std::string & path )
+{
+    std::string suffix( SUFFIX );
+    return path.length() > suffix.length() && path.compare( path.length() - suffix.length(), suffix.length(), suffix ) == 0;
+}
+
+std::string TxJournal::indexPath( const std::string & path )
+{
+    // zeroreserve.txj keeps zeroreserve.tx as its secondary index
+    return path.substr( 0, path.length() - 1 );
+}
+
+void TxJournal::encode( const Entry & entry, unsigned char * out )
+{
+    memset( out, 0, RECORD_SIZE );
+    memcpy( out, entry.m_peerId.c_str(), std::min( (size_t)PEER_LEN, entry.m_peerId.length() ) );
+    memcpy( out + PEER_LEN, entry.m_currency.c_str(), std::min( (size_t)CURRENCY_LEN - 1, entry.m_currency.length() ) );
+    putUInt64( out + 36, (uint64_t)entry.m_amount.numerator() );
+    putUInt64( out + 44, (uint64_t)entry.m_amount.denominator() );
+    putUInt64( out + 52, (uint64_t)entry.m_timeStamp );
+    putUInt64( out + 60, entry.m_sequence );
+    putUInt32( out + CRC_OFFSET, crc32( out, CRC_OFFSET ) );
+}
+
+bool TxJournal::decode( const unsigned char * in, Entry & entry )
+{
+    if( crc32( in, CRC_OFFSET ) != getUInt32( in + CRC_OFFSET ) )
+        return false;
+
+    entry.m_peerId = getFixedString( in, PEER_LEN );
+    entry.m_currency = getFixedString( in + PEER_LEN, CURRENCY_LEN );
+    int64_t denominator = (int64_t)getUInt64( in + 44 );
+    if( denominator <= 0 ) return false;
+    entry.m_amount = ZR::ZR_Number( (int64_t)getUInt64( in + 36 ), denominator );
+    entry.m_timeStamp = (qint64)getUInt64( in + 52 );
+    entry.m_sequence = getUInt64( in + 60 );
+    return true;
+}
+
+bool TxJournal::checkHeader( const unsigned char * in )
+{
+    return memcmp( in, JOURNAL_MAGIC, 7 ) == 0 && in[ 7 ] == JOURNAL_VERSION && getUInt32( in + 8 ) == RECORD_SIZE;
+}
+
+
+TxJournal::TxJournal( const std::string & path ) :
+    m_path( path ),
+    m_file( QString::fromStdString( path ) ),
+    m_sequence( 0 ),
+    m_unsynced( 0 ),
+    m_lastSync( 0 )
+{
+}
+
+TxJournal::~TxJournal()
+{
+    close();
+}
+
+void TxJournal::open()
+{
+    if( !m_file.open( QFile::ReadWrite ) ){
+        throw std::runtime_error( std::string( "Cannot open transaction journal " ) + m_path );
+    }
+
+    qint64 fileSize = m_file.size();
+    if( fileSize == 0 ){
+        unsigned char header[ HEADER_SIZE ];
+        memset( header, 0, HEADER_SIZE );
+        memcpy( header, JOURNAL_MAGIC, 7 );
+        header[ 7 ] = JOURNAL_VERSION;
+        putUInt32( header + 8, RECORD_SIZE );
+        m_file.write( reinterpret_cast< const char * >( header ), HEADER_SIZE );
+        sync();
+        return;
+    }
+
+    unsigned char header[ HEADER_SIZE ];
+    if( fileSize < HEADER_SIZE || m_file.read( reinterpret_cast< char * >( header ), HEADER_SIZE ) != HEADER_SIZE || !checkHeader( header ) ){
+        m_file.close();
+        throw std::runtime_error( std::string( "Not a transaction journal: " ) + m_path );
+    }
+
+    m_sequence = ( fileSize - HEADER_SIZE ) / RECORD_SIZE;
+    qint64 end = HEADER_SIZE + m_sequence * RECORD_SIZE;
+    if( end != fileSize ){
+        // a crash in the middle of an append - cut the torn record so the next one is aligned
+        std::cerr << "Zero Reserve: Truncating torn record in " << m_path << std::endl;
+        m_file.resize( end );
+    }
+    m_file.seek( end );
+}
+
+void TxJournal::close()
+{
+    if( !m_file.isOpen() ) return;
+    sync();
+    m_file.close();
+}
+
+void TxJournal::append( const std::string & peerId, const std::string & currency, const ZR::ZR_Number & amount )
+{
+    Entry entry;
+    entry.m_peerId = peerId;
+    entry.m_currency = currency;
+    entry.m_amount = amount;
+    entry.m_timeStamp = QDateTime::currentMSecsSinceEpoch();
+    entry.m_sequence = m_sequence;
+
+    unsigned char record[ RECORD_SIZE ];
+    encode( entry, record );
+    if( m_file.write( reinterpret_cast< const char * >( record ), RECORD_SIZE ) != RECORD_SIZE ){
+        throw std::runtime_error( std::string( "Cannot append to transaction journal " ) + m_path );
+    }
+    m_file.flush();   // make it visible to mapped readers, durability comes with sync()
+    m_sequence++;
+    m_unsynced++;
+
+    if( m_unsynced >= SYNC_BATCH || entry.m_timeStamp - m_lastSync > SYNC_INTERVAL ){
+        sync();
+    }
+}
+
+void TxJournal::syncPending()
+{
+    if( m_unsynced > 0 ) sync();
+}
+
+void TxJournal::sync()
+{
+    m_file.flush();
+#ifdef WIN32
+    _commit( m_file.handle() );
+#else
+    fsync( m_file.handle() );
+#endif
+    m_unsynced = 0;
+    m_lastSync = QDateTime::currentMSecsSinceEpoch();
+}
+
+
+///////////////////// TxJournalReader /////////////////////////////
+
+
+TxJournalReader::TxJournalReader( const std::string & path ) :
+    m_file( QString::fromStdString( path ) ),
+    m_map( NULL ),
+    m_mapSize( 0 ),
+    m_records( 0 )
+{
+}
+
+TxJournalReader::~TxJournalReader()
+{
+    unmap();
+}
+
+void TxJournalReader::unmap()
+{
+    if( m_map ){
+        m_file.unmap( m_map );
+        m_map = NULL;
+    }
+    if( m_file.isOpen() ) m_file.close();
+}
+
+bool TxJournalReader::refresh()
+{
+    unmap();
+    if( !m_file.open( QFile::ReadOnly ) ) return false;
+
+    m_mapSize = m_file.size();
+    if( m_mapSize < TxJournal::HEADER_SIZE ) return false;
+    m_map = m_file.map( 0, m_mapSize );
+    if( !m_map ) return false;
+    if( !TxJournal::checkHeader( m_map ) ){
+        unmap();
+        return false;
+    }
+
+    m_records = ( m_mapSize - TxJournal::HEADER_SIZE ) / TxJournal::RECORD_SIZE;
+
+    // extend the sparse index by the records appended since the last refresh
+    for( uint64_t index = m_sparseIndex.size() * INDEX_STRIDE; index < m_records; index += INDEX_STRIDE ){
+        TxJournal::Entry entry;
+        if( !read( index, entry ) ){
+            // keep the index monotonic even over a damaged record
+            entry.m_timeStamp = m_sparseIndex.empty() ? 0 : m_sparseIndex.back();
+        }
+        m_sparseIndex.push_back( entry.m_timeStamp );
+    }
+    return true;
+}
+
+bool TxJournalReader::read( uint64_t index, TxJournal::Entry & entry ) const
+{
+    if( !m_map || index >= m_records ) return false;
+    return TxJournal::decode( m_map + TxJournal::HEADER_SIZE + index * TxJournal::RECORD_SIZE, entry );
+}
+
+uint64_t TxJournalReader::find( qint64 t ) const
+{
+    if( m_sparseIndex.empty() ) return 0;
+
+    // last sparse entry strictly before t, then walk forward within the stride
+    std::vector< qint64 >::const_iterator it = std::lower_bound( m_sparseIndex.begin(), m_sparseIndex.end(), t );
+    uint64_t index = ( it == m_sparseIndex.begin() ) ? 0 : ( it - m_sparseIndex.begin() - 1 ) * INDEX_STRIDE;
+    for( ; index < m_records; index++ ){
+        TxJournal::Entry entry;
+        if( read( index, entry ) && entry.m_timeStamp >= t ) break;
+    }
+    return index;
+}
+
+void TxJournalReader::range( qint64 from, qint64 to, EntryList & entries )
+{
+    for( uint64_t index = find( from ); index < m_records; index++ ){
+        TxJournal::Entry entry;
+        if( !read( index, entry ) ){
+            std::cerr << "Zero Reserve: Checksum error in transaction journal, record " << index << std::endl;
+            continue;
+        }
+        if( entry.m_timeStamp >= to ) break;
+        entries.push_back( entry );
+    }
+}
+
+void TxJournalReader::tail( uint64_t & position, EntryList & entries )
+{
+    refresh();
+    for( ; position < m_records; position++ ){
+        TxJournal::Entry entry;
+        if( read( position, entry ) ){
+            entries.push_back( entry );
+        }
+        else {
+            std::cerr << "Zero Reserve: Checksum error in transaction journal, record " << position << std::endl;
+        }
+    }
+}
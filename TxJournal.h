@@ -0,0 +1,145 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TXJOURNAL_H
+#define TXJOURNAL_H
+
+#include "zrtypes.h"
+
+#include <QFile>
+
+#include <string>
+#include <vector>
+#include <list>
+
+
+/**
+ * @brief Append-only, checksummed binary transaction log
+ *
+ * The journal is a file header followed by fixed size records. Each record holds the
+ * peer ID, the currency code, the amount as exact fraction and a millisecond timestamp,
+ * protected by a CRC32. Records are never rewritten, a torn record at the end of the file
+ * is ignored by the reader.
+ *
+ * @see TxJournalReader
+ */
+
+class TxJournal
+{
+    TxJournal();
+    TxJournal( const TxJournal & );
+public:
+    /** a single decoded record */
+    class Entry
+    {
+    public:
+        std::string m_peerId;
+        std::string m_currency;
+        ZR::ZR_Number m_amount;
+        qint64 m_timeStamp;
+        uint64_t m_sequence;
+    };
+
+    TxJournal( const std::string & path );
+    ~TxJournal();
+
+    /** open or create the journal. Throws std::runtime_error on failure */
+    void open();
+    void close();
+
+    void append( const std::string & peerId, const std::string & currency, const ZR::ZR_Number & amount );
+    /** force all appended records to disk */
+    void sync();
+    /** sync if anything was appended since the last sync, so the tail of a burst does not wait for the next append */
+    void syncPending();
+
+    const std::string & path() const { return m_path; }
+
+    /** a TXLOGPATH ending in the journal suffix selects the journal instead of the SQLite tx log */
+    static bool isJournal( const std::string & path );
+    /** path of the optional SQLite secondary index of a journal */
+    static std::string indexPath( const std::string & path );
+
+    static const char * const SUFFIX;
+    static const unsigned int HEADER_SIZE;
+    static const unsigned int RECORD_SIZE;
+
+    /** the CRC32 of the records, for other logs which want the same */
+    static uint32_t checksum( const unsigned char * data, unsigned int len );
+
+    static void encode( const Entry & entry, unsigned char * out );
+    /** @return false if the record checksum does not match */
+    static bool decode( const unsigned char * in, Entry & entry );
+    static bool checkHeader( const unsigned char * in );
+
+private:
+    std::string m_path;
+    QFile m_file;
+    uint64_t m_sequence;
+    unsigned int m_unsynced;   // records written since the last fsync
+    qint64 m_lastSync;
+
+    static const unsigned int SYNC_BATCH;
+    static const qint64 SYNC_INTERVAL;
+};
+
+
+/**
+ * @brief Read only, memory mapped view on a @see TxJournal
+ *
+ * Keeps a sparse index of every INDEX_STRIDE'th record timestamp to find time ranges
+ * without decoding the whole file. Call refresh() to pick up records appended
+ * since the file was mapped.
+ */
+
+class TxJournalReader
+{
+    TxJournalReader();
+    TxJournalReader( const TxJournalReader & );
+public:
+    typedef std::list< TxJournal::Entry > EntryList;
+
+    TxJournalReader( const std::string & path );
+    ~TxJournalReader();
+
+    /** (re)map the file and extend the sparse index. @return false if the file cannot be mapped */
+    bool refresh();
+
+    uint64_t size() const { return m_records; }
+    bool read( uint64_t index, TxJournal::Entry & entry ) const;
+
+    /** all records with from <= timestamp < to, oldest first */
+    void range( qint64 from, qint64 to, EntryList & entries );
+    /** records appended since position, position is moved to the end */
+    void tail( uint64_t & position, EntryList & entries );
+
+    /** @return index of the first record with a timestamp >= t */
+    uint64_t find( qint64 t ) const;
+
+    static const unsigned int INDEX_STRIDE;
+
+private:
+    void unmap();
+
+    QFile m_file;
+    uchar * m_map;
+    qint64 m_mapSize;
+    uint64_t m_records;
+    std::vector< qint64 > m_sparseIndex;   // timestamp of record i * INDEX_STRIDE
+};
+
+#endif // TXJOURNAL_H
@@ -0,0 +1,105 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TxLogArchiver.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QByteArray>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include <iostream>
+
+
+const char * const TxLogArchiver::ARCHIVE_SUFFIX = ".z";
+
+
+TxLogArchiver::TxLogArchiver( const std::list< std::string > & files ) :
+    m_files( files )
+{
+}
+
+void TxLogArchiver::run()
+{
+    for( std::list< std::string >::const_iterator it = m_files.begin(); it != m_files.end(); it++ ){
+        archive( *it );
+    }
+}
+
+/** make a rename in dir durable. Windows has no handle to a directory, it journals the rename itself */
+static bool syncDir( const QString & dir )
+{
+#ifdef WIN32
+    (void)dir;
+    return true;
+#else
+    int fd = ::open( QFile::encodeName( dir ).constData(), O_RDONLY );
+    if( fd < 0 ) return false;
+    bool synced = ( fsync( fd ) == 0 );
+    ::close( fd );
+    return synced;
+#endif
+}
+
+void TxLogArchiver::archive( const std::string & path )
+{
+    QString source = QString::fromStdString( path );
+    QString target = source + ARCHIVE_SUFFIX;
+    QString tmp = target + ".tmp";
+
+    QFile in( source );
+    if( !in.open( QFile::ReadOnly ) ){
+        std::cerr << "Zero Reserve: Cannot read " << path << " for archiving" << std::endl;
+        return;
+    }
+    QByteArray compressed = qCompress( in.readAll(), 9 );
+    in.close();
+
+    // write aside and rename so that a crash never leaves a truncated archive
+    QFile::remove( tmp );
+    QFile out( tmp );
+    bool written = out.open( QFile::WriteOnly ) && out.write( compressed ) == compressed.size() && out.flush();
+#ifdef WIN32
+    written = written && _commit( out.handle() ) == 0;
+#else
+    written = written && fsync( out.handle() ) == 0;
+#endif
+    out.close();
+    if( !written ){
+        std::cerr << "Zero Reserve: Cannot write archive " << tmp.toStdString() << std::endl;
+        QFile::remove( tmp );
+        return;
+    }
+    QFile::remove( target );
+    if( !QFile::rename( tmp, target ) ){
+        std::cerr << "Zero Reserve: Cannot rename archive " << tmp.toStdString() << std::endl;
+        return;
+    }
+    // the source goes only once the archive is on disk under its name
+    if( !syncDir( QFileInfo( target ).absolutePath() ) ){
+        std::cerr << "Zero Reserve: Cannot sync the directory of " << target.toStdString() << ", keeping " << path << std::endl;
+        return;
+    }
+    QFile::remove( source );
+    std::cerr << "Zero Reserve: Archived " << path << std::endl;
+}
@@ -0,0 +1,50 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TXLOGARCHIVER_H
+#define TXLOGARCHIVER_H
+
+#include "util/rsthreads.h"
+
+#include <list>
+#include <string>
+
+
+/**
+ * @brief Compresses closed tx log partitions in the background
+ *
+ * Each file is replaced by a zlib compressed copy with the ARCHIVE_SUFFIX appended.
+ * Only hand it partitions which are already rolled up, nobody reads them afterwards.
+ */
+
+class TxLogArchiver : public RsThread
+{
+    TxLogArchiver();
+public:
+    TxLogArchiver( const std::list< std::string > & files );
+
+    virtual void run();
+
+    static const char * const ARCHIVE_SUFFIX;
+
+private:
+    void archive( const std::string & path );
+
+    std::list< std::string > m_files;
+};
+
+#endif // TXLOGARCHIVER_H
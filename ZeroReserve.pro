@@ -27,11 +27,24 @@ SOURCES = ZeroReserveDialog.cpp \
     Payment.cpp \
     TransactionManager.cpp \
     zrdb.cpp \
+    ZrSqliteDB.cpp \
+    ZrMemoryDB.cpp \
+    ZrConfig.cpp \
     MyOrders.cpp \
     Credit.cpp \
     dbconfig.cpp \
     Router.cpp \
     TraceRouter.cpp \
+    CapacityProbe.cpp \
+    SendQueue.cpp \
+    InboundQueue.cpp \
+    OrderAggregator.cpp \
+    ZrScheduler.cpp \
+    AsyncWallet.cpp \
+    TmJournal.cpp \
+    OrderSweep.cpp \
+    ZrApiServer.cpp \
+    ZrShmFeed.cpp \
     RSZRRemoteItems.cpp \
     TmLocalCoordinator.cpp \
     TmLocalCohorte.cpp \
@@ -41,7 +54,9 @@ SOURCES = ZeroReserveDialog.cpp \
     TmContract.cpp \
     CurrentTxList.cpp \
     helpers.cpp \
-    FriendResetDialog.cpp
+    FriendResetDialog.cpp \
+    TxJournal.cpp \
+    TxLogArchiver.cpp
 
 LIBS += -lsqlite3
 QMAKE_CXXFLAGS += -rdynamic -fPIC
@@ -50,6 +65,10 @@ win32 {
     INCLUDEPATH += ../../../libsqlite ../../../boost
 }
 
+linux {
+    LIBS += -lrt    # shm_open
+}
+
 
 HEADERS = ZeroReserveDialog.h \
     ZeroReservePlugin.h \
@@ -62,12 +81,25 @@ HEADERS = ZeroReserveDialog.h \
     Payment.h \
     TransactionManager.h \
     zrdb.h \
+    ZrSqliteDB.h \
+    ZrMemoryDB.h \
+    ZrConfig.h \
     zrtypes.h \
     MyOrders.h \
     Credit.h \
     dbconfig.h \
     Router.h \
     TraceRouter.h \
+    CapacityProbe.h \
+    SendQueue.h \
+    InboundQueue.h \
+    OrderAggregator.h \
+    ZrScheduler.h \
+    AsyncWallet.h \
+    TmJournal.h \
+    OrderSweep.h \
+    ZrApiServer.h \
+    ZrShmFeed.h \
     RSZRRemoteItems.h \
     TmLocalCoordinator.h \
     TmLocalCohorte.h \
@@ -79,7 +111,9 @@ HEADERS = ZeroReserveDialog.h \
     TmContract.h \
     CurrentTxList.h \
     helpers.h \
-    FriendResetDialog.h
+    FriendResetDialog.h \
+    TxJournal.h \
+    TxLogArchiver.h
 
 FORMS = ZeroReserveDialog.ui \
     frienddetailsdialog.ui \
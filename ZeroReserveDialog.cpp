@@ -29,6 +29,7 @@
 #include "NewWallet.h"
 #include "PeerAddressDialog.h"
 #include "CurrentTxList.h"
+#include "TmJournal.h"
 
 #include <QMenu>
 #include <QTimer>
@@ -49,6 +50,7 @@ ZeroReserveDialog::ZeroReserveDialog(OrderBook * bids, OrderBook * asks, QWidget
     m_update = true;
 
     Payment::txLogView = ui.paymentHistoryList;
+    TmJournal::Instance()->replay();   // my orders may need the fills of TX a crash cut short
     MyOrders * myOrders = MyOrders::Instance();
     if( myOrders->init() == ZR::ZR_FAILURE ){
         QMessageBox::critical( this, "Zero Reserve", "Could not load my Orders. Suggest exiting RS and fix the problem" );
@@ -162,14 +164,29 @@ void ZeroReserveDialog::janitor()
     g_ZeroReservePlugin->displayMsg();
     ui.paymentHistoryList->setCurrentRow( 0 ); // make the view emit currentItemChanged
     setWalletStatus();
+    setOrderBookUsage();
+}
+
+void ZeroReserveDialog::setOrderBookUsage()
+{
+    OrderBook::Usage asks, bids;
+    static_cast<OrderBook*>(ui.asksTableView->model())->getUsage( asks );
+    static_cast<OrderBook*>(ui.bidsTableView->model())->getUsage( bids );
+
+    ui.OrderBookUsage->setText( QString( "%1 orders, %2 kB" ).arg( asks.orders + bids.orders ).arg( ( asks.bytes + bids.bytes ) / 1024 ) );
+    ui.OrderBookUsage->setToolTip( QString( "Asks: %1 orders, %2 kB\nBids: %3 orders, %4 kB\nEvicted: %5, rejected: %6" )
+                                   .arg( asks.orders ).arg( asks.bytes / 1024 ).arg( bids.orders ).arg( bids.bytes / 1024 )
+                                   .arg( asks.evicted + bids.evicted ).arg( asks.rejected + bids.rejected ) );
 }
 
 void ZeroReserveDialog::loadTxLog()
 {
     std::list< ZrDB::TxLogItem > txList;
+    std::list< ZrDB::TxRollup > rollups;
     QStringList txStringList;
     try{
         ZrDB::Instance()->loadTxLog( txList );
+        ZrDB::Instance()->loadTxRollups( rollups );
     }
     catch( std::exception e ){
         std::cerr << "Zero Reserve: " << e.what() << std::endl;
@@ -179,6 +196,13 @@ void ZeroReserveDialog::loadTxLog()
         const ZrDB::TxLogItem & item = *it;
         txStringList.append( item.timestamp.toString() + " : " + item.currency + " : " + item.m_amount.toDecimalQString() );
     }
+    // older months only as sums per friend and currency
+    for( std::list< ZrDB::TxRollup >::const_iterator it = rollups.begin(); it != rollups.end(); it++ ){
+        const ZrDB::TxRollup & rollup = *it;
+        QString peer = QString::fromStdString( rsPeers->getPeerName( rollup.id.toStdString() ) );
+        txStringList.append( QString::fromStdString( rollup.partition ) + " : " + peer + " : " + rollup.currency + " : " +
+                             rollup.m_amount.toDecimalQString() + " (" + QString::number( rollup.count ) + " payments)" );
+    }
     ui.paymentHistoryList->insertItems( 0, txStringList );
 }
 
@@ -257,10 +281,13 @@ void ZeroReserveDialog::payTo()
 
 void ZeroReserveDialog::addBid()
 {
-    if( ui.bid_price->text() == "" ||  ui.bid_amount->text() == "" )return;
+    OrderBook::Order::Execution execution = static_cast< OrderBook::Order::Execution >( ui.bidExecution->currentIndex() );
+    if( ui.bid_amount->text() == "" )return;
+    if( ui.bid_price->text() == "" && execution != OrderBook::Order::MARKET )return;
 
     OrderBook * bids = static_cast<OrderBook*>(ui.bidsTableView->model());
-    doOrder( bids, OrderBook::Order::BID, ZR::ZR_Number::fromDecimalString( ui.bid_price->text() ), ZR::ZR_Number::fromDecimalString( ui.bid_amount->text() ) );
+    ZR::ZR_Number price = ( execution == OrderBook::Order::MARKET )? ZR::ZR_Number( 0 ) : ZR::ZR_Number::fromDecimalString( ui.bid_price->text() );
+    doOrder( bids, OrderBook::Order::BID, price, ZR::ZR_Number::fromDecimalString( ui.bid_amount->text() ), execution );
 }
 
 void ZeroReserveDialog::addAsk()
@@ -280,18 +307,45 @@ void ZeroReserveDialog::cancelOrder()
     myOrders->cancelOrder( indexes.at( 0 ).row() );
 }
 
+void ZeroReserveDialog::amendOrder()
+{
+    QModelIndexList indexes = ui.myOrders->selectionModel()->selection().indexes();
+    if( indexes.empty() )
+        return;
+    MyOrders * myOrders = static_cast< MyOrders* >( ui.myOrders->model() );
+    int row = indexes.at( 0 ).row();
+
+    bool ok;
+    QString price = QInputDialog::getText( this, "Amend Order", "New Price:", QLineEdit::Normal,
+                                           QString::number( myOrders->data( myOrders->index( row, 2, QModelIndex() ) ).toDouble(), 'f', 8 ), &ok );
+    if( !ok || price.isEmpty() ) return;
+    QString amount = QInputDialog::getText( this, "Amend Order", "New Amount:", QLineEdit::Normal,
+                                            QString::number( myOrders->data( myOrders->index( row, 1, QModelIndex() ) ).toDouble(), 'f', 8 ), &ok );
+    if( !ok || amount.isEmpty() ) return;
+
+    ZR::ZR_Number newPrice = ZR::ZR_Number::fromDecimalString( price );
+    ZR::ZR_Number newAmount = ZR::ZR_Number::fromDecimalString( amount );
+    if( newAmount <= 0 || newPrice <= 0 ){
+        QMessageBox::warning( this, "Amend Order", "Amount and Price must be greater than zero" );
+        return;
+    }
+    myOrders->amendOrder( row, newPrice, newAmount );
+}
+
 void ZeroReserveDialog::contextMenuMyOrders( const QPoint & )
 {
     QMenu contextMnu(this);
     QAction *action = contextMnu.addAction(QIcon(), tr("Cancel Order"), this, SLOT(cancelOrder()));
     action->setEnabled(true);
+    action = contextMnu.addAction(QIcon(), tr("Amend Order"), this, SLOT(amendOrder()));
+    action->setEnabled(true);
     contextMnu.exec(QCursor::pos());
 }
 
 
-void ZeroReserveDialog::doOrder( OrderBook * book, OrderBook::Order::OrderType type, ZR::ZR_Number price, ZR::ZR_Number amount )
+void ZeroReserveDialog::doOrder( OrderBook * book, OrderBook::Order::OrderType type, ZR::ZR_Number price, ZR::ZR_Number amount, OrderBook::Order::Execution execution )
 {
-    if( amount <= 0 || price <= 0 ){
+    if( amount <= 0 || ( price <= 0 && execution != OrderBook::Order::MARKET ) ){
         QMessageBox::warning( this, "New Order", "Amount and Price must be greater than zero" );
         return;
     }
@@ -303,6 +357,7 @@ void ZeroReserveDialog::doOrder( OrderBook * book, OrderBook::Order::OrderType t
     order->m_orderType = type;
     order->m_isMyOrder = true;
     order->m_purpose = OrderBook::Order::NEW;
+    order->m_execution = execution;
     order->m_timeStamp = QDateTime::currentMSecsSinceEpoch();
     order->setOrderId();
 
@@ -50,14 +50,17 @@ private slots:
     void payTo();
     void loadGrandTotal();
     void cancelOrder();
+    void amendOrder();
     void contextMenuMyOrders(const QPoint & );
     void janitor();
     void showCurrentTx();
 
 private:
-    void doOrder(OrderBook * book, OrderBook::Order::OrderType type, ZR::ZR_Number price, ZR::ZR_Number amount );
+    void doOrder(OrderBook * book, OrderBook::Order::OrderType type, ZR::ZR_Number price, ZR::ZR_Number amount,
+                 OrderBook::Order::Execution execution = OrderBook::Order::LIMIT );
     void loadTxLog();
     void setWalletStatus();
+    void setOrderBookUsage();
 
     Ui::ZeroReserveDialog ui;
     bool m_update;
@@ -24,6 +24,8 @@
 #include "zrdb.h"
 #include "dbconfig.h"
 #include "ZRBitcoin.h"
+#include "AsyncWallet.h"
+#include "ZrApiServer.h"
 #include "util/rsversion.h"
 
 #include <retroshare/rsplugin.h>
@@ -185,6 +187,8 @@ void ZeroReservePlugin::stop()
 
     std::cerr << "Zero Reserve: Closing Database" << std::endl;
     m_stopped = true;
+    ZrApiServer::Instance()->stop();
+    AsyncWallet::Instance()->stop();
     ZrDB::Instance()->close();
     ZR::Bitcoin::Instance()->stop();
 }
@@ -0,0 +1,677 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ZrApiServer.h"
+#include "MyOrders.h"
+#include "ZRBitcoin.h"
+#include "ZeroReservePlugin.h"
+#include "p3ZeroReserverRS.h"
+
+#include "retroshare/rsinit.h"
+
+#include <QDateTime>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string.h>
+
+
+const unsigned int ZrApiServer::MAX_FRAME = 65536;
+const unsigned int ZrApiServer::MAX_BACKLOG = 1048576;
+const unsigned int ZrApiServer::MAX_PENDING = 256;
+
+ZrApiServer * ZrApiServer::instance = 0;
+RsMutex ZrApiServer::creation_mutex( "api_server_creation_mutex" );
+
+
+ZrApiServer * ZrApiServer::Instance()
+{
+    RsStackMutex creationMutex( creation_mutex );
+    if( !ZrApiServer::instance ){
+        ZrApiServer::instance = new ZrApiServer();
+    }
+    return ZrApiServer::instance;
+}
+
+ZrApiServer::ZrApiServer() :
+    m_serials( 0 ),
+    m_watchers( 0 ),
+    m_listenFd( -1 ),
+    m_epollFd( -1 ),
+    m_wakeFd( -1 ),
+    m_started( false ),
+    m_stopped( false ),
+    m_mutex( "api_server_mutex" ),
+    m_worker( this )
+{
+}
+
+
+static void split( const std::string & s, char delim, std::vector< std::string > & out )
+{
+    std::istringstream ss( s );
+    std::string item;
+    while( std::getline( ss, item, delim ) ) out.push_back( item );
+}
+
+
+void ZrApiServer::listen( const std::string & path )
+{
+    if( m_started || path.empty() ) return;
+    m_started = true;
+
+#ifdef __linux__
+    std::string sockPath = path;
+    if( path.find( '/' ) == std::string::npos ){
+        p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+        sockPath = RsInit::RsConfigDirectory() + "/" + p3zr->getOwnId() + "/zeroreserve/" + path;
+    }
+    sockaddr_un addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    if( sockPath.length() >= sizeof( addr.sun_path ) ){
+        std::cerr << "Zero Reserve: API socket path too long: " << sockPath << std::endl;
+        return;
+    }
+    strncpy( addr.sun_path, sockPath.c_str(), sizeof( addr.sun_path ) - 1 );
+
+    m_listenFd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    unlink( sockPath.c_str() );   // left over from the last run
+    if( m_listenFd < 0 || bind( m_listenFd, (sockaddr*)&addr, sizeof( addr ) ) != 0
+            || chmod( sockPath.c_str(), S_IRUSR | S_IWUSR ) != 0 || ::listen( m_listenFd, 16 ) != 0 ){
+        std::cerr << "Zero Reserve: Cannot listen on " << sockPath << ": " << strerror( errno ) << std::endl;
+        if( m_listenFd >= 0 ) ::close( m_listenFd );
+        m_listenFd = -1;
+        return;
+    }
+
+    m_epollFd = epoll_create1( EPOLL_CLOEXEC );
+    m_wakeFd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    epoll_event ev;
+    memset( &ev, 0, sizeof( ev ) );
+    ev.events = EPOLLIN;
+    ev.data.fd = m_listenFd;
+    epoll_ctl( m_epollFd, EPOLL_CTL_ADD, m_listenFd, &ev );
+    ev.data.fd = m_wakeFd;
+    epoll_ctl( m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &ev );
+
+    // the books report fills of my orders, too
+    MyOrders * myOrders = MyOrders::Instance();
+    myOrders->getBids()->addListener( this );
+    myOrders->getAsks()->addListener( this );
+
+    std::cerr << "Zero Reserve: Trading API listening on " << sockPath << std::endl;
+    m_worker.start();
+    start();
+#else
+    std::cerr << "Zero Reserve: The trading API is only available on Linux" << std::endl;
+#endif
+}
+
+
+void ZrApiServer::run()
+{
+#ifdef __linux__
+    const int MAX_EVENTS = 32;
+    epoll_event events[ MAX_EVENTS ];
+    for( ;; ){
+        int n = epoll_wait( m_epollFd, events, MAX_EVENTS, -1 );
+        if( n < 0 ){
+            if( errno == EINTR ) continue;
+            std::cerr << "Zero Reserve: Trading API stopped: " << strerror( errno ) << std::endl;
+            return;
+        }
+        {
+            QMutexLocker lock( &m_request_mutex );
+            if( m_stopped ) break;
+        }
+        for( int i = 0; i < n; i++ ){
+            int fd = events[ i ].data.fd;
+            if( fd == m_listenFd ){
+                acceptClients();
+            }
+            else if( fd == m_wakeFd ){
+                uint64_t count;
+                while( read( m_wakeFd, &count, sizeof( count ) ) > 0 ){}
+            }
+            else if( events[ i ].events & ( EPOLLHUP | EPOLLERR ) ){
+                closeClient( fd );
+            }
+            else if( events[ i ].events & EPOLLIN ){
+                readClient( fd );
+            }
+        }
+        flushClients();
+    }
+#endif
+}
+
+
+void ZrApiServer::stop()
+{
+#ifdef __linux__
+    if( m_listenFd < 0 ) return;   // never listened
+    {
+        QMutexLocker lock( &m_request_mutex );
+        if( m_stopped ) return;
+        m_stopped = true;
+        m_requested.wakeAll();
+    }
+    wake();
+    m_worker.join();
+    join();
+
+    // the threads are gone. The wake and epoll fds stay open, the service thread may still reply
+    std::list< int > clients;
+    {
+        RsStackMutex mutex( m_mutex );
+        for( Clients::const_iterator it = m_clients.begin(); it != m_clients.end(); it++ ) clients.push_back( (*it).first );
+    }
+    for( std::list< int >::const_iterator it = clients.begin(); it != clients.end(); it++ ) closeClient( *it );
+    ::close( m_listenFd );
+    std::cerr << "Zero Reserve: Trading API stopped" << std::endl;
+#endif
+}
+
+
+void ZrApiServer::acceptClients()
+{
+#ifdef __linux__
+    for( ;; ){
+        int fd = accept4( m_listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if( fd < 0 ) return;
+        epoll_event ev;
+        memset( &ev, 0, sizeof( ev ) );
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl( m_epollFd, EPOLL_CTL_ADD, fd, &ev );
+
+        RsStackMutex mutex( m_mutex );
+        Client & client = m_clients[ fd ] = Client();
+        client.m_serial = ++m_serials;
+    }
+#endif
+}
+
+
+void ZrApiServer::readClient( int fd )
+{
+#ifdef __linux__
+    Requests requests;
+    bool closed = false;
+    {
+        RsStackMutex mutex( m_mutex );
+        Clients::iterator it = m_clients.find( fd );
+        if( it == m_clients.end() ) return;
+        Client & client = (*it).second;
+
+        // frames are taken after every read, so m_in never holds more than one frame and a read
+        char buf[ 4096 ];
+        for( ;; ){
+            ssize_t got = read( fd, buf, sizeof( buf ) );
+            if( got > 0 ){
+                client.m_in.append( buf, got );
+                if( !takeFrames( fd, client, requests ) ){
+                    closed = true;
+                    break;
+                }
+                continue;
+            }
+            if( got == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) ) closed = true;
+            if( got < 0 && errno == EINTR ) continue;
+            break;
+        }
+    }
+
+    if( !requests.empty() ){
+        QMutexLocker lock( &m_request_mutex );
+        m_requests.splice( m_requests.end(), requests );
+        m_requested.wakeOne();
+    }
+    if( closed ) closeClient( fd );
+#endif
+}
+
+
+bool ZrApiServer::takeFrames( int fd, Client & client, Requests & requests )
+{
+    while( client.m_in.length() >= 4 ){
+        const unsigned char * p = reinterpret_cast< const unsigned char * >( client.m_in.data() );
+        uint32_t length = ( p[ 0 ] << 24 ) | ( p[ 1 ] << 16 ) | ( p[ 2 ] << 8 ) | p[ 3 ];
+        if( length == 0 || length > MAX_FRAME ) return false;   // out of step, no way back
+        if( client.m_in.length() < 4 + length ) break;
+        if( client.m_pending >= MAX_PENDING ){
+            std::cerr << "Zero Reserve: Trading API client does not wait for its replies, dropping it" << std::endl;
+            return false;
+        }
+        Request request;
+        request.m_fd = fd;
+        request.m_serial = client.m_serial;
+        request.m_op = client.m_in[ 4 ];
+        request.m_body = client.m_in.substr( 5, length - 1 );
+        requests.push_back( request );
+        client.m_pending++;
+        client.m_in.erase( 0, 4 + length );
+    }
+    return client.m_in.length() <= MAX_FRAME + 4;
+}
+
+
+void ZrApiServer::Worker::run()
+{
+    QMutexLocker lock( &m_server->m_request_mutex );
+    for( ;; ){
+        while( m_server->m_requests.empty() && !m_server->m_stopped ) m_server->m_requested.wait( &m_server->m_request_mutex );
+        if( m_server->m_stopped ) return;
+        Request request = m_server->m_requests.front();
+        m_server->m_requests.pop_front();
+
+        lock.unlock();
+        m_server->prepare( request );
+        lock.relock();
+    }
+}
+
+
+void ZrApiServer::prepare( Request & request )
+{
+    if( request.m_op == PLACE ){
+        try{
+            parseOrders( request.m_body, request.m_orders );
+        }
+        catch( std::exception & e ){
+            request.m_error = e.what();
+        }
+    }
+    // the Execution owns the orders from here
+    p3ZeroReserveRS * p3zr = static_cast< p3ZeroReserveRS* >( g_ZeroReservePlugin->rs_pqi_service() );
+    p3zr->post( new Execution( this, request ) );
+    request.m_orders.clear();
+}
+
+
+ZrApiServer::Execution::~Execution()
+{
+    for( std::vector< OrderBook::Order * >::iterator it = m_request.m_orders.begin(); it != m_request.m_orders.end(); it++ ) delete *it;
+}
+
+
+void ZrApiServer::Execution::run()
+{
+    m_server->handleRequest( m_request );
+}
+
+
+void ZrApiServer::flushClients()
+{
+#ifdef __linux__
+    std::list< int > dead;
+    {
+        RsStackMutex mutex( m_mutex );
+        for( Clients::iterator it = m_clients.begin(); it != m_clients.end(); it++ ){
+            int fd = (*it).first;
+            Client & client = (*it).second;
+            while( !client.m_dead && !client.m_out.empty() ){
+                ssize_t sent = send( fd, client.m_out.data(), client.m_out.length(), MSG_NOSIGNAL );
+                if( sent > 0 ){
+                    client.m_out.erase( 0, sent );
+                    continue;
+                }
+                if( sent < 0 && errno == EINTR ) continue;
+                if( sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK ) client.m_dead = true;
+                break;
+            }
+            if( client.m_dead ){
+                dead.push_back( fd );
+                continue;
+            }
+            bool writing = !client.m_out.empty();
+            if( writing == client.m_writing ) continue;
+            client.m_writing = writing;
+            epoll_event ev;
+            memset( &ev, 0, sizeof( ev ) );
+            ev.events = ( writing )? EPOLLIN | EPOLLOUT : EPOLLIN;
+            ev.data.fd = fd;
+            epoll_ctl( m_epollFd, EPOLL_CTL_MOD, fd, &ev );
+        }
+    }
+    for( std::list< int >::const_iterator it = dead.begin(); it != dead.end(); it++ ){
+        closeClient( *it );
+    }
+#endif
+}
+
+
+void ZrApiServer::closeClient( int fd )
+{
+#ifdef __linux__
+    RsStackMutex mutex( m_mutex );
+    Clients::iterator it = m_clients.find( fd );
+    if( it == m_clients.end() ) return;
+    if( (*it).second.m_watching ) m_watchers--;
+    m_clients.erase( it );
+    epoll_ctl( m_epollFd, EPOLL_CTL_DEL, fd, NULL );
+    ::close( fd );
+#endif
+}
+
+
+void ZrApiServer::wake()
+{
+#ifdef __linux__
+    uint64_t one = 1;
+    if( write( m_wakeFd, &one, sizeof( one ) ) < 0 ){}   // already awake if the counter is full
+#endif
+}
+
+
+void ZrApiServer::queue( Client & client, char op, const std::string & body )
+{
+    if( client.m_dead ) return;
+    if( client.m_out.length() + body.length() + 5 > MAX_BACKLOG ){
+        std::cerr << "Zero Reserve: Trading API client does not keep up, dropping it" << std::endl;
+        client.m_dead = true;
+        client.m_out.clear();
+        return;
+    }
+    uint32_t length = body.length() + 1;
+    client.m_out += (char)( length >> 24 );
+    client.m_out += (char)( length >> 16 );
+    client.m_out += (char)( length >> 8 );
+    client.m_out += (char)length;
+    client.m_out += op;
+    client.m_out += body;
+}
+
+
+void ZrApiServer::reply( const Request & request, char op, const std::string & body )
+{
+    {
+        RsStackMutex mutex( m_mutex );
+        Clients::iterator it = m_clients.find( request.m_fd );
+        if( it == m_clients.end() || (*it).second.m_serial != request.m_serial ) return;
+        Client & client = (*it).second;
+        client.m_pending--;
+        queue( client, op, body );
+    }
+    wake();
+}
+
+
+void ZrApiServer::broadcast( const std::string & currency, char op, const std::string & body )
+{
+    {
+        RsStackMutex mutex( m_mutex );
+        for( Clients::iterator it = m_clients.begin(); it != m_clients.end(); it++ ){
+            Client & client = (*it).second;
+            if( !client.m_watching ) continue;
+            if( !client.m_currencies.empty() && client.m_currencies.find( currency ) == client.m_currencies.end() ) continue;
+            queue( client, op, body );
+        }
+    }
+    wake();
+}
+
+
+void ZrApiServer::orderChanged( OrderBook *, const OrderBook::Order * order, bool removed )
+{
+    {
+        RsStackMutex mutex( m_mutex );
+        if( m_watchers == 0 ) return;
+    }
+    if( order->m_ignored ) return;
+    broadcast( Currency::currencySymbols[ order->m_currency ], DELTA, std::string( removed ? "R\t" : "N\t" ) + describe( order ) );
+}
+
+
+void ZrApiServer::orderFilled( const OrderBook::Order * order, const ZR::ZR_Number & amount )
+{
+    {
+        RsStackMutex mutex( m_mutex );
+        if( m_watchers == 0 ) return;
+    }
+    std::ostringstream body;
+    body << ( ( order->m_orderType == OrderBook::Order::ASK )? 'A' : 'B' ) << '\t'
+         << Currency::currencySymbols[ order->m_currency ] << '\t'
+         << order->m_order_id << '\t'
+         << order->m_price.toStdString() << '\t'
+         << amount.toStdString() << '\t'
+         << order->m_amount.toStdString();
+    broadcast( Currency::currencySymbols[ order->m_currency ], FILL, body.str() );
+}
+
+
+std::string ZrApiServer::describe( const OrderBook::Order * order )
+{
+    std::ostringstream line;
+    line << ( ( order->m_orderType == OrderBook::Order::ASK )? 'A' : 'B' ) << '\t'
+         << Currency::currencySymbols[ order->m_currency ] << '\t'
+         << order->m_order_id << '\t'
+         << order->m_price.toStdString() << '\t'
+         << order->m_amount.toStdString() << '\t'
+         << ( order->m_isMyOrder ? 1 : 0 );
+    return line.str();
+}
+
+
+bool ZrApiServer::parseNumber( const std::string & field, ZR::ZR_Number & number )
+{
+    if( field.empty() ) return false;
+    try{
+        if( field.find( '/' ) != std::string::npos ){
+            number = ZR::ZR_Number::fromFractionString( field );
+        }
+        else {
+            number = ZR::ZR_Number::fromDecimalString( field );
+        }
+    }
+    catch( std::exception & ){
+        return false;
+    }
+    return number > 0;
+}
+
+
+void ZrApiServer::handleRequest( Request & request )
+{
+    std::string result;
+    try{
+        switch( request.m_op ){
+        case PLACE:
+            if( !request.m_error.empty() ) throw std::runtime_error( request.m_error );
+            result = place( request.m_orders );
+            break;
+        case CANCEL:
+            result = cancel( request.m_body );
+            break;
+        case AMEND:
+            result = amend( request.m_body );
+            break;
+        case SNAPSHOT:
+            result = snapshot( request.m_body );
+            break;
+        case WATCH:
+            watch( request );
+            break;
+        default:
+            throw std::runtime_error( "Unknown request" );
+        }
+    }
+    catch( std::exception & e ){
+        reply( request, FAILED, e.what() );
+        return;
+    }
+    reply( request, OK, result );
+}
+
+
+void ZrApiServer::parseOrders( const std::string & body, std::vector< OrderBook::Order * > & orders )
+{
+    std::vector< std::string > lines;
+    split( body, '\n', lines );
+    if( lines.empty() ) throw std::runtime_error( "No orders" );
+
+    try{
+        for( std::vector< std::string >::const_iterator it = lines.begin(); it != lines.end(); it++ ){
+            std::vector< std::string > fields;
+            split( *it, '\t', fields );
+            if( fields.size() < 4 || fields.size() > 5 || ( fields[ 0 ] != "B" && fields[ 0 ] != "A" ) )
+                throw std::runtime_error( "Bad order: " + *it );
+
+            OrderBook::Order::Execution execution = OrderBook::Order::LIMIT;
+            if( fields.size() == 5 ){
+                if( fields[ 4 ] == "I" ) execution = OrderBook::Order::IOC;
+                else if( fields[ 4 ] == "M" ) execution = OrderBook::Order::MARKET;
+                else if( fields[ 4 ] != "L" ) throw std::runtime_error( "Bad execution: " + *it );
+            }
+            if( execution != OrderBook::Order::LIMIT && lines.size() > 1 )
+                throw std::runtime_error( "Immediate and market orders go one per request" );
+            if( execution != OrderBook::Order::LIMIT && fields[ 0 ] != "B" )
+                throw std::runtime_error( "Only buy orders can be immediate or market orders" );
+
+            Currency::CurrencySymbols currency = Currency::getCurrencyBySymbol( fields[ 1 ] );
+            if( currency == Currency::INVALID ) throw std::runtime_error( "Bad currency: " + fields[ 1 ] );
+
+            ZR::ZR_Number price;
+            ZR::ZR_Number amount;
+            if( !parseNumber( fields[ 3 ], amount ) ) throw std::runtime_error( "Bad amount: " + *it );
+            if( !parseNumber( fields[ 2 ], price ) && execution != OrderBook::Order::MARKET ) throw std::runtime_error( "Bad price: " + *it );
+
+            OrderBook::Order * order = new OrderBook::Order( true );
+            orders.push_back( order );
+            order->m_orderType = ( fields[ 0 ] == "A" )? OrderBook::Order::ASK : OrderBook::Order::BID;
+            order->m_currency = currency;
+            order->m_price = price;
+            order->m_amount = amount;
+            order->m_execution = execution;
+            order->m_purpose = OrderBook::Order::NEW;
+            order->m_timeStamp = QDateTime::currentMSecsSinceEpoch();
+            order->setOrderId();
+        }
+
+        // the order addresses come last, when there is nothing left to go wrong in the request
+        for( std::vector< OrderBook::Order * >::iterator it = orders.begin(); it != orders.end(); it++ ){
+            OrderBook::Order * order = *it;
+            if( order->m_orderType != OrderBook::Order::ASK ) continue;
+            order->m_btcAddr = ZR::Bitcoin::Instance()->mkOrderAddress( order->m_amount );
+            if( order->m_btcAddr.empty() ) throw std::runtime_error( "Cannot make an order address" );
+        }
+    }
+    catch( std::runtime_error & ){
+        for( std::vector< OrderBook::Order * >::iterator it = orders.begin(); it != orders.end(); it++ ) delete *it;
+        orders.clear();
+        throw;
+    }
+}
+
+
+std::string ZrApiServer::place( std::vector< OrderBook::Order * > & orders )
+{
+    std::string ids;
+    for( std::vector< OrderBook::Order * >::const_iterator it = orders.begin(); it != orders.end(); it++ ){
+        if( !ids.empty() ) ids += '\n';
+        ids += (*it)->m_order_id;
+    }
+
+    // the books own the orders from here, placed or not
+    std::vector< OrderBook::Order * > placed;
+    placed.swap( orders );
+    MyOrders * myOrders = MyOrders::Instance();
+    if( placed.front()->m_execution != OrderBook::Order::LIMIT ){
+        // matched in the next run of the service jobs, gone after that if nothing crosses it
+        if( myOrders->getBids()->processMyOrder( placed.front() ) == ZR::ZR_FAILURE )
+            throw std::runtime_error( "Order not placed" );
+        return ids;
+    }
+    if( myOrders->placeOrders( placed ) == ZR::ZR_FAILURE ){
+        for( std::vector< OrderBook::Order * >::iterator it = placed.begin(); it != placed.end(); it++ ) delete *it;
+        throw std::runtime_error( "Orders not placed" );
+    }
+    return ids;
+}
+
+
+std::string ZrApiServer::cancel( const std::string & body )
+{
+    std::vector< std::string > ids;
+    split( body, '\n', ids );
+    if( ids.empty() ) throw std::runtime_error( "No orders" );
+    if( MyOrders::Instance()->cancelOrders( ids ) == ZR::ZR_FAILURE )
+        throw std::runtime_error( "Orders not cancelled" );
+    return std::string();
+}
+
+
+std::string ZrApiServer::amend( const std::string & body )
+{
+    std::vector< std::string > fields;
+    split( body, '\t', fields );
+    ZR::ZR_Number price;
+    ZR::ZR_Number amount;
+    if( fields.size() != 3 || !parseNumber( fields[ 1 ], price ) || !parseNumber( fields[ 2 ], amount ) )
+        throw std::runtime_error( "Bad amendment: " + body );
+
+    OrderBook::Order::ID newId;
+    if( MyOrders::Instance()->amendOrder( fields[ 0 ], price, amount, &newId ) == ZR::ZR_FAILURE )
+        throw std::runtime_error( "Order not amended" );
+    return newId;
+}
+
+
+std::string ZrApiServer::snapshot( const std::string & body )
+{
+    std::string result;
+    OrderBook * books[] = { MyOrders::Instance()->getBids(), MyOrders::Instance()->getAsks() };
+    for( int i = 0; i < 2; i++ ){
+        RsStackMutex orderMutex( books[ i ]->m_order_mutex );
+        for( OrderBook::OrderIterator it = books[ i ]->begin(); it != books[ i ]->end(); it++ ){
+            const OrderBook::Order * order = *it;
+            if( order->m_ignored ) continue;
+            if( !body.empty() && body != Currency::currencySymbols[ order->m_currency ] ) continue;
+            if( !result.empty() ) result += '\n';
+            result += describe( order );
+        }
+    }
+    return result;
+}
+
+
+void ZrApiServer::watch( const Request & request )
+{
+    std::vector< std::string > currencies;
+    split( request.m_body, '\n', currencies );
+
+    RsStackMutex mutex( m_mutex );
+    Clients::iterator it = m_clients.find( request.m_fd );
+    if( it == m_clients.end() || (*it).second.m_serial != request.m_serial ) return;
+    Client & client = (*it).second;
+    if( !client.m_watching ) m_watchers++;
+    client.m_watching = true;
+    client.m_currencies = std::set< std::string >( currencies.begin(), currencies.end() );
+}
@@ -0,0 +1,197 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ZRAPISERVER_H
+#define ZRAPISERVER_H
+
+#include "zrtypes.h"
+#include "OrderBook.h"
+#include "ZrScheduler.h"
+
+#include "util/rsthreads.h"
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <map>
+#include <set>
+#include <list>
+#include <vector>
+#include <string>
+
+/**
+ * @brief Local trading API on a Unix socket, for bots
+ *
+ * Set API_SOCKET to turn it on. One thread serves all clients through epoll, the core only
+ * appends to the output buffers of the clients and wakes that thread up. A client which does
+ * not read its feed is dropped when MAX_BACKLOG piles up, so it cannot slow the core down.
+ *
+ * The epoll thread only parses frames. A worker makes the order addresses, which waits for
+ * bitcoind, and hands each request on to the service thread, which owns the books. It replies
+ * from there, so the replies keep the order of the requests.
+ *
+ * Every frame is a 4 byte big endian length, followed by an opcode byte and the body. Bodies
+ * are lines of tab separated fields, numbers go as fractions (1/3) or decimals (0.5) in and as
+ * fractions out. Requests get an OK or a FAILED frame, in order.
+ *
+ *  PLACE    B|A currency price amount [L|I|M]  one order per line, IOC and market orders one per frame
+ *                                             OK: the order IDs. IOC and market orders are matched
+ *                                             after that, FILL and the R delta tell how it went
+ *  CANCEL   order IDs, one per line
+ *  AMEND    order ID, price, amount            OK: the ID of the amended order
+ *  SNAPSHOT currency, empty for all            OK: B|A currency ID price amount mine, one per line
+ *  WATCH    currencies, one per line, empty for all. Starts the feed:
+ *  DELTA    N|R B|A currency ID price amount mine - an order came into the book or left it
+ *  FILL     B|A currency ID price amount remaining - one of my orders was filled
+ */
+
+class ZrApiServer : public RsThread, public OrderBook::Listener
+{
+    ZrApiServer();
+    ZrApiServer( const ZrApiServer & );
+public:
+    enum Opcode {
+        PLACE = 'P',
+        CANCEL = 'C',
+        AMEND = 'A',
+        SNAPSHOT = 'S',
+        WATCH = 'W',
+        OK = 'K',
+        FAILED = 'E',
+        DELTA = 'D',
+        FILL = 'F'
+    };
+
+    static ZrApiServer * Instance();
+
+    /** open the socket and start serving, once. Nothing happens while path is empty */
+    void listen( const std::string & path );
+    /** drop the clients and end the threads. Requests already with the service thread are not answered */
+    void stop();
+
+    virtual void run();
+
+    virtual void orderChanged( OrderBook * book, const OrderBook::Order * order, bool removed );
+    virtual void orderFilled( const OrderBook::Order * order, const ZR::ZR_Number & amount );
+
+    static const unsigned int MAX_FRAME;     // bytes of a request
+    static const unsigned int MAX_BACKLOG;   // bytes queued for a client before it is dropped
+    static const unsigned int MAX_PENDING;   // requests of a client not answered yet before it is dropped
+
+private:
+    class Client
+    {
+    public:
+        Client() : m_serial( 0 ), m_pending( 0 ), m_watching( false ), m_writing( false ), m_dead( false ) {}
+        unsigned long m_serial;                 // the fd is reused by later clients, this is not
+        unsigned int m_pending;                 // requests not answered yet
+        std::string m_in;                       // never more than a frame and a read
+        std::string m_out;
+        bool m_watching;
+        std::set< std::string > m_currencies;   // watched, empty for all
+        bool m_writing;                         // waiting for EPOLLOUT
+        bool m_dead;
+    };
+    typedef std::map< int, Client > Clients;
+
+    class Request
+    {
+    public:
+        Request() : m_fd( -1 ), m_serial( 0 ), m_op( 0 ) {}
+        int m_fd;
+        unsigned long m_serial;                       // of the client
+        char m_op;
+        std::string m_body;
+        std::vector< OrderBook::Order * > m_orders;   // PLACE: parsed by the worker, asks with their address
+        std::string m_error;                          // PLACE: why the worker could not parse it
+    };
+    typedef std::list< Request > Requests;
+
+    /** takes the requests off the epoll thread, see prepare() */
+    class Worker : public RsThread
+    {
+    public:
+        Worker( ZrApiServer * server ) : m_server( server ) {}
+        virtual void run();
+    private:
+        ZrApiServer * m_server;
+    };
+    friend class Worker;
+
+    /** the part of a request which touches the books, on the service thread */
+    class Execution : public ZrScheduler::Task
+    {
+    public:
+        Execution( ZrApiServer * server, const Request & request ) : m_server( server ), m_request( request ) {}
+        virtual ~Execution();
+        virtual void run();
+    private:
+        ZrApiServer * m_server;
+        Request m_request;
+    };
+    friend class Execution;
+
+    void acceptClients();
+    void readClient( int fd );
+    /** move the complete frames of the client to requests. @return false if the stream is out of step */
+    bool takeFrames( int fd, Client & client, Requests & requests );
+    void flushClients();
+    void closeClient( int fd );
+    void wake();
+
+    /** worker: parse orders and make their addresses, then post the request to the service thread */
+    void prepare( Request & request );
+    /** service thread: run the request and reply */
+    void handleRequest( Request & request );
+    /** @throw std::runtime_error if the orders are bad, orders is empty then */
+    static void parseOrders( const std::string & body, std::vector< OrderBook::Order * > & orders );
+    /** takes ownership of the orders */
+    std::string place( std::vector< OrderBook::Order * > & orders );
+    std::string cancel( const std::string & body );
+    std::string amend( const std::string & body );
+    std::string snapshot( const std::string & body );
+    void watch( const Request & request );
+
+    /** queue a frame for one client, m_mutex held */
+    void queue( Client & client, char op, const std::string & body );
+    /** answer a request, if its client is still there */
+    void reply( const Request & request, char op, const std::string & body );
+    void broadcast( const std::string & currency, char op, const std::string & body );
+
+    static std::string describe( const OrderBook::Order * order );
+    static bool parseNumber( const std::string & field, ZR::ZR_Number & number );
+
+    Clients m_clients;
+    unsigned long m_serials;
+    unsigned int m_watchers;
+    int m_listenFd;
+    int m_epollFd;
+    int m_wakeFd;
+    bool m_started;
+    bool m_stopped;             // under m_request_mutex, read by the epoll thread when woken
+    RsMutex m_mutex;
+
+    Worker m_worker;
+    Requests m_requests;        // for the worker
+    QMutex m_request_mutex;
+    QWaitCondition m_requested;
+
+    static ZrApiServer * instance;
+    static RsMutex creation_mutex;
+};
+
+#endif // ZRAPISERVER_H
@@ -0,0 +1,202 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ZrConfig.h"
+#include "zrdb.h"
+
+#include <iostream>
+#include <stdlib.h>
+
+
+ZrConfig * ZrConfig::instance = 0;
+RsMutex ZrConfig::creation_mutex( "config_creation_mutex" );
+
+
+ZrConfig * ZrConfig::Instance()
+{
+    RsStackMutex creationMutex( creation_mutex );
+    if( !ZrConfig::instance ){
+        ZrConfig::instance = new ZrConfig();
+    }
+    return ZrConfig::instance;
+}
+
+ZrConfig::ZrConfig() :
+    m_snapshot( 0 ),
+    m_mutex( "zrconfig_mutex" ),
+    m_listener_mutex( "zrconfig_listener_mutex" )
+{
+    m_registry[ ZrDB::TXLOGPATH ]      = std::make_pair( STRING, std::string() );
+    m_registry[ ZrDB::TXLOG_INDEX ]    = std::make_pair( INTEGER, std::string( "1" ) );
+    m_registry[ ZrDB::TXLOG_ARCHIVE ]  = std::make_pair( INTEGER, std::string( "1" ) );
+    m_registry[ ZrDB::MINIMUM_FEE ]    = std::make_pair( NUMBER, std::string( "0/1" ) );
+    m_registry[ ZrDB::PERCENTAGE_FEE ] = std::make_pair( NUMBER, std::string( "0/1" ) );
+    m_registry[ ZrDB::ROUTING_TABLE_SIZE ] = std::make_pair( INTEGER, std::string( "65536" ) );
+    m_registry[ ZrDB::GOSSIP_COALESCE_MS ] = std::make_pair( INTEGER, std::string( "500" ) );
+    m_registry[ ZrDB::MAX_ORDER_HOPS ]   = std::make_pair( INTEGER, std::string( "8" ) );
+    m_registry[ ZrDB::ORDER_BAND ]       = std::make_pair( NUMBER, std::string( "0/1" ) );
+    m_registry[ ZrDB::ORDER_TOP_LEVELS ] = std::make_pair( INTEGER, std::string( "100" ) );
+    m_registry[ ZrDB::MAX_ORDERS ]       = std::make_pair( INTEGER, std::string( "20000" ) );
+    m_registry[ ZrDB::MAX_ORDERS_PER_GATEWAY ]  = std::make_pair( INTEGER, std::string( "2000" ) );
+    m_registry[ ZrDB::MAX_ORDERS_PER_CURRENCY ] = std::make_pair( INTEGER, std::string( "10000" ) );
+    m_registry[ ZrDB::ORDER_AGGREGATION ] = std::make_pair( INTEGER, std::string( "0" ) );
+    m_registry[ ZrDB::SCHEDULER_WORKERS ] = std::make_pair( INTEGER, std::string( "2" ) );
+    m_registry[ ZrDB::API_SOCKET ]        = std::make_pair( STRING, std::string() );
+    m_registry[ ZrDB::SHM_FEED ]          = std::make_pair( STRING, std::string() );
+    m_registry[ ZrDB::SHM_FEED_LEVELS ]   = std::make_pair( INTEGER, std::string( "10" ) );
+}
+
+void ZrConfig::registerKey( const std::string & key, Type type, const std::string & defaultValue )
+{
+    RsStackMutex mutex( m_mutex );
+    m_registry[ key ] = std::make_pair( type, defaultValue );
+
+    const Snapshot * current = loadSnapshot();
+    if( !current ) return;   // picked up by the initial load
+
+    Snapshot * next = new Snapshot( *current );
+    (*next)[ key ] = parse( key, ZrDB::Instance()->getConfig( key ) );
+    publish( next );
+}
+
+const ZrConfig::Snapshot * ZrConfig::snapshot()
+{
+    const Snapshot * current = loadSnapshot();
+    if( current ) return current;
+
+    RsStackMutex mutex( m_mutex );
+    current = loadSnapshot();
+    if( current ) return current;   // somebody else was faster
+
+    Snapshot * loaded = new Snapshot;
+    for( Registry::const_iterator it = m_registry.begin(); it != m_registry.end(); it++ ){
+        (*loaded)[ it->first ] = parse( it->first, ZrDB::Instance()->getConfig( it->first ) );
+    }
+    publish( loaded );
+    return loaded;
+}
+
+ZrConfig::Value ZrConfig::parse( const std::string & key, const std::string & value )
+{
+    Value parsed;
+    Registry::const_iterator reg = m_registry.find( key );
+    if( reg == m_registry.end() ){
+        parsed.m_string = value;
+        return parsed;
+    }
+    parsed.m_string = value.empty() ? reg->second.second : value;
+
+    try{
+        switch( reg->second.first ){
+        case NUMBER:
+            if( parsed.m_string.find( '/' ) != std::string::npos ){
+                parsed.m_number = ZR::ZR_Number::fromFractionString( parsed.m_string );
+            }
+            else {
+                parsed.m_number = ZR::ZR_Number::fromDecimalString( parsed.m_string );
+            }
+            break;
+        case INTEGER:
+            parsed.m_integer = atoll( parsed.m_string.c_str() );
+            break;
+        default:
+            break;
+        }
+    }
+    catch( std::exception & e ){
+        std::cerr << "Zero Reserve: Invalid config value " << key << " = " << value << " : " << e.what() << std::endl;
+    }
+    return parsed;
+}
+
+const ZrConfig::Snapshot * ZrConfig::loadSnapshot() const
+{
+#if QT_VERSION >= 0x050000
+    return m_snapshot.loadAcquire();
+#else
+    return m_snapshot;
+#endif
+}
+
+void ZrConfig::publish( Snapshot * snapshot )
+{
+    Snapshot * old = m_snapshot.fetchAndStoreOrdered( snapshot );
+    if( old ) m_retired.push_back( old );
+}
+
+const ZrConfig::Value & ZrConfig::get( const std::string & key )
+{
+    static const Value empty;
+    const Snapshot * current = snapshot();
+    Snapshot::const_iterator it = current->find( key );
+    if( it == current->end() ) return empty;
+    return it->second;
+}
+
+const std::string & ZrConfig::getString( const std::string & key )
+{
+    return get( key ).m_string;
+}
+
+const ZR::ZR_Number & ZrConfig::getNumber( const std::string & key )
+{
+    return get( key ).m_number;
+}
+
+qint64 ZrConfig::getInteger( const std::string & key )
+{
+    return get( key ).m_integer;
+}
+
+const std::string & ZrConfig::txLogPath()
+{
+    return getString( ZrDB::TXLOGPATH );
+}
+
+void ZrConfig::changed( const std::string & key, const std::string & value )
+{
+    {
+        RsStackMutex mutex( m_mutex );
+        const Snapshot * current = loadSnapshot();
+        if( current ){
+            Snapshot * next = new Snapshot( *current );
+            (*next)[ key ] = parse( key, value );
+            publish( next );
+        }
+    }
+
+    std::list< Listener * > listeners;
+    {
+        RsStackMutex listenerMutex( m_listener_mutex );
+        listeners = m_listeners;
+    }
+    for( std::list< Listener * >::const_iterator it = listeners.begin(); it != listeners.end(); it++ ){
+        (*it)->configChanged( key, value );
+    }
+}
+
+void ZrConfig::addListener( Listener * listener )
+{
+    RsStackMutex listenerMutex( m_listener_mutex );
+    m_listeners.push_back( listener );
+}
+
+void ZrConfig::removeListener( Listener * listener )
+{
+    RsStackMutex listenerMutex( m_listener_mutex );
+    m_listeners.remove( listener );
+}
@@ -0,0 +1,106 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ZRCONFIG_H
+#define ZRCONFIG_H
+
+#include "zrtypes.h"
+
+#include "util/rsthreads.h"
+
+#include <QAtomicPointer>
+
+#include <string>
+#include <map>
+#include <list>
+
+
+/**
+ * @brief Typed, cached view on the config table
+ *
+ * All registered keys are loaded from ZrDB once and kept parsed in an immutable snapshot.
+ * Reads only dereference the current snapshot and need no lock. ZrDB::updateConfig() publishes
+ * a new snapshot and notifies the listeners. Replaced snapshots are kept until shutdown, so
+ * references returned by the getters stay valid; config changes are rare.
+ */
+
+class ZrConfig
+{
+    ZrConfig();
+    ZrConfig( const ZrConfig & );
+public:
+    enum Type { STRING, NUMBER, INTEGER };
+
+    class Value
+    {
+    public:
+        Value() : m_integer( 0 ) {}
+        std::string m_string;
+        ZR::ZR_Number m_number;   // NUMBER: fraction or decimal string
+        qint64 m_integer;         // INTEGER
+    };
+
+    /** gets called after a config value changed, from the thread which changed it */
+    class Listener
+    {
+    public:
+        virtual ~Listener(){}
+        virtual void configChanged( const std::string & key, const std::string & value ) = 0;
+    };
+
+    static ZrConfig * Instance();
+
+    /** add a key to the cache. The default applies if the key is not in the DB */
+    void registerKey( const std::string & key, Type type, const std::string & defaultValue );
+
+    const std::string & getString( const std::string & key );
+    const ZR::ZR_Number & getNumber( const std::string & key );
+    qint64 getInteger( const std::string & key );
+
+    const std::string & txLogPath();
+
+    /** called by ZrDB::updateConfig() after the value was stored */
+    void changed( const std::string & key, const std::string & value );
+
+    void addListener( Listener * listener );
+    void removeListener( Listener * listener );
+
+private:
+    typedef std::map< std::string, Value > Snapshot;
+    typedef std::map< std::string, std::pair< Type, std::string > > Registry;
+
+    const Value & get( const std::string & key );
+    /** the current snapshot, loads it on first use */
+    const Snapshot * snapshot();
+    /** the current snapshot or NULL, no locking */
+    const Snapshot * loadSnapshot() const;
+    Value parse( const std::string & key, const std::string & value );
+    void publish( Snapshot * snapshot );
+
+    QAtomicPointer< Snapshot > m_snapshot;
+    std::list< Snapshot * > m_retired;
+    Registry m_registry;
+    RsMutex m_mutex;                      // writers only
+
+    std::list< Listener * > m_listeners;
+    RsMutex m_listener_mutex;
+
+    static ZrConfig * instance;
+    static RsMutex creation_mutex;
+};
+
+#endif // ZRCONFIG_H
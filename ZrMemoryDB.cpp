@@ -0,0 +1,349 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ZrMemoryDB.h"
+#include "BtcContract.h"
+
+#include <iostream>
+#include <stdexcept>
+
+
+ZrMemoryDB::ZrMemoryDB() :
+    m_mutex( "memorydb_mutex" ),
+    m_db_mutex( QMutex::Recursive ),
+    m_snapshot( NULL )
+{
+    // the same defaults as a fresh SQLite DB
+    m_config[ TXLOGPATH ] = "";
+    m_config[ DB_VERSION ] = "2";
+    m_config[ MINIMUM_FEE ] = "0/1";
+    m_config[ PERCENTAGE_FEE ] = "0/1";
+}
+
+
+////////////////////////// Peers //////////////////////////////////////
+
+void ZrMemoryDB::createPeerRecord( const Credit & peer_in )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    m_peers[ std::make_pair( peer_in.m_id, peer_in.m_currency ) ] = PeerRecord();
+}
+
+void ZrMemoryDB::deletePeerRecord( const std::string & uid, const Currency::CurrencySymbols & sym )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    PeerMap::iterator it = m_peers.lower_bound( std::make_pair( uid, std::string() ) );
+    while( it != m_peers.end() && it->first.first == uid ){
+        if( Currency::INVALID == sym || it->first.second == Currency::currencySymbols[ sym ] ){
+            m_peers.erase( it++ );
+        }
+        else {
+            it++;
+        }
+    }
+}
+
+void ZrMemoryDB::updatePeerCredit( const Credit & peer_in, const std::string & column, ZR::ZR_Number & value )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    PeerMap::iterator it = m_peers.find( std::make_pair( peer_in.m_id, peer_in.m_currency ) );
+    if( it == m_peers.end() ) return;   // like an update without matching row
+
+    PeerRecord & peer = it->second;
+    if( column == "credit" ) peer.credit = value;
+    else if( column == "our_credit" ) peer.our_credit = value;
+    else if( column == "balance" ) peer.balance = value;
+    else if( column == "allocation" ) peer.allocation = value;
+    else throw std::runtime_error( "Memory DB: No such column " + column );
+}
+
+void ZrMemoryDB::loadPeer( Credit & peer_out )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    PeerMap::const_iterator it = m_peers.find( std::make_pair( peer_out.m_id, peer_out.m_currency ) );
+    if( it == m_peers.end() ) return;
+
+    peer_out.m_credit = it->second.credit;
+    peer_out.m_our_credit = it->second.our_credit;
+    peer_out.m_balance = it->second.balance;
+    peer_out.m_allocated = it->second.allocation;
+}
+
+void ZrMemoryDB::loadPeer( const std::string & id, Credit::CreditList & peer_out )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    for( PeerMap::const_iterator it = m_peers.lower_bound( std::make_pair( id, std::string() ) ); it != m_peers.end() && it->first.first == id; it++ ){
+        Credit * credit = new Credit( id, it->first.second );
+        credit->m_credit = it->second.credit;
+        credit->m_our_credit = it->second.our_credit;
+        credit->m_balance = it->second.balance;
+        credit->m_allocated = it->second.allocation;
+        peer_out.push_back( credit );
+    }
+}
+
+bool ZrMemoryDB::peerExists( const Credit & peer_in )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    return m_peers.find( std::make_pair( peer_in.m_id, peer_in.m_currency ) ) != m_peers.end();
+}
+
+ZrDB::GrandTotal & ZrMemoryDB::loadGrandTotal( const std::string & currency )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    grandTotal.currency =  currency;
+    grandTotal.our_credit = 0;
+    grandTotal.credit = 0;
+    grandTotal.outstanding = 0;
+    grandTotal.debt = 0;
+    grandTotal.balance = 0;
+
+    for( PeerMap::const_iterator it = m_peers.begin(); it != m_peers.end(); it++ ){
+        if( it->first.second != currency ) continue;
+        const PeerRecord & peer = it->second;
+        grandTotal.our_credit += peer.our_credit;
+        grandTotal.credit     += peer.credit;
+        grandTotal.balance    += peer.balance;
+        if( peer.balance > 0 ){
+            grandTotal.outstanding += peer.balance;
+        }
+        else {
+            grandTotal.debt        -= peer.balance;
+        }
+    }
+    return grandTotal;
+}
+
+
+////////////////////////// Config //////////////////////////////////////
+
+std::string ZrMemoryDB::getConfig( const std::string & key )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    std::map< std::string, std::string >::const_iterator it = m_config.find( key );
+    return ( it == m_config.end() ) ? std::string() : it->second;
+}
+
+void ZrMemoryDB::storeConfig( const std::string & key, const std::string & value )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    m_config[ key ] = value;
+}
+
+
+////////////////////////// Orders //////////////////////////////////////
+
+void ZrMemoryDB::addOrder( OrderBook::Order * order )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    // only what the SQLite backend stores, the rest is runtime state
+    OrderBook::Order & stored = m_orders[ order->m_order_id ];
+    stored.m_order_id = order->m_order_id;
+    stored.m_orderType = order->m_orderType;
+    stored.m_amount = order->m_amount;
+    stored.m_price = order->m_price;
+    stored.m_currency = order->m_currency;
+    stored.m_timeStamp = order->m_timeStamp;
+    stored.m_purpose = order->m_purpose;
+    stored.m_isMyOrder = true;
+}
+
+void ZrMemoryDB::loadOrders( OrderBook::OrderList * orders_out )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    for( OrderMap::const_iterator it = m_orders.begin(); it != m_orders.end(); it++ ){
+        orders_out->push_back( new OrderBook::Order( it->second ) );
+    }
+}
+
+void ZrMemoryDB::updateOrder( OrderBook::Order * order )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    OrderMap::iterator it = m_orders.find( order->m_order_id );
+    if( it != m_orders.end() ) it->second.m_amount = order->m_amount;
+}
+
+void ZrMemoryDB::deleteOrder( OrderBook::Order * order )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    m_orders.erase( order->m_order_id );
+}
+
+
+////////////////////////// TX log //////////////////////////////////////
+
+void ZrMemoryDB::appendTx( const std::string & id, const std::string & currency, ZR::ZR_Number amount )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    TxLogItem item;
+    item.id = QString::fromStdString( id );
+    item.currency = QString::fromStdString( currency );
+    item.m_amount = amount;
+    item.timestamp = QDateTime::currentDateTime();
+    m_txLog.push_front( item );
+}
+
+void ZrMemoryDB::loadTxLog( std::list< TxLogItem > & txList )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    txList.insert( txList.end(), m_txLog.begin(), m_txLog.end() );
+}
+
+void ZrMemoryDB::loadTxRollups( std::list< TxRollup > & )
+{
+    // nothing lives long enough to be rolled up
+}
+
+
+////////////////////////// Transactions //////////////////////////////////////
+
+void ZrMemoryDB::beginTx()
+{
+    m_db_mutex.lock();   // until commitTx() or rollbackTx(), like ZrSqliteDB
+    RsStackMutex mutex( m_mutex );
+    if( m_snapshot ){
+        m_db_mutex.unlock();
+        throw std::runtime_error( "Memory DB: Cannot start a transaction within a transaction" );
+    }
+    m_snapshot = new Snapshot;
+    m_snapshot->m_peers = m_peers;
+    m_snapshot->m_orders = m_orders;
+    m_snapshot->m_contracts = m_contracts;
+}
+
+void ZrMemoryDB::commitTx()
+{
+    RsStackMutex mutex( m_mutex );
+    if( !m_snapshot ) throw std::runtime_error( "Memory DB: Cannot commit - no transaction is active" );
+    delete m_snapshot;
+    m_snapshot = NULL;
+    m_db_mutex.unlock();
+}
+
+void ZrMemoryDB::rollbackTx()
+{
+    RsStackMutex mutex( m_mutex );
+    if( !m_snapshot ) throw std::runtime_error( "Memory DB: Cannot rollback - no transaction is active" );
+    m_peers.swap( m_snapshot->m_peers );
+    m_orders.swap( m_snapshot->m_orders );
+    m_contracts.swap( m_snapshot->m_contracts );
+    delete m_snapshot;
+    m_snapshot = NULL;
+    m_db_mutex.unlock();
+}
+
+
+////////////////////////// Wallet //////////////////////////////////////
+
+ZR::RetVal ZrMemoryDB::storeMyWallet( const ZR::WalletSecret & secret, unsigned int type, const std::string & nick )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    MyWallet wallet;
+    wallet.secret = secret;
+    wallet.type = type;
+    wallet.nick = nick;
+    m_myWallets.push_back( wallet );
+    return ZR::ZR_SUCCESS;
+}
+
+ZR::RetVal ZrMemoryDB::addPeerWallet( const ZR::BitcoinAddress & address, const std::string & nick )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    m_peerWallets[ address ] = nick;
+    return ZR::ZR_SUCCESS;
+}
+
+void ZrMemoryDB::loadMyWallets( std::vector< MyWallet > & wallets )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    wallets.insert( wallets.end(), m_myWallets.begin(), m_myWallets.end() );
+}
+
+
+////////////////////////// Contracts //////////////////////////////////////
+
+void ZrMemoryDB::addBtcContract( BtcContract * contract )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    ContractRecord & record = m_contracts[ std::make_pair( contract->getBtcTxId(), (int)contract->getParty() ) ];
+    record.btcAmount = contract->getBtcAmount();
+    record.price = contract->getPrice();
+    record.currency = contract->getCurrencySym();
+    record.party = contract->getParty();
+    record.counterParty = contract->getCounterParty();
+    record.destAddress = contract->getDestAddress();
+    record.creationTime = contract->getCreationTime();
+    record.fee = contract->getFee();
+}
+
+void ZrMemoryDB::rmBtcContract( const ZR::TransactionId & btcTxId, int party )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    m_contracts.erase( std::make_pair( btcTxId, party ) );
+}
+
+bool ZrMemoryDB::btcContractExists( const ZR::TransactionId & btcTxId, int party )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    return m_contracts.find( std::make_pair( btcTxId, party ) ) != m_contracts.end();
+}
+
+void ZrMemoryDB::loadBtcContracts()
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    for( ContractMap::const_iterator it = m_contracts.begin(); it != m_contracts.end(); it++ ){
+        const ContractRecord & record = it->second;
+        BtcContract * contract = new BtcContract( record.btcAmount, record.fee, record.price, record.currency,
+                                                  (BtcContract::Party)record.party, record.counterParty, record.creationTime );
+        contract->setBtcTxId( it->first.first );
+        contract->setBtcAddress( record.destAddress );
+        contract->activate();
+    }
+}
+
+
+////////////////////////// Shutdown //////////////////////////////////////
+
+void ZrMemoryDB::close()
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex mutex( m_mutex );
+    delete m_snapshot;
+    m_snapshot = NULL;
+}
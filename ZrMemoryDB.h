@@ -0,0 +1,130 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ZRMEMORYDB_H
+#define ZRMEMORYDB_H
+
+#include "zrdb.h"
+
+#include <QMutex>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <list>
+
+
+/**
+ * @brief Storage backend without any disk I/O
+ *
+ * Keeps everything in memory, nothing survives a restart. Meant for benchmarks and
+ * headless runs of the engine, install it with ZrDB::setInstance().
+ * A DB transaction snapshots the peers, orders and contracts so that rollbackTx()
+ * behaves like the SQLite backend.
+ */
+
+class ZrMemoryDB : public ZrDB
+{
+public:
+    ZrMemoryDB();
+
+    virtual void createPeerRecord( const Credit & peer_in );
+    virtual void deletePeerRecord( const std::string & uid, const Currency::CurrencySymbols & sym );
+    virtual void updatePeerCredit(const Credit & peer_in, const std::string & column, ZR::ZR_Number &value );
+    virtual void loadPeer( Credit & peer_out );
+    virtual void loadPeer( const std::string & id, Credit::CreditList & peer_out );
+    virtual bool peerExists( const Credit & peer_in );
+
+    virtual GrandTotal &loadGrandTotal( const std::string & currency );
+
+    virtual std::string getConfig( const std::string & key );
+
+    virtual void addOrder( OrderBook::Order * order );
+    virtual void loadOrders(OrderBook::OrderList *orders_out );
+    virtual void updateOrder( OrderBook::Order * order );
+    virtual void deleteOrder( OrderBook::Order * order );
+
+    virtual void close();
+
+    virtual void appendTx(const std::string & id, const std::string &currency, ZR::ZR_Number amount );
+    virtual void syncTxLog(){}
+    virtual void loadTxLog(std::list< TxLogItem > & txList );
+    virtual void loadTxRollups( std::list< TxRollup > & rollups );
+
+    virtual void beginTx();
+    virtual void commitTx();
+    virtual void rollbackTx();
+
+    virtual ZR::RetVal storeMyWallet( const ZR::WalletSecret &secret, unsigned int type, const std::string &nick );
+    virtual ZR::RetVal addPeerWallet( const ZR::BitcoinAddress & address, const std::string & nick );
+    virtual void loadMyWallets( std::vector< MyWallet > & wallets );
+
+    virtual void addBtcContract( BtcContract * contract );
+    virtual void rmBtcContract(const ZR::TransactionId & btcTxId , int party );
+    virtual bool btcContractExists( const ZR::TransactionId & btcTxId, int party );
+    virtual void loadBtcContracts();
+
+protected:
+    virtual void storeConfig( const std::string & key, const std::string & value );
+
+private:
+    typedef struct {
+        ZR::ZR_Number credit;
+        ZR::ZR_Number our_credit;
+        ZR::ZR_Number balance;
+        ZR::ZR_Number allocation;
+    } PeerRecord;
+
+    typedef struct {
+        ZR::ZR_Number btcAmount;
+        ZR::ZR_Number price;
+        std::string currency;
+        int party;
+        std::string counterParty;
+        std::string destAddress;
+        qint64 creationTime;
+        ZR::ZR_Number fee;
+    } ContractRecord;
+
+    typedef std::map< std::pair< std::string, std::string >, PeerRecord > PeerMap;          // id, currency
+    typedef std::map< OrderBook::Order::ID, OrderBook::Order > OrderMap;
+    typedef std::map< std::pair< ZR::TransactionId, int >, ContractRecord > ContractMap;   // btcTxId, party
+
+    class Snapshot
+    {
+    public:
+        PeerMap m_peers;
+        OrderMap m_orders;
+        ContractMap m_contracts;
+    };
+
+    RsMutex m_mutex;
+    QMutex m_db_mutex;                 // taken ahead of m_mutex, held through a DB transaction
+
+    PeerMap m_peers;
+    OrderMap m_orders;
+    ContractMap m_contracts;
+    std::map< std::string, std::string > m_config;
+    std::vector< MyWallet > m_myWallets;
+    std::map< ZR::BitcoinAddress, std::string > m_peerWallets;
+    std::list< TxLogItem > m_txLog;    // newest first
+    GrandTotal grandTotal;
+
+    Snapshot * m_snapshot;             // open DB transaction
+};
+
+#endif // ZRMEMORYDB_H
@@ -0,0 +1,206 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ZrScheduler.h"
+#include "ZrConfig.h"
+
+#include <QDateTime>
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+const char * const ZrScheduler::CONFIG_PREFIX = "SCHEDULE_";
+const unsigned int ZrScheduler::IDLE_SLEEP = 50;
+
+
+static qint64 randomJitter( qint64 jitter )
+{
+    return ( jitter > 0 )? rand() % ( jitter + 1 ) : 0;
+}
+
+
+ZrScheduler::ZrScheduler() :
+    m_stopped( false ),
+    m_mutex( "scheduler_mutex" )
+{
+}
+
+ZrScheduler::~ZrScheduler()
+{
+    stop();
+    for( std::vector< Job * >::iterator it = m_jobs.begin(); it != m_jobs.end(); it++ ){
+        delete (*it)->m_task;
+        delete *it;
+    }
+    for( std::list< Task * >::iterator it = m_posted.begin(); it != m_posted.end(); it++ ) delete *it;
+}
+
+void ZrScheduler::addJob( const std::string & name, Task * task, qint64 interval, qint64 jitter, qint64 deadline, Affinity affinity )
+{
+    Job * job = new Job;
+    job->m_configKey = CONFIG_PREFIX + name;
+    job->m_task = task;
+    job->m_interval = interval;
+    job->m_jitter = jitter;
+    job->m_deadline = deadline;
+    job->m_affinity = affinity;
+    job->m_next = QDateTime::currentMSecsSinceEpoch() + randomJitter( jitter );
+    job->m_running = false;
+    job->m_stats.name = name;
+    job->m_stats.interval = interval;
+
+    std::ostringstream defaultInterval;
+    defaultInterval << interval;
+    ZrConfig::Instance()->registerKey( job->m_configKey, ZrConfig::INTEGER, defaultInterval.str() );
+
+    RsStackMutex mutex( m_mutex );
+    m_jobs.push_back( job );
+}
+
+void ZrScheduler::start( unsigned int workers )
+{
+    RsStackMutex mutex( m_mutex );
+    if( !m_workers.empty() ) return;
+    if( workers == 0 ) workers = 1;   // else the POOL jobs never run
+
+    m_stopped = false;
+    for( unsigned int i = 0; i < workers; i++ ){
+        Worker * worker = new Worker( this );
+        m_workers.push_back( worker );
+        worker->start();
+    }
+}
+
+void ZrScheduler::stop()
+{
+    std::vector< Worker * > workers;
+    {
+        RsStackMutex mutex( m_mutex );
+        m_stopped = true;
+        workers.swap( m_workers );
+    }
+    for( std::vector< Worker * >::iterator it = workers.begin(); it != workers.end(); it++ ){
+        (*it)->join();
+        delete *it;
+    }
+}
+
+void ZrScheduler::post( Task * task )
+{
+    RsStackMutex mutex( m_mutex );
+    m_posted.push_back( task );
+}
+
+void ZrScheduler::runServiceJobs()
+{
+    std::list< Task * > posted;
+    {
+        RsStackMutex mutex( m_mutex );
+        posted.swap( m_posted );
+    }
+    for( std::list< Task * >::iterator it = posted.begin(); it != posted.end(); it++ ){
+        try{
+            (*it)->run();
+        }
+        catch( std::exception & e ){
+            std::cerr << "Zero Reserve: Posted task: Exception caught: " << e.what() << std::endl;
+        }
+        delete *it;
+    }
+
+    Job * job;
+    while( ( job = claim( SERVICE ) ) != NULL ){
+        execute( job );
+    }
+}
+
+ZrScheduler::Job * ZrScheduler::claim( Affinity affinity )
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    RsStackMutex mutex( m_mutex );
+    Job * due = NULL;
+    for( std::vector< Job * >::iterator it = m_jobs.begin(); it != m_jobs.end(); it++ ){
+        Job * job = *it;
+        if( job->m_affinity != affinity || job->m_running || job->m_next > now ) continue;
+        if( !due || job->m_next < due->m_next ) due = job;   // the most overdue first
+    }
+    if( due ) due->m_running = true;
+    return due;
+}
+
+qint64 ZrScheduler::interval( const Job * job )
+{
+    qint64 configured = ZrConfig::Instance()->getInteger( job->m_configKey );
+    return ( configured > 0 )? configured : job->m_interval;
+}
+
+void ZrScheduler::execute( Job * job )
+{
+    qint64 start = QDateTime::currentMSecsSinceEpoch();
+    try{
+        job->m_task->run();
+    }
+    catch( std::exception & e ){
+        std::cerr << "Zero Reserve: Job " << job->m_stats.name << ": Exception caught: " << e.what() << std::endl;
+    }
+    qint64 end = QDateTime::currentMSecsSinceEpoch();
+    qint64 took = end - start;
+    qint64 next = interval( job );
+
+    bool overrun = job->m_deadline > 0 && took > job->m_deadline;
+    {
+        RsStackMutex mutex( m_mutex );
+        JobStats & stats = job->m_stats;
+        stats.interval = next;
+        stats.runs++;
+        stats.lastTime = took;
+        stats.totalTime += took;
+        if( took > stats.maxTime ) stats.maxTime = took;
+        if( overrun ) stats.overruns++;
+        job->m_next = end + next + randomJitter( job->m_jitter );
+        job->m_running = false;
+    }
+    if( overrun ){
+        std::cerr << "Zero Reserve: Job " << job->m_stats.name << " took " << took << " ms, deadline is " << job->m_deadline << " ms" << std::endl;
+    }
+}
+
+void ZrScheduler::getStats( StatsList & stats )
+{
+    RsStackMutex mutex( m_mutex );
+    for( std::vector< Job * >::const_iterator it = m_jobs.begin(); it != m_jobs.end(); it++ ){
+        stats.push_back( (*it)->m_stats );
+    }
+}
+
+
+void ZrScheduler::Worker::run()
+{
+    while( !m_scheduler->m_stopped ){
+        Job * job = m_scheduler->claim( POOL );
+        if( job ){
+            m_scheduler->execute( job );
+        }
+        else {
+            usleep( IDLE_SLEEP * 1000 );
+        }
+    }
+}
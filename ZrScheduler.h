@@ -0,0 +1,151 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ZRSCHEDULER_H
+#define ZRSCHEDULER_H
+
+#include "zrtypes.h"
+
+#include "util/rsthreads.h"
+
+#include <list>
+#include <vector>
+#include <string>
+
+/**
+ * @brief Named periodic jobs on a small worker pool
+ *
+ * Each job has its own interval, a random jitter added to it, so jobs do not fire in lock step,
+ * and a deadline. Runs over the deadline are logged and counted. The interval can be changed at
+ * runtime through the config key SCHEDULE_<name>, in milliseconds.
+ *
+ * POOL jobs run on the worker threads. SERVICE jobs run from runServiceJobs() on the thread that
+ * calls it, for work on state that is only safe there, like the TX managers. Other threads hand
+ * such work over with post().
+ */
+
+class ZrScheduler
+{
+    ZrScheduler( const ZrScheduler & );
+public:
+    enum Affinity { SERVICE, POOL };
+
+    class Task
+    {
+    public:
+        virtual ~Task(){}
+        virtual void run() = 0;
+    };
+
+    template< class T >
+    class MethodTask : public Task
+    {
+    public:
+        MethodTask( T * object, void (T::*method)() ) : m_object( object ), m_method( method ) {}
+        virtual void run(){ (m_object->*m_method)(); }
+    private:
+        T * m_object;
+        void (T::*m_method)();
+    };
+
+    class FunctionTask : public Task
+    {
+    public:
+        FunctionTask( void (*function)() ) : m_function( function ) {}
+        virtual void run(){ m_function(); }
+    private:
+        void (*m_function)();
+    };
+
+    class JobStats
+    {
+    public:
+        JobStats() : interval( 0 ), runs( 0 ), lastTime( 0 ), totalTime( 0 ), maxTime( 0 ), overruns( 0 ) {}
+        std::string name;
+        qint64 interval;          // ms, as currently configured
+        unsigned long runs;
+        qint64 lastTime;          // ms the last run took
+        qint64 totalTime;
+        qint64 maxTime;
+        unsigned long overruns;   // runs over the deadline
+    };
+    typedef std::list< JobStats > StatsList;
+
+    ZrScheduler();
+    ~ZrScheduler();
+
+    /**
+     * @brief add a periodic job. Takes ownership of the task
+     * @param interval ms between the end of a run and the next, unless configured otherwise
+     * @param jitter up to this many ms are added to each interval
+     * @param deadline ms a run may take, 0 for no deadline
+     */
+    void addJob( const std::string & name, Task * task, qint64 interval, qint64 jitter, qint64 deadline, Affinity affinity = POOL );
+
+    /** start the worker threads, at least one. Does nothing if already started */
+    void start( unsigned int workers );
+    void stop();
+
+    /** run the task once, from the next runServiceJobs(). Takes ownership. Safe from any thread */
+    void post( Task * task );
+
+    /** run the posted tasks and the SERVICE jobs which are due */
+    void runServiceJobs();
+
+    void getStats( StatsList & stats );
+
+    static const char * const CONFIG_PREFIX;
+
+private:
+    class Job
+    {
+    public:
+        std::string m_configKey;
+        Task * m_task;
+        qint64 m_interval;
+        qint64 m_jitter;
+        qint64 m_deadline;
+        Affinity m_affinity;
+        qint64 m_next;
+        bool m_running;
+        JobStats m_stats;
+    };
+
+    class Worker : public RsThread
+    {
+    public:
+        Worker( ZrScheduler * scheduler ) : m_scheduler( scheduler ) {}
+        virtual void run();
+    private:
+        ZrScheduler * m_scheduler;
+    };
+
+    /** take a due job of that affinity, NULL if there is none */
+    Job * claim( Affinity affinity );
+    void execute( Job * job );
+    qint64 interval( const Job * job );
+
+    std::vector< Job * > m_jobs;
+    std::list< Task * > m_posted;
+    std::vector< Worker * > m_workers;
+    volatile bool m_stopped;
+    RsMutex m_mutex;
+
+    static const unsigned int IDLE_SLEEP;   // ms a worker sleeps when nothing is due
+};
+
+#endif // ZRSCHEDULER_H
@@ -0,0 +1,245 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ZrShmFeed.h"
+#include "MyOrders.h"
+#include "Currency.h"
+
+#include <QDateTime>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include <iostream>
+#include <string.h>
+
+
+ZrShmFeed * ZrShmFeed::instance = 0;
+RsMutex ZrShmFeed::creation_mutex( "shm_feed_creation_mutex" );
+
+static const uint64_t CACHE_LINE = 64;
+
+static void writeLevel( ZrShmFeed::Level & out, const std::pair< const ZR::ZR_Number, std::pair< ZR::ZR_Number, uint32_t > > & level )
+{
+    out.m_priceNum = level.first.numerator();
+    out.m_priceDen = level.first.denominator();
+    out.m_amountNum = level.second.first.numerator();
+    out.m_amountDen = level.second.first.denominator();
+    out.m_orders = level.second.second;
+}
+
+
+ZrShmFeed * ZrShmFeed::Instance()
+{
+    RsStackMutex creationMutex( creation_mutex );
+    if( !ZrShmFeed::instance ){
+        ZrShmFeed::instance = new ZrShmFeed();
+    }
+    return ZrShmFeed::instance;
+}
+
+ZrShmFeed::ZrShmFeed() :
+    m_segment( NULL ),
+    m_header( NULL ),
+    m_started( false ),
+    m_mutex( "shm_feed_mutex" )
+{
+}
+
+
+void ZrShmFeed::open( const std::string & name, unsigned int levels )
+{
+    if( m_started || name.empty() ) return;
+    m_started = true;
+
+#ifdef __linux__
+    if( levels == 0 ) levels = 1;
+    uint64_t blockSize = sizeof( Block ) + levels * sizeof( Level );
+    blockSize = ( blockSize + CACHE_LINE - 1 ) / CACHE_LINE * CACHE_LINE;
+    uint64_t firstBlock = ( sizeof( Header ) + CACHE_LINE - 1 ) / CACHE_LINE * CACHE_LINE;
+    uint32_t blocks = Currency::INVALID * 2;
+    size_t size = firstBlock + blocks * blockSize;
+
+    // readers still mapping the last run's segment keep a stale copy, they have to open it again by name
+    shm_unlink( name.c_str() );
+    int fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR );
+    if( fd < 0 || ftruncate( fd, size ) != 0 ){
+        std::cerr << "Zero Reserve: Cannot create the market data feed " << name << ": " << strerror( errno ) << std::endl;
+        if( fd >= 0 ) ::close( fd );
+        return;
+    }
+    void * segment = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if( segment == MAP_FAILED ){
+        std::cerr << "Zero Reserve: Cannot map the market data feed " << name << ": " << strerror( errno ) << std::endl;
+        return;
+    }
+
+    m_segment = static_cast< char * >( segment );
+    m_header = reinterpret_cast< Header * >( m_segment );
+    m_header->m_version = VERSION;
+    m_header->m_levels = levels;
+    m_header->m_blocks = blocks;
+    m_header->m_firstBlock = firstBlock;
+    m_header->m_blockSize = blockSize;
+    for( int currency = 0; currency < Currency::INVALID; currency++ ){
+        for( int side = BID; side <= ASK; side++ ){
+            Block * b = block( currency, (Side)side );
+            strncpy( b->m_currency, Currency::currencySymbols[ currency ], sizeof( b->m_currency ) - 1 );
+            b->m_side = side;
+        }
+    }
+    __sync_synchronize();
+    m_header->m_magic = MAGIC;   // readers may look now
+
+    // listen first, so no change slips in between the initial fill and the first notification.
+    // An order which is added twice that way replaces what it added the first time
+    OrderBook * books[] = { MyOrders::Instance()->getBids(), MyOrders::Instance()->getAsks() };
+    for( int side = BID; side <= ASK; side++ ){
+        books[ side ]->addListener( this );
+        RsStackMutex orderMutex( books[ side ]->m_order_mutex );
+        RsStackMutex mutex( m_mutex );
+        for( OrderBook::OrderIterator it = books[ side ]->begin(); it != books[ side ]->end(); it++ ){
+            add( *it );
+        }
+        for( int currency = 0; currency < Currency::INVALID; currency++ ){
+            publish( currency, (Side)side, 0, levels );
+        }
+    }
+    std::cerr << "Zero Reserve: Publishing " << levels << " price levels to " << name << std::endl;
+#else
+    std::cerr << "Zero Reserve: The market data feed is only available on Linux" << std::endl;
+#endif
+}
+
+
+ZrShmFeed::Block * ZrShmFeed::block( int currency, Side side )
+{
+    return reinterpret_cast< Block * >( m_segment + m_header->m_firstBlock + ( currency * 2 + side ) * m_header->m_blockSize );
+}
+
+
+void ZrShmFeed::orderChanged( OrderBook *, const OrderBook::Order * order, bool removed )
+{
+    if( !m_segment ) return;
+    RsStackMutex mutex( m_mutex );
+    if( removed ){
+        take( order->m_order_id );
+    }
+    else {
+        add( order );
+    }
+}
+
+
+void ZrShmFeed::orderFilled( const OrderBook::Order * order, const ZR::ZR_Number & )
+{
+    // the amount of my order went down in place, the only change that comes without orderChanged()
+    if( !m_segment ) return;
+    RsStackMutex mutex( m_mutex );
+    if( m_contributions.find( order->m_order_id ) == m_contributions.end() ) return;   // not in the books
+    add( order );
+}
+
+
+void ZrShmFeed::add( const OrderBook::Order * order )
+{
+    take( order->m_order_id );
+    if( order->m_currency >= Currency::INVALID || order->m_ignored ) return;
+
+    Contribution & contribution = m_contributions[ order->m_order_id ];
+    contribution.m_currency = order->m_currency;
+    contribution.m_side = ( order->m_orderType == OrderBook::Order::ASK )? ASK : BID;
+    contribution.m_price = order->m_price;
+    contribution.m_amount = order->m_amount;
+    apply( contribution, true );
+}
+
+
+void ZrShmFeed::take( const OrderBook::Order::ID & id )
+{
+    Contributions::iterator it = m_contributions.find( id );
+    if( it == m_contributions.end() ) return;
+    apply( (*it).second, false );
+    m_contributions.erase( it );
+}
+
+
+void ZrShmFeed::apply( const Contribution & contribution, bool add )
+{
+    PriceLevels & levels = m_levels[ contribution.m_currency ][ contribution.m_side ];
+    PriceLevels::iterator level = levels.find( contribution.m_price );
+    bool shifted = false;   // a level came or went, the ones below it move
+    if( level == levels.end() ){
+        level = levels.insert( std::make_pair( contribution.m_price, std::make_pair( ZR::ZR_Number( 0 ), (uint32_t)0 ) ) ).first;
+        shifted = true;
+    }
+    if( add ){
+        (*level).second.first += contribution.m_amount;
+        (*level).second.second++;
+    }
+    else {
+        (*level).second.first -= contribution.m_amount;
+        (*level).second.second--;
+    }
+
+    // where the level is in the block, nothing to write if it is below the top levels
+    uint32_t rank = 0;
+    if( contribution.m_side == BID ){
+        for( PriceLevels::reverse_iterator it = levels.rbegin(); (*it).first != contribution.m_price && rank < m_header->m_levels; it++ ) rank++;
+    }
+    else {
+        for( PriceLevels::iterator it = levels.begin(); (*it).first != contribution.m_price && rank < m_header->m_levels; it++ ) rank++;
+    }
+    if( (*level).second.second == 0 ){
+        levels.erase( level );
+        shifted = true;
+    }
+    if( rank >= m_header->m_levels ) return;
+    publish( contribution.m_currency, contribution.m_side, rank, ( shifted )? m_header->m_levels : rank + 1 );
+}
+
+
+void ZrShmFeed::publish( int currency, Side side, uint32_t from, uint32_t to )
+{
+    const PriceLevels & levels = m_levels[ currency ][ side ];
+    Block * b = block( currency, side );
+    Level * out = reinterpret_cast< Level * >( b + 1 );
+    uint32_t count = 0;
+
+    b->m_seq++;   // odd: readers back off
+    __sync_synchronize();
+    if( side == BID ){
+        for( PriceLevels::const_reverse_iterator it = levels.rbegin(); it != levels.rend() && count < m_header->m_levels; it++, count++ ){
+            if( count >= from && count < to ) writeLevel( out[ count ], *it );
+        }
+    }
+    else {
+        for( PriceLevels::const_iterator it = levels.begin(); it != levels.end() && count < m_header->m_levels; it++, count++ ){
+            if( count >= from && count < to ) writeLevel( out[ count ], *it );
+        }
+    }
+    b->m_count = count;
+    b->m_timeStamp = QDateTime::currentMSecsSinceEpoch();
+    __sync_synchronize();
+    b->m_seq++;
+}
@@ -0,0 +1,125 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ZRSHMFEED_H
+#define ZRSHMFEED_H
+
+#include "OrderBook.h"
+
+#include <stdint.h>
+#include <string>
+#include <map>
+
+/**
+ * @brief Market data feed in POSIX shared memory, for local analytics
+ *
+ * Set SHM_FEED to turn it on. The segment holds the top SHM_FEED_LEVELS price levels of both sides
+ * of the book for every currency. The books publish into it on each change, readers map it read only
+ * and poll it without syscalls. The price levels are kept up to date order by order, a change rewrites
+ * the level it touched, and the ones below it if a level came or went.
+ *
+ * Layout: a Header and Header::m_blocks blocks, one per currency and side at the offset
+ * m_firstBlock + ( currency * 2 + side ) * m_blockSize. Each is a Block followed by m_levels Level,
+ * best price first, and starts on a cache line of its own. Prices and amounts are exact fractions.
+ *
+ * Each block is a seqlock: read m_seq, skip if odd, copy the block, re-read m_seq and retry if it moved.
+ */
+
+class ZrShmFeed : public OrderBook::Listener
+{
+    ZrShmFeed();
+    ZrShmFeed( const ZrShmFeed & );
+public:
+    static const uint32_t MAGIC = 0x5a524246;   // ZRBF
+    static const uint32_t VERSION = 1;
+
+    enum Side { BID = 0, ASK = 1 };
+
+    struct Header
+    {
+        uint32_t m_magic;
+        uint32_t m_version;
+        uint32_t m_levels;
+        uint32_t m_blocks;
+        uint64_t m_firstBlock;
+        uint64_t m_blockSize;
+    };
+
+    struct Block
+    {
+        volatile uint64_t m_seq;
+        int64_t m_timeStamp;        // msecs since the epoch of the last change
+        char m_currency[ 8 ];
+        uint32_t m_side;
+        uint32_t m_count;           // valid levels
+    };
+
+    struct Level
+    {
+        int64_t m_priceNum;
+        int64_t m_priceDen;
+        int64_t m_amountNum;
+        int64_t m_amountDen;
+        uint32_t m_orders;
+        uint32_t m_pad;
+    };
+
+    static ZrShmFeed * Instance();
+
+    /** create the segment and start publishing, once. Nothing happens while name is empty */
+    void open( const std::string & name, unsigned int levels );
+
+    virtual void orderChanged( OrderBook * book, const OrderBook::Order * order, bool removed );
+    virtual void orderFilled( const OrderBook::Order * order, const ZR::ZR_Number & amount );
+
+private:
+    /** what an order added to its level, taken back as it was when the order leaves */
+    class Contribution
+    {
+    public:
+        int m_currency;
+        Side m_side;
+        ZR::ZR_Number m_price;
+        ZR::ZR_Number m_amount;
+    };
+    typedef std::map< OrderBook::Order::ID, Contribution > Contributions;
+    /** price -> amount and number of orders */
+    typedef std::map< ZR::ZR_Number, std::pair< ZR::ZR_Number, uint32_t > > PriceLevels;
+
+    /** add order to its level, or take back what it added. m_mutex held */
+    void add( const OrderBook::Order * order );
+    void take( const OrderBook::Order::ID & id );
+    /** change a level and rewrite it in the block if it is in the top levels. m_mutex held */
+    void apply( const Contribution & contribution, bool add );
+    /** rewrite the levels [from, to) of the block, best price is 0. m_mutex held */
+    void publish( int currency, Side side, uint32_t from, uint32_t to );
+
+    Block * block( int currency, Side side );
+
+    char * m_segment;
+    Header * m_header;
+    bool m_started;
+
+    PriceLevels m_levels[ Currency::INVALID ][ 2 ];
+    Contributions m_contributions;
+    RsMutex m_mutex;
+
+    static ZrShmFeed * instance;
+    static RsMutex creation_mutex;
+};
+
+#endif // ZRSHMFEED_H
@@ -0,0 +1,1113 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ZrSqliteDB.h"
+#include "ZeroReservePlugin.h"
+#include "BtcContract.h"
+#include "TxJournal.h"
+#include "TxLogArchiver.h"
+#include "ZrConfig.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+
+// increment this every time the DB layout changes
+// and provide an update program
+const static char* REQUIRED_DB_VERSION = "2";
+
+// the tx log is partitioned by month, the history view shows this many partitions
+static const int TXLOG_RECENT_MONTHS = 2;
+// the unpartitioned tx log of older versions
+static const char * const LEGACY_PARTITION = "legacy";
+
+static std::string txPartitionOf( const QDate & date )
+{
+    return date.toString( "yyyyMM" ).toStdString();
+}
+
+// zeroreserve.tx -> zeroreserve-201410.tx
+static std::string txPartitionPath( const std::string & base, const std::string & partition )
+{
+    if( partition == LEGACY_PARTITION ) return base;
+    QFileInfo info( QString::fromStdString( base ) );
+    QString name = info.completeBaseName() + "-" + QString::fromStdString( partition );
+    if( !info.suffix().isEmpty() ) name += "." + info.suffix();
+    return info.absoluteDir().filePath( name ).toStdString();
+}
+
+
+
+static int btccontracts_callback(void * , int argc, char ** argv, char ** )
+{
+    if( argc != 9 ) return SQLITE_ERROR;
+
+    ZR::ZR_Number btcAmount = ZR::ZR_Number::fromDecimalString( std::string( argv[ 1 ] ) );
+    ZR::ZR_Number price = ZR::ZR_Number::fromDecimalString( std::string( argv[ 2 ] ) );
+    std::string currencySym = argv[ 3 ];
+    BtcContract::Party party = (BtcContract::Party)atoi( argv[ 4 ] );
+    std::string counterParty = argv[ 5 ];
+    qint64 creationtime = atoll( argv[7] );
+    ZR::ZR_Number fee = ZR::ZR_Number::fromDecimalString( std::string( argv[ 8 ] ) );
+
+    BtcContract * contract = new BtcContract(btcAmount, fee, price, currencySym, party, counterParty, creationtime );
+    contract->setBtcTxId( argv[ 0 ] );
+    contract->setBtcAddress( argv[ 6 ] );
+    contract->activate();
+
+    return SQLITE_OK;
+}
+
+static int mywallets_callback(void * db, int argc, char ** argv, char ** )
+{
+    ZrSqliteDB * zrdb = static_cast< ZrSqliteDB * >( db );
+    if( argc == 3 ){
+        ZrDB::MyWallet wallet;
+        wallet.secret = argv[ 0 ];
+        wallet.type = atoi( argv[ 1 ] );
+        wallet.nick = argv[ 2 ];
+        zrdb->addMyWallet( wallet );
+    }
+    else {
+        return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+}
+
+static int orders_callback(void * db, int argc, char ** argv, char ** )
+{
+    ZrSqliteDB * zrdb = static_cast< ZrSqliteDB * >( db );
+    if( argc == 7 ){
+        OrderBook::Order * order = new OrderBook::Order( true );
+        order->m_order_id = argv[0];
+        order->m_orderType = OrderBook::Order::OrderType( atoi( argv[1] ) );
+        order->m_amount = ZR::ZR_Number::fromDecimalString( std::string( argv[2]) );
+        order->m_price = ZR::ZR_Number::fromDecimalString( std::string( argv[3]) );
+        order->m_currency = Currency::getCurrencyBySymbol( argv[4] );
+        order->m_timeStamp = atoll( argv[5] );
+        order->m_purpose = OrderBook::Order::Purpose( atoi( argv[6] ) );
+        order->m_isMyOrder = true;
+
+        zrdb->addToOrderList( order );
+    }
+    else {
+        return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+}
+
+static int txlog_callback(void * db, int argc, char ** argv, char ** )
+{
+    ZrSqliteDB * zrdb = static_cast< ZrSqliteDB * >( db );
+    if(argc == 4){
+        ZrDB::TxLogItem item;
+        item.id = argv[0];
+        item.currency = argv[1];
+        item.m_amount = ZR::ZR_Number::fromDecimalString( std::string(argv[2]) );
+        item.timestamp = QDateTime::fromString( argv[3], "yyyy-MM-dd HH:mm:ss" );
+
+        zrdb->addToTxList( item );
+    }
+    else {
+        return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+}
+
+
+static int txrollup_callback(void * db, int argc, char ** argv, char ** )
+{
+    ZrSqliteDB * zrdb = static_cast< ZrSqliteDB * >( db );
+    if(argc == 5){
+        ZrDB::TxRollup rollup;
+        rollup.partition = argv[0];
+        rollup.id = argv[1];
+        rollup.currency = argv[2];
+        // exact fractions, decimals in rollups written before they were
+        std::string amount( argv[3] ? argv[3] : "0" );
+        if( amount.find( '/' ) != std::string::npos ){
+            rollup.m_amount = ZR::ZR_Number::fromFractionString( amount );
+        }
+        else {
+            rollup.m_amount = ZR::ZR_Number::fromDecimalString( amount );
+        }
+        rollup.count = atoi( argv[4] );
+
+        zrdb->addToTxRollups( rollup );
+    }
+    else {
+        return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+}
+
+static int exists_callback(void * exists, int, char **, char **)
+{
+    *static_cast< bool * >( exists ) = true;
+    return SQLITE_OK;
+}
+
+
+static int store_peer_callback(void * db, int, char **, char **)
+{
+    ZrSqliteDB * zrdb = static_cast< ZrSqliteDB * >( db );
+    zrdb->peerRecordExists();
+    return SQLITE_OK;
+}
+
+static int peer_credit_callback(void * db, int argc, char ** argv, char ** )
+{
+    ZrSqliteDB * zrdb = static_cast< ZrSqliteDB * >( db );
+    if( argc == 4 ){
+        zrdb->setPeerCredit( argv[0], argv[1], argv[2], argv[3] );
+    }
+    else {
+        return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+}
+
+static int peer_credits_callback(void * db, int argc, char ** argv, char ** )
+{
+    ZrSqliteDB * zrdb = static_cast< ZrSqliteDB * >( db );
+    if(argc == 6){
+        Credit * credit = new Credit( argv[0], argv[1]);
+        credit->m_credit = ZR::ZR_Number::fromDecimalString( std::string( argv[2] ) );
+        credit->m_our_credit = ZR::ZR_Number::fromDecimalString( std::string( argv[3] ) );
+        credit->m_balance = ZR::ZR_Number::fromDecimalString( std::string( argv[4] ) );
+        credit->m_allocated = ZR::ZR_Number::fromDecimalString( std::string( argv[5] ) );
+        zrdb->addPeerCredit( credit );
+    }
+    else {
+        return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+}
+
+static int grandtotal_callback(void * db, int argc, char ** argv, char ** )
+{
+    if(argc != 3) return SQLITE_ERROR;
+    ZrSqliteDB * zrdb = static_cast< ZrSqliteDB * >( db );
+
+    zrdb->addToGrandTotal( argv );
+    return SQLITE_OK;
+}
+
+static int peer_config_callback(void * db, int argc, char ** argv, char ** )
+{
+    ZrSqliteDB * zrdb = static_cast< ZrSqliteDB * >( db );
+    if(argc == 1){
+        zrdb->setConfigValue( argv[0] );
+    }
+    else {
+        return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+}
+
+ZrSqliteDB::ZrSqliteDB( const std::string & pathname ) :
+        m_pathname( pathname ),
+        m_peer_mutex("peer_mutex"),
+        m_config_mutex("config_mutex"),
+        m_tx_mutex ( "tx_mutex" ),
+        m_db_mutex( QMutex::Recursive ),
+        m_txLog( NULL ),
+        m_txJournal( NULL ),
+        m_txPartitionsDue( false ),
+        m_archiver( NULL )
+{
+
+}
+
+void ZrSqliteDB::init()
+{
+    char *zErrMsg = 0;
+    int rc;
+    const std::string & pathname = m_pathname;
+    QDir zrdata ( QString::fromStdString(pathname) );
+
+    if( !zrdata.mkpath( QString::fromStdString( pathname ) ) ){
+        throw  std::runtime_error( std::string( "Error", "Cannot create DB at " ) + pathname );
+    }
+    std::string db_name = pathname + "/zeroreserve.db";
+    bool db_exists = QFile::exists(db_name.c_str() );
+
+    if( db_exists ){
+        std::cerr << "Opening DB " << db_name << std::endl;
+    }
+    else{
+        g_ZeroReservePlugin->placeMsg( std::string( "Creating DB: " ) + db_name );
+    }
+
+    rc = sqlite3_open( db_name.c_str(), &m_db);
+    if( rc ){
+        std::cerr <<  "Can't open database: " << sqlite3_errmsg(m_db) << std::endl;
+        sqlite3_close(m_db);
+        throw  std::runtime_error( std::string( "SQL Error: Cannot open database: " ) + db_name );
+    }
+
+    if( !db_exists ){
+        std::cerr << "Populating " << db_name << std::endl;
+        std::vector < std::string > tables;
+        tables.push_back( "create table if not exists peers ( id varchar(32), currency varchar(3), our_credit decimal(12,8), credit decimal(12,8), balance decimal(12,8), allocation decimal(12,8) )");
+        tables.push_back( "create table if not exists config ( key varchar(32), value varchar(160) )");
+        tables.push_back( "create table if not exists payments ( payee varchar(32), currency varchar(3), amount decimal(12,8) )");
+        tables.push_back( "create table if not exists myorders ( orderid varchar(32), ordertype int, amount decimal(12,8), price decimal(12,8), currency varchar(3), creationtime int, purpose int )");
+        tables.push_back( "create table if not exists mywallet ( secret varchar(64), type int, nick varchar(64) )");
+        tables.push_back( "create table if not exists peerwallet ( address varchar(34), nick varchar(64) )");
+        tables.push_back( "create table if not exists btccontracts ( btcTxId varchar(64), btcAmount decimal(12,8), price decimal(12,8), currency varchar(3), party int, counterparty varchar(32), destAddress varchar(36), creationtime int, fee decimal(12,8) )");
+        tables.push_back( "create unique index if not exists id_curr on peers ( id, currency)");
+        tables.push_back( "create unique index if not exists config_key on config ( key )");
+        tables.push_back( "create unique index if not exists myorders_id on myorders ( orderid )");
+        tables.push_back( "create unique index if not exists btccontracts_id on btccontracts ( btcTxId, party )");
+        tables.push_back( "create table if not exists txrollups ( period varchar(8), uid varchar(32), currency varchar(3), amount decimal(12,8), txcount int )");
+        tables.push_back( "create unique index if not exists txrollups_key on txrollups ( period, uid, currency )");
+        for(std::vector < std::string >::const_iterator it = tables.begin(); it != tables.end(); it++ ){
+            rc = sqlite3_exec(m_db, (*it).c_str(), NULL, NULL, &zErrMsg);
+            if( rc!=SQLITE_OK ){
+                std::cerr << "SQL error: " << zErrMsg << std::endl;
+                sqlite3_free(zErrMsg);
+                throw std::runtime_error("SQL Error: Cannot create table");
+            }
+        }
+        setConfig( TXLOGPATH, pathname + "/zeroreserve.tx" );
+        setConfig( DB_VERSION, REQUIRED_DB_VERSION );
+        setConfig( MINIMUM_FEE, "0/1" );
+        setConfig( PERCENTAGE_FEE, "0/1" );
+    }
+
+    openTxLog();
+
+    std::string dbversion = getConfig( "DB_VERSION" );
+    if( getConfig( "DB_VERSION" ) != REQUIRED_DB_VERSION ){
+        g_ZeroReservePlugin->placeMsg( std::string( "Updating Database version, required version is " ) + REQUIRED_DB_VERSION + " current version is " + dbversion );
+
+        // Append DB update functions as required below
+        if( dbversion == "a" ){
+            updateConfig( DB_VERSION, "0" );
+            dbversion = "0";
+        }
+        if( dbversion == "0" ){
+            // version "1": keyed lookups on config, myorders and btccontracts.
+            // Older versions could insert duplicate rows, keep the most recent one.
+            beginTx();
+            try{
+                runQuery( "delete from config where rowid not in ( select max( rowid ) from config group by key )" );
+                runQuery( "delete from myorders where rowid not in ( select max( rowid ) from myorders group by orderid )" );
+                runQuery( "delete from btccontracts where rowid not in ( select max( rowid ) from btccontracts group by btcTxId, party )" );
+                runQuery( "create unique index if not exists config_key on config ( key )" );
+                runQuery( "create unique index if not exists myorders_id on myorders ( orderid )" );
+                runQuery( "create unique index if not exists btccontracts_id on btccontracts ( btcTxId, party )" );
+                updateConfig( DB_VERSION, "1" );
+                commitTx();
+            }
+            catch( std::runtime_error & e ){
+                rollbackTx();
+                throw;
+            }
+            dbversion = "1";
+        }
+        if( dbversion == "1" ){
+            // version "2": per peer and currency sums of closed tx log partitions
+            beginTx();
+            try{
+                runQuery( "create table if not exists txrollups ( period varchar(8), uid varchar(32), currency varchar(3), amount decimal(12,8), txcount int )" );
+                runQuery( "create unique index if not exists txrollups_key on txrollups ( period, uid, currency )" );
+                updateConfig( DB_VERSION, "2" );
+                commitTx();
+            }
+            catch( std::runtime_error & e ){
+                rollbackTx();
+                throw;
+            }
+            dbversion = "2";
+        }
+        if( dbversion == "2" ){
+            // enter code for update to version "3"
+        }
+
+    }
+
+    {
+        // roll up and archive what was left over from the last run, once the service runs
+        RsStackMutex txMutex( m_tx_mutex );
+        m_txPartitionsDue = true;
+    }
+
+    // refresh the planner statistics where they are stale. Cheap if nothing changed.
+    runQuery( "PRAGMA optimize" );
+    checkQueryPlans();
+
+    ZrConfig::Instance()->addListener( this );
+}
+
+static int query_plan_callback(void * scans, int argc, char ** argv, char ** )
+{
+    // the last column holds the human readable plan, e.g. "SCAN TABLE myorders" for a full table scan
+    if( argc < 1 || argv[ argc - 1 ] == NULL ) return SQLITE_OK;
+    if( std::string( argv[ argc - 1 ] ).compare( 0, 4, "SCAN" ) == 0 ){
+        static_cast< std::vector< std::string > * >( scans )->push_back( argv[ argc - 1 ] );
+    }
+    return SQLITE_OK;
+}
+
+void ZrSqliteDB::checkQueryPlans()
+{
+    // statements which run on every order update, settlement or credit check
+    std::vector < std::string > hotPath;
+    hotPath.push_back( "select 1 from peers where id = '' and currency = '' limit 1" );
+    hotPath.push_back( "select credit, our_credit, balance, allocation from peers where id = '' and currency = ''" );
+    hotPath.push_back( "update peers set balance = 0 where id = '' and currency = ''" );
+    hotPath.push_back( "select value from config where key = ''" );
+    hotPath.push_back( "update myorders set amount = 0 where orderid = ''" );
+    hotPath.push_back( "delete from myorders where orderid = ''" );
+    hotPath.push_back( "delete from btccontracts where btcTxId = '' and party = 0" );
+
+    unsigned int regressions = 0;
+    for(std::vector < std::string >::const_iterator it = hotPath.begin(); it != hotPath.end(); it++ ){
+        std::vector< std::string > scans;
+        char *zErrMsg = 0;
+        int rc = sqlite3_exec( m_db, ( "explain query plan " + *it ).c_str(), query_plan_callback, &scans, &zErrMsg );
+        if( rc != SQLITE_OK ){
+            std::cerr << "SQL error: " << zErrMsg << " in: " << *it << std::endl;
+            sqlite3_free(zErrMsg);
+            regressions++;
+            continue;
+        }
+        for( std::vector< std::string >::const_iterator scanIt = scans.begin(); scanIt != scans.end(); scanIt++ ){
+            std::cerr << "Zero Reserve: Query plan regression: " << *scanIt << " in: " << *it << std::endl;
+            regressions++;
+        }
+    }
+    if( regressions == 0 ) return;
+    // the wording of the plans differs between SQLite versions, a release build still opens the wallet
+    std::cerr << "Zero Reserve: WARNING: " << regressions << " hot path queries fall back to full table scans, missing index?" << std::endl;
+    g_ZeroReservePlugin->placeMsg( "Database queries fall back to full table scans. Zero Reserve may be slow, see the log" );
+#ifndef QT_NO_DEBUG
+    throw std::runtime_error( "SQL Error: Hot path queries fall back to full table scans, missing index?" );
+#endif
+}
+
+void ZrSqliteDB::setConfig( const std::string & key, const std::string & value )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex configMutex( m_config_mutex );
+    std::string insert =  "insert into config values( '";
+    insert += key + "', '" + value + "' )";
+    runQuery( insert );
+}
+
+void ZrSqliteDB::storeConfig( const std::string & key, const std::string & value )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex configMutex( m_config_mutex );
+    // keys added after the DB was created have no row yet
+    std::string update =  "insert or replace into config ( key, value ) values( '";
+    update += key + "', '" + value + "' )";
+    runQuery( update );
+}
+
+std::string ZrSqliteDB::getConfig( const std::string & key )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    char *zErrMsg = 0;
+    RsStackMutex configMutex( m_config_mutex );
+    m_config_value.clear();
+    std::string select = "select value from config where key = '";
+    select += key + "'";
+    int rc = sqlite3_exec(m_db, select.c_str(), peer_config_callback, this, &zErrMsg);
+    if( rc!=SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( std::string( "SQL Error: Cannot get value " ) + key );
+    }
+    return m_config_value;
+}
+
+
+
+// the connection is shared - other threads wait until the transaction is over, else their
+// statements would become part of it
+void ZrSqliteDB::beginTx()
+{
+    m_db_mutex.lock();
+    try{
+        runQuery( "BEGIN TRANSACTION");
+    }
+    catch( std::runtime_error & e ){
+        m_db_mutex.unlock();
+        throw;
+    }
+}
+
+// a failed COMMIT leaves the transaction open, the caller rolls it back
+void ZrSqliteDB::commitTx()
+{
+    runQuery( "COMMIT");
+    m_db_mutex.unlock();
+}
+
+void ZrSqliteDB::rollbackTx()
+{
+    try{
+        runQuery( "ROLLBACK");
+    }
+    catch( std::runtime_error & e ){
+        m_db_mutex.unlock();
+        throw;
+    }
+    m_db_mutex.unlock();
+}
+
+ZrDB::GrandTotal & ZrSqliteDB::loadGrandTotal( const std::string & currency )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    char *zErrMsg = 0;
+    RsStackMutex peerMutex( m_peer_mutex );
+    grandTotal.currency =  currency;
+    grandTotal.our_credit = 0;
+    grandTotal.credit = 0;
+    grandTotal.outstanding = 0;
+    grandTotal.debt = 0;
+    grandTotal.balance = 0;
+
+    std::ostringstream select;
+    select << "select our_credit, credit, balance from peers where currency = '" << currency << "'";
+    int rc = sqlite3_exec(m_db, select.str().c_str(), grandtotal_callback, this, &zErrMsg);
+    if( rc!=SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot store peer data" );
+    }
+    return grandTotal;
+}
+
+void ZrSqliteDB::addToGrandTotal( char ** cols )
+{
+    grandTotal.our_credit += ZR::ZR_Number::fromDecimalString( std::string( cols[0] ) );
+    grandTotal.credit     += ZR::ZR_Number::fromDecimalString( std::string( cols[1] ) );
+    ZR::ZR_Number peerbalance = ZR::ZR_Number::fromDecimalString( std::string( cols[2] ) );
+    grandTotal.balance    += peerbalance;
+    if( peerbalance > 0 ){
+        grandTotal.outstanding += peerbalance;
+    }
+    else {
+        grandTotal.debt        -= peerbalance;
+    }
+}
+
+
+bool ZrSqliteDB::peerExists( const Credit & peer_in )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    char *zErrMsg = 0;
+    RsStackMutex peerMutex( m_peer_mutex );
+    m_peer_record_exists = false;
+    std::ostringstream select;
+    select << "select 1 from peers where id = '" << peer_in.m_id
+           << "' and currency = '" << peer_in.m_currency << "' limit 1";
+    int rc = sqlite3_exec(m_db, select.str().c_str(), store_peer_callback, this, &zErrMsg);
+    if( rc!=SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot store peer data" );
+    }
+    return m_peer_record_exists;
+}
+
+void ZrSqliteDB::updatePeerCredit( const Credit & peer_in, const std::string & column, ZR::ZR_Number & value )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex peerMutex( m_peer_mutex );
+    std::cerr << "Zero Reserve: Updating peer credit " << peer_in.m_id << std::endl; 
+    std::ostringstream update;
+    update << "update peers set " <<
+              column << " = " << value.toDouble() <<
+              " where id = '" << peer_in.m_id << "'" <<
+              " and currency = '" << peer_in.m_currency << "'";
+    runQuery( update.str() );
+}
+
+void ZrSqliteDB::runQuery( const std::string & sql )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    char *zErrMsg = 0;
+    int rc = sqlite3_exec(m_db, sql.c_str(), NULL, NULL, &zErrMsg);
+    if( rc != SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( std::string( "SQL Error: Cannot run query " ) + sql );
+    }
+}
+
+void ZrSqliteDB::createPeerRecord( const Credit & peer_in )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    std::cerr << "Zero Reserve: Updating peer credit " << peer_in.m_id << std::endl;
+    std::ostringstream insert;
+    insert << "insert into peers (id, currency, our_credit, credit, balance, allocation) values( '"
+           << peer_in.m_id << "', '" << peer_in.m_currency << "', 0, 0, 0, 0 )";
+
+    runQuery( insert.str() );
+}
+
+void ZrSqliteDB::deletePeerRecord( const std::string & uid, const Currency::CurrencySymbols & sym )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    std::cerr << "Zero Reserve: Deleting peer credit " << uid << std::endl;
+    RsStackMutex peerMutex( m_peer_mutex );
+    std::ostringstream sql;
+    sql << "delete from peers where id = '" << uid << "'";
+    if( Currency::INVALID != sym ){
+        sql << " and currency = '" << Currency::currencySymbols[ sym ] << "'";
+    }
+    runQuery( sql.str() );
+}
+
+
+
+void ZrSqliteDB::loadPeer( Credit & peer_out )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex peerMutex( m_peer_mutex );
+    m_credit = &peer_out;
+    char *zErrMsg = 0;
+    std::ostringstream select;
+    select << "select credit, our_credit, balance, allocation from peers where id = '"
+           << peer_out.m_id << "' and currency = '" << peer_out.m_currency << "'";
+    std::string selectstr = select.str();
+    int rc = sqlite3_exec(m_db, selectstr.c_str(), peer_credit_callback, this, &zErrMsg);
+    if( rc!=SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot load peer data" );
+    }
+}
+
+void ZrSqliteDB::loadPeer( const std::string & id, Credit::CreditList & peer_out )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex peerMutex( m_peer_mutex );
+    m_creditList = &peer_out;
+    char *zErrMsg = 0;
+    std::ostringstream select;
+    select << "select id, currency, credit, our_credit, balance, allocation from peers where id = '" << id << "'";
+    std::string selectstr = select.str();
+    int rc = sqlite3_exec(m_db, selectstr.c_str(), peer_credits_callback, this, &zErrMsg);
+    if( rc!=SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot load peer data" );
+    }
+}
+
+
+void ZrSqliteDB::setPeerCredit( const std::string & credit, const std::string & our_credit, const std::string & balance, const std::string & allocation )
+{
+    m_credit->m_credit = ZR::ZR_Number::fromDecimalString( credit );
+    m_credit->m_our_credit = ZR::ZR_Number::fromDecimalString( our_credit );
+    m_credit->m_balance = ZR::ZR_Number::fromDecimalString( balance );
+    m_credit->m_allocated = ZR::ZR_Number::fromDecimalString( allocation );
+}
+
+void ZrSqliteDB::addPeerCredit( Credit * credit )
+{
+    m_creditList->push_back( credit );
+}
+
+void ZrSqliteDB::openTxLog()
+{
+    char *zErrMsg = 0;
+    m_txPartition = txPartitionOf( QDate::currentDate() );
+    std::string txLog = txPartitionPath( getConfig( TXLOGPATH ), m_txPartition );
+    if( TxJournal::isJournal( txLog ) ){
+        m_txJournal = new TxJournal( txLog );
+        m_txJournal->open();
+        if( getConfig( TXLOG_INDEX ) == "0" ) return;
+        txLog = TxJournal::indexPath( txLog );
+    }
+    int rc = sqlite3_open( txLog.c_str(), &m_txLog );
+    if( rc ){
+        std::cerr <<  "Can't open transaction log: " << sqlite3_errmsg( m_txLog ) << std::endl;
+        sqlite3_close(m_txLog);
+        m_txLog = NULL;
+        throw  std::runtime_error("SQL Error: Cannot open database");
+    }
+    rc = sqlite3_exec(m_txLog, "create table if not exists txlog ( uid varchar(32), currency varchar(3), amount decimal(12,8), txtime datetime default current_timestamp )", NULL, NULL, &zErrMsg);
+    if( rc!=SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error("SQL Error: Cannot create table");
+    }
+}
+
+void ZrSqliteDB::syncTxLog()
+{
+    {
+        RsStackMutex txMutex( m_tx_mutex );
+        if( m_txJournal ) m_txJournal->syncPending();
+        if( !m_txPartitionsDue ) return;
+    }
+    // the connection is taken ahead of m_tx_mutex, like in appendTx()
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex txMutex( m_tx_mutex );
+    m_txPartitionsDue = false;   // after a failure, the next rotation or restart tries again
+    closeTxPartitions();
+}
+
+void ZrSqliteDB::appendTx(const std::string & id, const std::string & currency, ZR::ZR_Number amount )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    char *zErrMsg = 0;
+    std::cerr << "Zero Reserve: Appending to TX log " << id << ". " << amount << std::endl;
+    RsStackMutex txMutex( m_tx_mutex );
+    if( txPartitionOf( QDate::currentDate() ) != m_txPartition ){
+        rotateTxLog();
+    }
+    if( m_txJournal ){
+        // the journal is the record of truth, the SQLite log is only an index
+        m_txJournal->append( id, currency, amount );
+    }
+    if( !m_txLog ) return;
+
+    std::ostringstream insert;
+    insert << "insert into txlog ( uid, currency, amount ) values( '"
+           << id << "', '"
+           << currency << "', "
+           << amount.toDouble() << " )";
+    int rc = sqlite3_exec(m_txLog, insert.str().c_str(), NULL, NULL, &zErrMsg);
+    if( rc!=SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot append to TX log" );
+    }
+}
+
+void ZrSqliteDB::loadTxLog( std::list< TxLogItem > & txList )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex txMutex( m_tx_mutex );
+    // only the recent partitions, older ones are summarized in the rollups
+    std::string base = getConfig( TXLOGPATH );
+    QDate today = QDate::currentDate();
+    for( int month = 0; month < TXLOG_RECENT_MONTHS; month++ ){
+        std::string path = txPartitionPath( base, txPartitionOf( today.addMonths( -month ) ) );
+        if( QFile::exists( QString::fromStdString( path ) ) ){
+            readTxPartition( path, txList );
+        }
+    }
+}
+
+void ZrSqliteDB::readTxPartition( const std::string & path, std::list< TxLogItem > & txList )
+{
+    char *zErrMsg = 0;
+    if( TxJournal::isJournal( path ) ){
+        TxJournalReader reader( path );
+        if( !reader.refresh() ){
+            throw std::runtime_error( "Cannot map transaction journal " + path );
+        }
+        // newest first, like the SQLite log
+        for( uint64_t index = reader.size(); index > 0; index-- ){
+            TxJournal::Entry entry;
+            if( !reader.read( index - 1, entry ) ) continue;
+            TxLogItem item;
+            item.id = QString::fromStdString( entry.m_peerId );
+            item.currency = QString::fromStdString( entry.m_currency );
+            item.m_amount = entry.m_amount;
+            item.timestamp = QDateTime::fromMSecsSinceEpoch( entry.m_timeStamp );
+            txList.push_back( item );
+        }
+        return;
+    }
+
+    sqlite3 * txLog;
+    int rc = sqlite3_open_v2( path.c_str(), &txLog, SQLITE_OPEN_READONLY, NULL );
+    if( rc ){
+        std::cerr <<  "Can't open transaction log: " << sqlite3_errmsg( txLog ) << std::endl;
+        sqlite3_close( txLog );
+        throw  std::runtime_error( "SQL Error: Cannot open transaction log " + path );
+    }
+    m_txList = &txList;
+    rc = sqlite3_exec(txLog, "select uid,currency,amount,txtime from txlog order by txtime desc", txlog_callback, this, &zErrMsg);
+    sqlite3_close( txLog );
+    if( rc != SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot read TX log" );
+    }
+}
+
+void ZrSqliteDB::rotateTxLog()
+{
+    std::cerr << "Zero Reserve: Closing TX log partition " << m_txPartition << std::endl;
+    closeTxLogFiles();
+    openTxLog();
+    m_txPartitionsDue = true;
+}
+
+void ZrSqliteDB::closeTxPartitions()
+{
+    std::string base = getConfig( TXLOGPATH );
+    QFileInfo info( QString::fromStdString( base ) );
+    QString pattern = info.completeBaseName() + "-??????";
+    if( !info.suffix().isEmpty() ) pattern += "." + info.suffix();
+    QStringList names = info.absoluteDir().entryList( QStringList( pattern ), QDir::Files, QDir::Name );
+
+    std::list< std::string > closed;
+    if( QFile::exists( QString::fromStdString( base ) ) ){
+        closed.push_back( LEGACY_PARTITION );
+    }
+    for( QStringList::const_iterator it = names.begin(); it != names.end(); it++ ){
+        std::string partition = (*it).mid( info.completeBaseName().length() + 1, 6 ).toStdString();
+        if( partition < m_txPartition ) closed.push_back( partition );
+    }
+
+    bool compress = getConfig( TXLOG_ARCHIVE ) != "0";
+    std::string oldestRecent = txPartitionOf( QDate::currentDate().addMonths( 1 - TXLOG_RECENT_MONTHS ) );
+    // months are rolled up in order, empty ones leave no rollup behind to tell
+    std::string rolledUp = getConfig( TXLOG_ROLLED_UP );
+    std::list< std::string > archive;
+    for( std::list< std::string >::const_iterator it = closed.begin(); it != closed.end(); it++ ){
+        const std::string & partition = *it;
+        std::string path = txPartitionPath( base, partition );
+        if( partition == LEGACY_PARTITION ){
+            if( !txRollupExists( partition ) ) rollupTxPartition( path, partition );
+        }
+        else if( partition > rolledUp ){
+            if( !txRollupExists( partition ) ) rollupTxPartition( path, partition );
+            rolledUp = partition;
+            storeConfig( TXLOG_ROLLED_UP, rolledUp );
+        }
+        if( !compress ) continue;
+        if( partition == LEGACY_PARTITION || partition < oldestRecent ){
+            archive.push_back( path );
+            if( TxJournal::isJournal( path ) && QFile::exists( QString::fromStdString( TxJournal::indexPath( path ) ) ) ){
+                archive.push_back( TxJournal::indexPath( path ) );
+            }
+        }
+    }
+
+    if( archive.empty() ) return;
+    if( m_archiver ){
+        if( m_archiver->isRunning() ) return;  // the rest is picked up on the next rotation or restart
+        delete m_archiver;
+    }
+    m_archiver = new TxLogArchiver( archive );
+    m_archiver->start();
+}
+
+void ZrSqliteDB::rollupTxPartition( const std::string & path, const std::string & partition )
+{
+    std::cerr << "Zero Reserve: Writing rollup for TX log partition " << partition << std::endl;
+    std::list< TxLogItem > txList;
+    readTxPartition( path, txList );
+
+    typedef std::map< std::pair< std::string, std::string >, std::pair< ZR::ZR_Number, int > > RollupMap;
+    RollupMap rollup;
+    for( std::list< TxLogItem >::const_iterator it = txList.begin(); it != txList.end(); it++ ){
+        std::pair< ZR::ZR_Number, int > & sum = rollup[ std::make_pair( (*it).id.toStdString(), (*it).currency.toStdString() ) ];
+        sum.first += (*it).m_amount;
+        sum.second++;
+    }
+
+    beginTx();
+    try{
+        for( RollupMap::const_iterator it = rollup.begin(); it != rollup.end(); it++ ){
+            std::ostringstream insert;
+            insert << "insert or replace into txrollups ( period, uid, currency, amount, txcount ) values( '"
+                   << partition << "', '"
+                   << it->first.first << "', '"
+                   << it->first.second << "', '"
+                   << it->second.first.toStdString() << "', "   // a fraction, the totals must not round
+                   << it->second.second << " )";
+            runQuery( insert.str() );
+        }
+        commitTx();
+    }
+    catch( std::runtime_error & e ){
+        rollbackTx();
+        throw;
+    }
+}
+
+bool ZrSqliteDB::txRollupExists( const std::string & partition )
+{
+    char *zErrMsg = 0;
+    bool exists = false;
+    std::string select = "select 1 from txrollups where period = '" + partition + "' limit 1";
+    int rc = sqlite3_exec(m_db, select.c_str(), exists_callback, &exists, &zErrMsg);
+    if( rc != SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot read TX rollups" );
+    }
+    return exists;
+}
+
+void ZrSqliteDB::loadTxRollups( std::list< TxRollup > & rollups )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    char *zErrMsg = 0;
+    RsStackMutex txMutex( m_tx_mutex );
+    m_txRollups = &rollups;
+    int rc = sqlite3_exec(m_db, "select period, uid, currency, amount, txcount from txrollups order by period desc", txrollup_callback, this, &zErrMsg);
+    if( rc != SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot read TX rollups" );
+    }
+}
+
+void ZrSqliteDB::addToTxRollups( const TxRollup & rollup )
+{
+    m_txRollups->push_back( rollup );
+}
+
+void ZrSqliteDB::addToTxList( const TxLogItem & item )
+{
+    m_txList->push_back( item );
+}
+
+////////////////////////////////////////////////////////////////
+
+void ZrSqliteDB::addOrder( OrderBook::Order * order )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    std::ostringstream insert;
+    insert << "insert into myorders ( orderid, ordertype, amount, price, currency, creationtime, purpose ) values( '"
+           << order->m_order_id << "', "
+           << order->m_orderType << ", "
+           << order->m_amount.toDouble() << ", "
+           << order->m_price.toDouble() << ", '"
+           << Currency::currencySymbols[ order->m_currency ] << "', "
+           << order->m_timeStamp << ", "
+           << order->m_purpose << " )";
+
+    runQuery( insert.str() );
+}
+
+void ZrSqliteDB::loadOrders( OrderBook::OrderList * orders_out )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    char *zErrMsg = 0;
+    m_orderList = orders_out;
+    int rc = sqlite3_exec(m_db, "select orderid, ordertype, amount, price, currency, creationtime, purpose from myorders", orders_callback, this, &zErrMsg);
+    if( rc != SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot read Orders" );
+    }
+}
+
+void ZrSqliteDB::updateOrder( OrderBook::Order * order )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    std::cerr << "Zero Reserve: Updating my orders " << order->m_order_id << std::endl;
+    std::ostringstream update;
+    update << "update myorders set amount = " << order->m_amount
+           << " where orderid = '" << order->m_order_id << "'";
+
+    runQuery( update.str() );
+}
+
+void ZrSqliteDB::deleteOrder( OrderBook::Order * order )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    std::cerr << "Zero Reserve: Updating my orders " << order->m_order_id << std::endl;
+    std::ostringstream rmo;
+    rmo << "delete from  myorders where orderid = '" << order->m_order_id << "'";
+    runQuery( rmo.str() );
+}
+
+
+void ZrSqliteDB::addToOrderList( OrderBook::Order * order )
+{
+    m_orderList->push_back( order );
+}
+
+
+/////////////////////////// Wallet /////////////////////////////////////
+
+
+ZR::RetVal ZrSqliteDB::storeMyWallet( const ZR::WalletSecret & secret, unsigned int type, const std::string & nick )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    std::cerr << "Zero Reserve: Inserting my wallet " << std::endl;
+    std::ostringstream insert;
+    insert << "insert into mywallet ( secret, type, nick ) values( '"
+           << secret << "', '"
+           << type << "', '"
+           << nick << "' )";
+    runQuery( insert.str() );
+    return ZR::ZR_SUCCESS;
+}
+
+
+ZR::RetVal ZrSqliteDB::addPeerWallet( const ZR::BitcoinAddress & address, const std::string & nick )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    std::cerr << "Zero Reserve: Inserting peer wallet " << std::endl;
+    std::ostringstream insert;
+    insert << "insert into peerwallet ( address, nick ) values( '"
+           << address << "', '"
+           << nick << "' )";
+    runQuery( insert.str() );
+    return ZR::ZR_SUCCESS;
+}
+
+
+void ZrSqliteDB::loadMyWallets( std::vector< MyWallet > & wallets )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    char *zErrMsg = 0;
+    m_wallets = &wallets;
+    std::ostringstream select;
+    select << "select secret, type, nick from mywallet";
+    int rc = sqlite3_exec(m_db, select.str().c_str(), mywallets_callback, this, &zErrMsg);
+    if( rc!=SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot store peer data" );
+    }
+}
+
+
+void ZrSqliteDB::addMyWallet( MyWallet &wallet )
+{
+    m_wallets->push_back( wallet );
+}
+
+
+/////////////////////////// Contracts /////////////////////////////////////
+
+
+void ZrSqliteDB::addBtcContract( BtcContract * contract )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    std::cerr << "Zero Reserve: Inserting contract " << std::endl;
+    std::ostringstream insert;
+    insert << "insert into btccontracts values( '"
+           << contract->getBtcTxId() << "', "
+           << contract->getBtcAmount().toDecimalStdString() << ", "
+           << contract->getPrice().toDecimalStdString() << ", '"
+           << contract->getCurrencySym() << "', "
+           << (int)contract->getParty() << ", '"
+           << contract->getCounterParty() << "', '"
+           << contract->getDestAddress() << "', "
+           << contract->getCreationTime() << ", "
+           << contract->getFee().toDecimalStdString() << " )";
+
+    runQuery( insert.str() );
+}
+
+void ZrSqliteDB::rmBtcContract(const ZR::TransactionId & btcTxId, int party )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    std::cerr << "Zero Reserve: Deleting Contract " << btcTxId << std::endl;
+    std::ostringstream rmc;
+    rmc << "delete from  btccontracts where btcTxId = '" << btcTxId << "' and party = " << party;
+    runQuery( rmc.str() );
+}
+
+bool ZrSqliteDB::btcContractExists( const ZR::TransactionId & btcTxId, int party )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    char *zErrMsg = 0;
+    bool exists = false;
+    std::ostringstream select;
+    select << "select 1 from btccontracts where btcTxId = '" << btcTxId << "' and party = " << party << " limit 1";
+    int rc = sqlite3_exec(m_db, select.str().c_str(), exists_callback, &exists, &zErrMsg);
+    if( rc != SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot load contract data" );
+    }
+    return exists;
+}
+
+void ZrSqliteDB::loadBtcContracts()
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    char *zErrMsg = 0;
+    std::ostringstream select;
+    select << "select btcTxId, btcAmount, price, currency, party, counterparty, destAddress, creationtime, fee from btccontracts order by creationtime desc";
+    std::string selectstr = select.str();
+    int rc = sqlite3_exec(m_db, selectstr.c_str(), btccontracts_callback, this, &zErrMsg);
+    if( rc!=SQLITE_OK ){
+        std::cerr << "SQL error: " << zErrMsg << std::endl;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error( "SQL Error: Cannot load contract data" );
+    }
+    // stale allocations of TX a crash cut short are released by TmJournal::replay()
+}
+
+
+
+////////////////////////// Shutdown //////////////////////////////////////
+
+void ZrSqliteDB::closeTxLog()
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    RsStackMutex txMutex( m_tx_mutex );
+    closeTxLogFiles();
+}
+
+void ZrSqliteDB::configChanged( const std::string & key, const std::string & )
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    if( key != TXLOGPATH ) return;
+
+    std::cerr << "Zero Reserve: TX log moved, reopening" << std::endl;
+    RsStackMutex txMutex( m_tx_mutex );
+    closeTxLogFiles();
+    openTxLog();
+    m_txPartitionsDue = true;
+}
+
+void ZrSqliteDB::closeTxLogFiles()
+{
+    if( m_txJournal ){
+        m_txJournal->close();
+        delete m_txJournal;
+        m_txJournal = NULL;
+    }
+    if( m_txLog ){
+        sqlite3_close( m_txLog );
+        m_txLog = NULL;
+    }
+}
+
+void ZrSqliteDB::close()
+{
+    QMutexLocker dbLock( &m_db_mutex );
+    ZrConfig::Instance()->removeListener( this );
+    if( m_archiver ){
+        m_archiver->join();
+        delete m_archiver;
+        m_archiver = NULL;
+    }
+    sqlite3_close( m_db );
+    closeTxLog();
+}
@@ -0,0 +1,151 @@
+/*
+    This file is part of the Zero Reserve Plugin for Retroshare.
+
+    Zero Reserve is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Zero Reserve is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Zero Reserve.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ZRSQLITEDB_H
+#define ZRSQLITEDB_H
+
+#include "zrdb.h"
+#include "ZrConfig.h"
+
+#include <sqlite3.h>
+#include <QMutex>
+
+#include <string>
+#include <vector>
+#include <list>
+
+
+class TxJournal;
+class TxLogArchiver;
+
+/**
+  Database class to save and load friend data and payment info. Uses sqlite3
+  */
+
+class ZrSqliteDB : public ZrDB, public ZrConfig::Listener
+{
+    ZrSqliteDB();
+public:
+    /** @arg pathname: directory of the database and the default tx log */
+    ZrSqliteDB( const std::string & pathname );
+
+    /** open or create the database. Throws std::runtime_error on failure */
+    void init();
+
+    virtual void createPeerRecord( const Credit & peer_in );
+    virtual void deletePeerRecord( const std::string & uid, const Currency::CurrencySymbols & sym );
+    virtual void updatePeerCredit(const Credit & peer_in, const std::string & column, ZR::ZR_Number &value );
+    virtual void loadPeer( Credit & peer_out );
+    virtual void loadPeer( const std::string & id, Credit::CreditList & peer_out );
+    virtual bool peerExists( const Credit & peer_in );
+
+    virtual GrandTotal &loadGrandTotal( const std::string & currency );
+
+    virtual std::string getConfig( const std::string & key );
+
+    virtual void addOrder( OrderBook::Order * order );
+    virtual void loadOrders(OrderBook::OrderList *orders_out );
+    virtual void updateOrder( OrderBook::Order * order );
+    virtual void deleteOrder( OrderBook::Order * order );
+
+    virtual void close();
+
+    virtual void appendTx(const std::string & id, const std::string &currency, ZR::ZR_Number amount );
+    virtual void syncTxLog();
+    virtual void loadTxLog(std::list< TxLogItem > & txList );
+    virtual void loadTxRollups( std::list< TxRollup > & rollups );
+
+    virtual void beginTx();
+    virtual void commitTx();
+    virtual void rollbackTx();
+
+    virtual ZR::RetVal storeMyWallet( const ZR::WalletSecret &secret, unsigned int type, const std::string &nick );
+    virtual ZR::RetVal addPeerWallet( const ZR::BitcoinAddress & address, const std::string & nick );
+    virtual void loadMyWallets( std::vector< MyWallet > & wallets );
+
+    virtual void addBtcContract( BtcContract * contract );
+    virtual void rmBtcContract(const ZR::TransactionId & btcTxId , int party );
+    virtual bool btcContractExists( const ZR::TransactionId & btcTxId, int party );
+    virtual void loadBtcContracts();
+
+    // buffers for the sqlite callbacks
+    void addToOrderList( OrderBook::Order * order );
+    void peerRecordExists(){ m_peer_record_exists = true; }
+    void setPeerCredit( const std::string & credit, const std::string & our_credit, const std::string & balance , const std::string & allocation );
+    void addPeerCredit( Credit * credit );
+    void setConfigValue( const std::string & val ) { m_config_value = val; }
+    void addToGrandTotal( char ** cols );
+    void addToTxList( const TxLogItem & item );
+    void addToTxRollups( const TxRollup & rollup );
+    void addMyWallet( MyWallet & wallet );
+
+    void openTxLog();
+    void closeTxLog();
+
+    /** reopens the tx log when TXLOGPATH changes */
+    virtual void configChanged( const std::string & key, const std::string & value );
+
+protected:
+    virtual void storeConfig( const std::string & key, const std::string & value );
+
+private:
+    void setConfig( const std::string & key, const std::string & value );
+    void runQuery( const std::string & sql );
+    /** log if the planner would run a hot path statement as a full table scan
+     *  @throw std::runtime_error in debug builds, for the same reason */
+    void checkQueryPlans();
+
+    // tx log partitions, the callers hold m_tx_mutex
+    void closeTxLogFiles();
+    void rotateTxLog();
+    /** roll up all partitions before the current one and hand the old ones to the archiver.
+     *  Runs from syncTxLog(), the DB work stays off the appends. Callers hold m_db_mutex, too */
+    void closeTxPartitions();
+    void rollupTxPartition( const std::string & path, const std::string & partition );
+    bool txRollupExists( const std::string & partition );
+    void readTxPartition( const std::string & path, std::list< TxLogItem > & txList );
+
+
+private:
+    std::string m_pathname;
+
+    RsMutex m_peer_mutex;
+    RsMutex m_config_mutex;
+    RsMutex m_tx_mutex;
+    /** taken first by every method on the connection and held from beginTx() to commitTx() or rollbackTx() */
+    QMutex m_db_mutex;
+
+    sqlite3 *m_db;
+    sqlite3 *m_txLog;          // NULL if a journal without index is used
+    TxJournal * m_txJournal;   // NULL unless TXLOGPATH names a journal
+    std::string m_txPartition; // yyyyMM of the open tx log partition
+    bool m_txPartitionsDue;    // closeTxPartitions() on the next syncTxLog()
+    TxLogArchiver * m_archiver;
+
+    // buffers for the callbacks
+    bool m_peer_record_exists;
+    std::string m_config_value;
+    GrandTotal grandTotal;
+    Credit * m_credit;
+    Credit::CreditList * m_creditList;
+    std::list< TxLogItem > * m_txList;
+    std::list< TxRollup > * m_txRollups;
+    OrderBook::OrderList * m_orderList;
+    std::vector< MyWallet > * m_wallets;
+};
+
+#endif // ZRSQLITEDB_H
@@ -17,6 +17,7 @@
 
 #include "dbconfig.h"
 #include "zrdb.h"
+#include "ZrConfig.h"
 
 #include "QFileDialog"
 #include "QFileInfo"
@@ -42,9 +43,9 @@ void DBConfig::load()
 
 void DBConfig::editTxLog()
 {
-    QString txLogPath = QString::fromStdString( ZrDB::Instance()->getConfig( ZrDB::TXLOGPATH ) );
+    QString txLogPath = QString::fromStdString( ZrConfig::Instance()->txLogPath() );
     QFileInfo fileInfo( txLogPath );
-    QString newPath   = QFileDialog::getSaveFileName( 0, "Set the Transaction Log", fileInfo.absoluteDir().absolutePath(), "Transaction Log (*.tx)" );
+    QString newPath   = QFileDialog::getSaveFileName( 0, "Set the Transaction Log", fileInfo.absoluteDir().absolutePath(), "Transaction Log (*.tx);;Transaction Journal (*.txj)" );
     if( newPath.isEmpty() )
         return;
 
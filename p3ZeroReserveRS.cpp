@@ -20,34 +20,100 @@
 #include "Payment.h"
 #include "zrtypes.h"
 #include "Router.h"
+#include "CapacityProbe.h"
+#include "OrderAggregator.h"
+#include "AsyncWallet.h"
 #include "ZeroReservePlugin.h"
 #include "ZeroReserveDialog.h"
 #include "MyOrders.h"
 #include "BtcContract.h"
 #include "Currency.h"
+#include "ZrConfig.h"
+#include "zrdb.h"
+#include "ZrApiServer.h"
+#include "ZrShmFeed.h"
 
 #include "pqi/p3linkmgr.h"
 
+#include <QDateTime>
+
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <iterator>
 
 // after getting data from 3 peers, we believe we're complete
 static const int INIT_THRESHOLD = 3;
+const char * const p3ZeroReserveRS::ORDERS_EXTENDED = "orders2";
 
 p3ZeroReserveRS::p3ZeroReserveRS( RsPluginHandler *pgHandler, OrderBook * bids, OrderBook * asks, RsPeers* peers ) :
         RsPQIService( RS_SERVICE_TYPE_ZERORESERVE_PLUGIN, CONFIG_TYPE_ZERORESERVE_PLUGIN, 0, pgHandler ),
         m_bids(bids),
         m_asks(asks),
         m_peers(peers),
-        m_initialized( 0 )
+        m_initialized( 0 ),
+        m_sendQueue( this ),
+        m_gossip_mutex( "gossip_mutex" ),
+        m_gossipCoalesced( 0 ),
+        m_subscription_mutex( "subscription_mutex" )
 {
     addSerialType(new RsZeroReserveSerialiser());
     pgHandler->getLinkMgr()->addMonitor( this );
+
+    // the TX managers and the orders they point to are only safe on the service thread
+    m_scheduler.addJob( "orders", new ZrScheduler::MethodTask< p3ZeroReserveRS >( this, &p3ZeroReserveRS::timeoutOrders ),
+                        10000, 1000, 1000, ZrScheduler::SERVICE );
+    m_scheduler.addJob( "transactions", new ZrScheduler::FunctionTask( &TransactionManager::timeout ),
+                        10000, 1000, 1000, ZrScheduler::SERVICE );
+    m_scheduler.addJob( "match", new ZrScheduler::MethodTask< p3ZeroReserveRS >( this, &p3ZeroReserveRS::matchOrders ),
+                        10000, 1000, 1000, ZrScheduler::SERVICE );
+    m_scheduler.addJob( "routes", new ZrScheduler::MethodTask< p3ZeroReserveRS >( this, &p3ZeroReserveRS::timeoutRoutes ),
+                        10000, 2000, 1000 );
+    m_scheduler.addJob( "probes", new ZrScheduler::FunctionTask( &CapacityProbe::timeout ),
+                        5000, 1000, 1000 );
+    m_scheduler.addJob( "contracts", new ZrScheduler::FunctionTask( &BtcContract::pollContracts ),
+                        10000, 2000, 5000 );
+    m_scheduler.addJob( "queues", new ZrScheduler::MethodTask< p3ZeroReserveRS >( this, &p3ZeroReserveRS::logQueueStats ),
+                        10000, 0, 0 );
+    m_scheduler.addJob( "jobs", new ZrScheduler::MethodTask< p3ZeroReserveRS >( this, &p3ZeroReserveRS::logJobStats ),
+                        300000, 0, 0 );
+    // the journal syncs in batches, this bounds how long the end of a burst stays in the page cache
+    m_scheduler.addJob( "txlog", new ZrScheduler::MethodTask< p3ZeroReserveRS >( this, &p3ZeroReserveRS::syncTxLog ),
+                        1000, 0, 1000 );
 }
 
 
 void p3ZeroReserveRS::statusChange(const std::list< pqipeer > &plist)
 {
     std::cerr << "Zero Reserve: Status changed:" << std::endl;
+    for (std::list< pqipeer >::const_iterator it = plist.begin(); it != plist.end(); it++ ){
+        if( RS_PEER_DISCONNECTED & (*it).actions ){
+            m_sendQueue.clear( (*it).id );
+            RsStackMutex subscriptionMutex( m_subscription_mutex );
+            m_subscriptions.erase( (*it).id );
+            m_extendedPeers.erase( (*it).id );   // it may come back with another version
+        }
+    }
+    // first of all, so the friend knows which order items we understand before it sends any
+    for (std::list< pqipeer >::const_iterator it = plist.begin(); it != plist.end(); it++ ){
+        if( RS_PEER_CONNECTED & (*it).actions ){
+            RsZeroReserveMsgItem * item = new RsZeroReserveMsgItem( RsZeroReserveMsgItem::FEATURES, ORDERS_EXTENDED );
+            item->PeerId( (*it).id );
+            sendItem( item );
+        }
+    }
+    // ahead of the order book request, so the friend knows what to send
+    CurrencySet wanted;
+    wantedCurrencies( wanted );
+    {
+        RsStackMutex subscriptionMutex( m_subscription_mutex );
+        m_subscribed = wanted;
+    }
+    for (std::list< pqipeer >::const_iterator it = plist.begin(); it != plist.end(); it++ ){
+        if( RS_PEER_CONNECTED & (*it).actions ){
+            sendSubscription( (*it).id, wanted );
+        }
+    }
     if( m_initialized < INIT_THRESHOLD ){
         for (std::list< pqipeer >::const_iterator it = plist.begin(); it != plist.end(); it++ ){
             if( RS_PEER_CONNECTED & (*it).actions ){
@@ -83,33 +149,103 @@ int p3ZeroReserveRS::tick()
     if( !g_ZeroReservePlugin->isStopped() ) // something bad must have happened. Don't make it worse
         processIncoming();
 
-    janitor();
+    m_scheduler.start( ZrConfig::Instance()->getInteger( ZrDB::SCHEDULER_WORKERS ) );
+    m_scheduler.runServiceJobs();
+    AsyncWallet::Instance()->dispatch();
+    ZrShmFeed::Instance()->open( ZrConfig::Instance()->getString( ZrDB::SHM_FEED ), ZrConfig::Instance()->getInteger( ZrDB::SHM_FEED_LEVELS ) );
+    ZrApiServer::Instance()->listen( ZrConfig::Instance()->getString( ZrDB::API_SOCKET ) );
+    flushGossip();
+    m_sendQueue.flush();
     return 0;
 }
 
-void p3ZeroReserveRS::janitor()
+
+int p3ZeroReserveRS::sendItem( RsItem * item )
 {
-    static time_t lastCleanup = 0;
-    time_t t = time( 0 );
-    if( t - lastCleanup < 10 ) return;  // cleanup once in 10 sec
-    lastCleanup = t;
+    m_sendQueue.push( item );
+    return 1;
+}
 
+void p3ZeroReserveRS::timeoutOrders()
+{
     m_asks->timeoutOrders();
     m_bids->timeoutOrders();
 
-    TransactionManager::timeout();
-    BtcContract::pollContracts();
+    OrderAggregator::LevelList expired;
+    OrderAggregator::Instance()->timeout( expired );
+    for( OrderAggregator::LevelList::iterator it = expired.begin(); it != expired.end(); it++ ){
+        publishOrder( &(*it) );
+    }
+}
 
+void p3ZeroReserveRS::matchOrders()
+{
     MyOrders::Instance()->match();
 }
 
+void p3ZeroReserveRS::timeoutRoutes()
+{
+    Router::Instance()->timeout();
+}
+
+void p3ZeroReserveRS::logQueueStats()
+{
+    static unsigned long lastDropped = 0;
+    SendQueue::Stats stats;
+    m_sendQueue.getStats( stats );
+    if( stats.depth[ SendQueue::GOSSIP ] > SendQueue::GOSSIP_BUDGET || stats.dropped > lastDropped ){
+        lastDropped = stats.dropped;
+        std::cerr << "Zero Reserve: Send queues: TX " << stats.depth[ SendQueue::TX_CONTROL ] << ", credit " << stats.depth[ SendQueue::CREDIT ]
+                  << ", gossip " << stats.depth[ SendQueue::GOSSIP ] << " queued; " << stats.sent << " sent, "
+                  << stats.coalesced << " coalesced, " << stats.dropped << " dropped" << std::endl;
+    }
+
+    static unsigned long lastCoalesced = 0;
+    if( m_gossipCoalesced > lastCoalesced ){
+        std::cerr << "Zero Reserve: Collapsed " << m_gossipCoalesced - lastCoalesced << " order updates" << std::endl;
+        lastCoalesced = m_gossipCoalesced;
+    }
+
+    static unsigned long lastInboundDropped = 0;
+    InboundQueue::Stats inboundStats;
+    m_inboundQueue.getStats( inboundStats );
+    if( inboundStats.dropped > lastInboundDropped ){
+        lastInboundDropped = inboundStats.dropped;
+        std::cerr << "Zero Reserve: Inbound: " << inboundStats.received << " received, " << inboundStats.processed << " processed, "
+                  << inboundStats.deferred << " deferred, " << inboundStats.dropped << " dropped" << std::endl;
+    }
+}
+
+void p3ZeroReserveRS::logJobStats()
+{
+    ZrScheduler::StatsList stats;
+    m_scheduler.getStats( stats );
+    for( ZrScheduler::StatsList::const_iterator it = stats.begin(); it != stats.end(); it++ ){
+        if( (*it).runs == 0 ) continue;
+        std::cerr << "Zero Reserve: Job " << (*it).name << " every " << (*it).interval << " ms: " << (*it).runs << " runs, "
+                  << (*it).totalTime / (*it).runs << " ms average, " << (*it).maxTime << " ms max, "
+                  << (*it).overruns << " over deadline" << std::endl;
+    }
+}
+
+void p3ZeroReserveRS::syncTxLog()
+{
+    ZrDB::Instance()->syncTxLog();
+}
+
 void p3ZeroReserveRS::processIncoming()
 {
     RsItem *item = NULL;
-    while(NULL != (item = recvItem())){
+    for( unsigned int received = 0; received < InboundQueue::RECEIVE_BUDGET && NULL != (item = recvItem()); received++ ){
+        m_inboundQueue.push( item );
+    }
+
+    for( unsigned int work = 0; work < InboundQueue::WORK_BUDGET && NULL != (item = m_inboundQueue.next()); ){
+        work += InboundQueue::cost( item );   // a batch counts by its orders
         switch( item->PacketSubType() )
         {
         case RsZeroReserveItem::ZERORESERVE_ORDERBOOK_ITEM:
+        case RsZeroReserveItem::ZERORESERVE_ORDERBOOK_EXT_ITEM:
             handleOrder( dynamic_cast<RsZeroReserveOrderBookItem*>( item ) );
             break;
         case RsZeroReserveItem::ZERORESERVE_TX_INIT_ITEM:
@@ -125,29 +261,51 @@ void p3ZeroReserveRS::processIncoming()
         case RsZeroReserveItem::ZR_REMOTE_TX_ITEM:
             TransactionManager::handleTxItem( dynamic_cast<RSZRRemoteTxItem*>( item ) );
             break;
+        case RsZeroReserveItem::ZR_REMOTE_PROBE_ITEM:
+            CapacityProbe::handleItem( dynamic_cast<RSZRRemoteProbeItem*>( item ) );
+            break;
+        case RsZeroReserveItem::ZERORESERVE_ORDERBATCH_ITEM:
+            handleOrderBatch( dynamic_cast<RsZeroReserveOrderBatchItem*>( item ) );
+            break;
         default:
             std::cerr << "Zero Reserve: Received Item unknown" << std::endl;
         }
         delete item;
     }
+    m_inboundQueue.endTick();
 }
 
 
-void p3ZeroReserveRS::sendOrderBook( const std::string & uid )
+void p3ZeroReserveRS::sendOrderBook( const std::string & uid, const CurrencySet & currencies )
 {
-    {
-        RsStackMutex askMutex( m_asks->m_order_mutex );
-        for( OrderBook::OrderIterator it = m_asks->begin(); it != m_asks->end(); it++ ){
+    OrderAggregator * aggregator = OrderAggregator::Instance();
+    bool aggregate = aggregator->enabled();
+    OrderBook * books[] = { m_asks, m_bids };
+    for( int i = 0; i < 2; i++ ){
+        RsStackMutex orderMutex( books[ i ]->m_order_mutex );
+        for( OrderBook::OrderIterator it = books[ i ]->begin(); it != books[ i ]->end(); it++ ){
+            if( aggregate && !(*it)->m_isMyOrder ) continue;   // they go out as price levels below
+            std::string currency = Currency::currencySymbols[ (*it)->m_currency ];
+            if( !currencies.empty() && currencies.find( currency ) == currencies.end() ) continue;
+            if( !wants( uid, currency ) ) continue;
             sendOrder( uid, *it );
         }
     }
-    {
-        RsStackMutex bidMutex( m_bids->m_order_mutex );
-        for( OrderBook::OrderIterator it = m_bids->begin(); it != m_bids->end(); it++ ){
-            sendOrder( uid, *it );
+    if( aggregate ){
+        OrderAggregator::LevelList levels;
+        aggregator->getLevels( levels );
+        for( OrderAggregator::LevelList::iterator it = levels.begin(); it != levels.end(); it++ ){
+            std::string currency = Currency::currencySymbols[ (*it).m_currency ];
+            if( !currencies.empty() && currencies.find( currency ) == currencies.end() ) continue;
+            if( !wants( uid, currency ) ) continue;
+            sendOrder( uid, &(*it) );
         }
     }
-    sendItem( new RsZeroReserveMsgItem( RsZeroReserveMsgItem::SENT_ORDERBOOK, "" ) );
+    if( !currencies.empty() ) return;   // a top up, not the bootstrap
+
+    RsZeroReserveMsgItem * item = new RsZeroReserveMsgItem( RsZeroReserveMsgItem::SENT_ORDERBOOK, "" );
+    item->PeerId( uid );
+    sendItem( item );
 }
 
 
@@ -162,23 +320,172 @@ void p3ZeroReserveRS::handleMessage( RsZeroReserveMsgItem *item )
     case RsZeroReserveMsgItem::SENT_ORDERBOOK:
         m_initialized++;
         break;
+    case RsZeroReserveMsgItem::SUBSCRIBE:
+        handleSubscription( item );
+        break;
+    case RsZeroReserveMsgItem::FEATURES:
+        handleFeatures( item );
+        break;
     default:
         std::cerr << "Zero Reserve: Received unknown message" << std::endl;
     }
 }
 
 
+void p3ZeroReserveRS::wantedCurrencies( CurrencySet & currencies )
+{
+    for( int sym = 0; sym < Currency::INVALID; sym++ ){
+        try{
+            ZrDB::GrandTotal total;
+            bool cached;
+            {
+                RsStackMutex subscriptionMutex( m_subscription_mutex );
+                std::map< std::string, ZrDB::GrandTotal >::const_iterator it = m_grandTotals.find( Currency::currencySymbols[ sym ] );
+                cached = ( it != m_grandTotals.end() );
+                if( cached ) total = (*it).second;
+            }
+            if( !cached ){
+                // not under the mutex, a DB transaction may be waiting for it
+                total = ZrDB::Instance()->loadGrandTotal( Currency::currencySymbols[ sym ] );
+                RsStackMutex subscriptionMutex( m_subscription_mutex );
+                m_grandTotals[ Currency::currencySymbols[ sym ] ] = total;
+            }
+            if( total.credit > 0 || total.our_credit > 0 ){
+                currencies.insert( Currency::currencySymbols[ sym ] );
+            }
+        }
+        catch( std::runtime_error e ){
+            std::cerr << "Zero Reserve: Exception caught: " << e.what() << std::endl;
+        }
+    }
+}
+
+void p3ZeroReserveRS::sendSubscription( const std::string & uid, const CurrencySet & currencies )
+{
+    std::string msg;
+    for( CurrencySet::const_iterator it = currencies.begin(); it != currencies.end(); it++ ){
+        if( !msg.empty() ) msg += ':';
+        msg += *it;
+    }
+    RsZeroReserveMsgItem * item = new RsZeroReserveMsgItem( RsZeroReserveMsgItem::SUBSCRIBE, msg );
+    item->PeerId( uid );
+    sendItem( item );
+}
+
+void p3ZeroReserveRS::announceSubscriptions( const std::string & currency )
+{
+    {
+        RsStackMutex subscriptionMutex( m_subscription_mutex );
+        m_grandTotals.erase( currency );
+    }
+    CurrencySet wanted;
+    wantedCurrencies( wanted );
+    {
+        RsStackMutex subscriptionMutex( m_subscription_mutex );
+        if( wanted == m_subscribed ) return;
+        m_subscribed = wanted;
+    }
+
+    std::list< std::string > sendList;
+    m_peers->getOnlineList( sendList );
+    for( std::list< std::string >::const_iterator it = sendList.begin(); it != sendList.end(); it++ ){
+        if( (*it) == getOwnId() ) continue;
+        sendSubscription( *it, wanted );
+    }
+}
+
+void p3ZeroReserveRS::handleSubscription( RsZeroReserveMsgItem * item )
+{
+    CurrencySet currencies;
+    std::stringstream ss( item->getMessage() );
+    std::string currency;
+    while( getline( ss, currency, ':' ) ){
+        if( Currency::getCurrencyBySymbol( currency ) != Currency::INVALID ) currencies.insert( currency );
+    }
+
+    CurrencySet added;
+    {
+        RsStackMutex subscriptionMutex( m_subscription_mutex );
+        std::map< std::string, CurrencySet >::iterator it = m_subscriptions.find( item->PeerId() );
+        if( it != m_subscriptions.end() ){
+            std::set_difference( currencies.begin(), currencies.end(), (*it).second.begin(), (*it).second.end(),
+                                 std::inserter( added, added.begin() ) );
+        }
+        m_subscriptions[ item->PeerId() ] = currencies;
+    }
+    std::cerr << "Zero Reserve: " << item->PeerId() << " subscribed to " << currencies.size() << " currencies" << std::endl;
+
+    // a friend who just opened a credit line in a new currency wants its book now, not with the next updates
+    if( !added.empty() ){
+        sendOrderBook( item->PeerId(), added );
+    }
+}
+
+void p3ZeroReserveRS::handleFeatures( RsZeroReserveMsgItem * item )
+{
+    std::stringstream ss( item->getMessage() );
+    std::string feature;
+    bool orderExtensions = false;
+    while( getline( ss, feature, ':' ) ){
+        if( feature == ORDERS_EXTENDED ) orderExtensions = true;
+    }
+    std::cerr << "Zero Reserve: " << item->PeerId() << ( orderExtensions ? " understands" : " does not understand" ) << " extended orders" << std::endl;
+
+    RsStackMutex subscriptionMutex( m_subscription_mutex );
+    if( orderExtensions ){
+        m_extendedPeers.insert( item->PeerId() );
+    }
+    else {
+        m_extendedPeers.erase( item->PeerId() );
+    }
+}
+
+bool p3ZeroReserveRS::extended( const std::string & uid )
+{
+    RsStackMutex subscriptionMutex( m_subscription_mutex );
+    return m_extendedPeers.find( uid ) != m_extendedPeers.end();
+}
+
+bool p3ZeroReserveRS::wants( const std::string & uid, const std::string & currency )
+{
+    RsStackMutex subscriptionMutex( m_subscription_mutex );
+    std::map< std::string, CurrencySet >::const_iterator it = m_subscriptions.find( uid );
+    if( it == m_subscriptions.end() ) return true;
+    return (*it).second.find( currency ) != (*it).second.end();
+}
+
+
+bool p3ZeroReserveRS::forwardOrder( OrderBook::Order * order )
+{
+    ZrConfig * config = ZrConfig::Instance();
+    if( order->m_hops >= (unsigned int)config->getInteger( ZrDB::MAX_ORDER_HOPS ) ) return false;
+
+    // removals and replacements follow the order wherever it went
+    if( order->m_purpose == OrderBook::Order::FILLED || order->m_purpose == OrderBook::Order::CANCEL ) return true;
+    if( order->m_purpose == OrderBook::Order::REPLACE ) return true;
+
+    OrderBook * book = ( order->m_orderType == OrderBook::Order::ASK )? m_asks : m_bids;
+    return book->isCompetitive( order, config->getNumber( ZrDB::ORDER_BAND ), config->getInteger( ZrDB::ORDER_TOP_LEVELS ) );
+}
+
+
 void p3ZeroReserveRS::handleOrder(RsZeroReserveOrderBookItem *item)
 {
-    std::cerr << "Zero Reserve: Received Orderbook Item" << std::endl;
     ZR::RetVal result;
-    item->print( std::cerr );
     OrderBook::Order * order = new OrderBook::Order( *( item->getOrder() ) );
 
-    if( !Router::Instance()->hasRoute( order->m_order_id ) ){
-        Router::Instance()->addRoute( order->m_order_id, item->PeerId() );
+    // one of my price levels coming back around a loop
+    if( OrderAggregator::Instance()->isLevel( order->m_order_id ) ){
+        delete order;
+        return;
     }
 
+    order->m_gateway = item->PeerId();
+
+    // learn every gateway the order arrives through, they are the alternatives if a TX fails
+    order->m_hops++;
+    Router::Instance()->addRoute( order->m_order_id, item->PeerId(), order->m_timeStamp + OrderBook::Order::timeout, order->m_hops );
+
     if( order->m_orderType == OrderBook::Order::ASK ){
         result = m_asks->processOrder( order );
     }
@@ -186,10 +493,30 @@ void p3ZeroReserveRS::handleOrder(RsZeroReserveOrderBookItem *item)
         result = m_bids->processOrder( order );
     }
 
-    if( ZR::ZR_SUCCESS == result ){
-        publishOrder( order, item );
+    if( ZR::ZR_SUCCESS != result ){
+        delete order;
+        return;
     }
-    else{
+
+    if( forwardOrder( order ) ){
+        OrderAggregator * aggregator = OrderAggregator::Instance();
+        if( aggregator->enabled() ){
+            OrderBook::Order level;
+            if( order->m_purpose == OrderBook::Order::REPLACE && !order->m_replaces.empty() ){
+                OrderBook::Order replaced( *order );   // leaves its level, if it had one
+                replaced.m_order_id = order->m_replaces;
+                replaced.m_purpose = OrderBook::Order::CANCEL;
+                if( aggregator->update( replaced, level ) ) publishOrder( &level, item );
+            }
+            if( aggregator->update( *order, level ) ) publishOrder( &level, item );
+        }
+        else {
+            publishOrder( order, item );
+        }
+    }
+
+    // the book keeps new orders and updates, removals were only needed for forwarding
+    if( order->m_purpose == OrderBook::Order::FILLED || order->m_purpose == OrderBook::Order::CANCEL ){
         delete order;
     }
 }
@@ -203,6 +530,7 @@ void p3ZeroReserveRS::handleCredit(RsZeroReserveCreditItem *item)
 
     if( ourCredit.m_our_credit != otherCredit->m_our_credit ){
         otherCredit->updateOurCredit();
+        announceSubscriptions( otherCredit->m_currency );
     }
     if( -ourCredit.m_balance != otherCredit->m_balance ){
         g_ZeroReservePlugin->placeMsg( std::string( "Different balance: " ) + rsPeers->getPeerName( otherCredit->m_id ) + " has " + otherCredit->m_balance.toDecimalStdString()
@@ -226,7 +554,18 @@ bool p3ZeroReserveRS::sendCredit( Credit * credit )
 bool p3ZeroReserveRS::sendOrder( const std::string& peer_id, OrderBook::Order * order )
 {
     std::cerr << "Zero Reserve: Sending order to " << peer_id << std::endl;
-    RsZeroReserveOrderBookItem * item = new RsZeroReserveOrderBookItem( *order );
+    // peers which never announced the extensions only parse the original layout
+    bool extensions = extended( peer_id );
+    if( !extensions && order->m_purpose == OrderBook::Order::REPLACE ){
+        // they know no REPLACE, the same as a CANCEL of the old order and the new one
+        OrderBook::Order cancel( *order );
+        cancel.m_order_id = order->m_replaces;
+        cancel.m_purpose = OrderBook::Order::CANCEL;
+        OrderBook::Order replacement( *order );
+        replacement.m_purpose = OrderBook::Order::NEW;
+        return sendOrder( peer_id, &cancel ) && sendOrder( peer_id, &replacement );
+    }
+    RsZeroReserveOrderBookItem * item = new RsZeroReserveOrderBookItem( *order, extensions );
     if(!item){
             std::cerr << "Cannot allocate RsZeroReserveOrderBookItem !" << std::endl;
             return false ;
@@ -238,23 +577,126 @@ bool p3ZeroReserveRS::sendOrder( const std::string& peer_id, OrderBook::Order *
 
 
 void p3ZeroReserveRS::publishOrder( OrderBook::Order * order, RsZeroReserveOrderBookItem * item )
+{
+    std::set< std::string > from;
+    if( item ) from.insert( item->PeerId() );
+    qint64 window = ZrConfig::Instance()->getInteger( ZrDB::GOSSIP_COALESCE_MS );
+    if( window <= 0 ){
+        sendToPeers( *order, from );
+        return;
+    }
+
+    // collect the updates of an order for a while, only the latest state goes out
+    PendingGossip replace;
+    {
+        RsStackMutex gossipMutex( m_gossip_mutex );
+        GossipList::iterator it = m_gossip.find( order->m_order_id );
+        if( it != m_gossip.end() ){
+            OrderBook::Order newer( *order );
+            if( (*it).second.m_order.mergeInto( newer ) ){
+                (*it).second.m_order = newer;
+                (*it).second.m_from.insert( from.begin(), from.end() );
+                m_gossipCoalesced++;
+                return;
+            }
+            replace = (*it).second;   // the order is gone already, the REPLACE goes out first
+            m_gossip.erase( it );
+        }
+        PendingGossip & pending = m_gossip[ order->m_order_id ];
+        pending.m_order = *order;
+        pending.m_from = from;
+        pending.m_queued = QDateTime::currentMSecsSinceEpoch();
+    }
+    if( !replace.m_order.m_order_id.empty() ) sendToPeers( replace.m_order, replace.m_from );
+}
+
+void p3ZeroReserveRS::flushGossip()
+{
+    qint64 window = ZrConfig::Instance()->getInteger( ZrDB::GOSSIP_COALESCE_MS );
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    std::list< PendingGossip > due;
+    {
+        RsStackMutex gossipMutex( m_gossip_mutex );
+        for( GossipList::iterator it = m_gossip.begin(); it != m_gossip.end(); ){
+            if( now - (*it).second.m_queued >= window ){
+                due.push_back( (*it).second );
+                m_gossip.erase( it++ );
+            }
+            else {
+                it++;
+            }
+        }
+    }
+    for( std::list< PendingGossip >::iterator it = due.begin(); it != due.end(); it++ ){
+        sendToPeers( (*it).m_order, (*it).m_from );
+    }
+}
+
+void p3ZeroReserveRS::sendToPeers( OrderBook::Order & order, const std::set< std::string > & from )
 {
     std::list< std::string > sendList;
     m_peers->getOnlineList(sendList);
     for(std::list< std::string >::const_iterator it = sendList.begin(); it != sendList.end(); it++ ){
         if( (*it) == getOwnId() ) continue;
-        if( item && (*it) == item->PeerId() ) continue; // don't return to sender
+        if( from.find( *it ) != from.end() ) continue; // don't return to sender
+        if( !routable( *it, order ) ) continue;
+        sendOrder( *it, &order );
+    }
+}
 
-        Credit c( *it, Currency::currencySymbols[ order->m_currency ] );
-        c.loadPeer();
-        // do not route orders we cannot at least fill to 10%
-        if( order->m_orderType == OrderBook::Order::ASK && ( order->m_purpose != OrderBook::Order::CANCEL || order->m_purpose != OrderBook::Order::FILLED ) ){
-            if( c.getMyAvailable() < order->m_amount * 0.1 ) continue;
-        }
-        else{
-            if( c.getPeerAvailable() < order->m_amount * 0.1 ) continue;
+bool p3ZeroReserveRS::routable( const std::string & uid, const OrderBook::Order & order )
+{
+    if( !wants( uid, Currency::currencySymbols[ order.m_currency ] ) ) return false;
+
+    Credit c( uid, Currency::currencySymbols[ order.m_currency ] );
+    c.loadPeer();
+    // do not route orders we cannot at least fill to 10%
+    if( order.m_orderType == OrderBook::Order::ASK && ( order.m_purpose != OrderBook::Order::CANCEL || order.m_purpose != OrderBook::Order::FILLED ) ){
+        return c.getMyAvailable() >= order.m_amount * 0.1;
+    }
+    return c.getPeerAvailable() >= order.m_amount * 0.1;
+}
+
+void p3ZeroReserveRS::publishOrders( const std::vector< OrderBook::Order * > & orders )
+{
+    std::list< std::string > sendList;
+    m_peers->getOnlineList(sendList);
+    for(std::list< std::string >::const_iterator it = sendList.begin(); it != sendList.end(); it++ ){
+        if( (*it) == getOwnId() ) continue;
+        bool batches = extended( *it );   // older peers get them one by one
+
+        RsZeroReserveOrderBatchItem::OrderVector batch;
+        for( std::vector< OrderBook::Order * >::const_iterator orderIt = orders.begin(); orderIt != orders.end(); orderIt++ ){
+            if( !routable( *it, **orderIt ) ) continue;
+            if( !batches ){
+                sendOrder( *it, *orderIt );
+                continue;
+            }
+            batch.push_back( **orderIt );
+            if( batch.size() < RsZeroReserveOrderBatchItem::MAX_ORDERS ) continue;
+            sendOrders( *it, batch );
+            batch.clear();
         }
-        sendOrder( *it, order );
+        if( !batch.empty() ) sendOrders( *it, batch );
+    }
+}
+
+void p3ZeroReserveRS::sendOrders( const std::string & peer_id, const RsZeroReserveOrderBatchItem::OrderVector & orders )
+{
+    std::cerr << "Zero Reserve: Sending " << orders.size() << " orders to " << peer_id << std::endl;
+    RsZeroReserveOrderBatchItem * item = new RsZeroReserveOrderBatchItem( orders );
+    item->PeerId( peer_id );
+    sendItem( item );
+}
+
+void p3ZeroReserveRS::handleOrderBatch( RsZeroReserveOrderBatchItem * item )
+{
+    const RsZeroReserveOrderBatchItem::OrderVector & orders = item->getOrders();
+    for( RsZeroReserveOrderBatchItem::OrderVector::const_iterator it = orders.begin(); it != orders.end(); it++ ){
+        OrderBook::Order order( *it );
+        RsZeroReserveOrderBookItem single( order );   // each goes its own way from here
+        single.PeerId( item->PeerId() );
+        handleOrder( &single );
     }
 }
 
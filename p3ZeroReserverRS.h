@@ -25,6 +25,15 @@
 #include "plugins/rspqiservice.h"
 #include "pqi/pqimonitor.h"
 #include "RSZRRemoteItems.h"
+#include "SendQueue.h"
+#include "InboundQueue.h"
+#include "ZrScheduler.h"
+#include "zrdb.h"
+
+#include "util/rsthreads.h"
+
+#include <map>
+#include <set>
 
 
 
@@ -40,30 +49,92 @@ public:
 
     virtual int tick();
 
+    /** queue an item for sending, @see SendQueue. Takes ownership */
+    int sendItem( RsItem * item );
+    void getSendStats( const std::string & peerId, SendQueue::Stats & stats ){ m_sendQueue.getStats( peerId, stats ); }
+    void getReceiveStats( const std::string & peerId, InboundQueue::Stats & stats ){ m_inboundQueue.getStats( peerId, stats ); }
+
     bool sendOrder( const std::string& peer_id, OrderBook::Order * order );
     bool sendCredit( Credit * credit );
+    /** send an order to all friends, after GOSSIP_COALESCE_MS. @arg item: the item it came with, if any */
     void publishOrder( OrderBook::Order * order, RsZeroReserveOrderBookItem * item = NULL );
+    /** send my orders to all friends right away, in one item per friend. @see MyOrders::placeOrders */
+    void publishOrders( const std::vector< OrderBook::Order * > & orders );
     std::string getOwnId(){ return m_peers->getOwnId(); }
+    /** tell friends which currencies we want orders in, if that changed. Call it after credit changes in currency */
+    void announceSubscriptions( const std::string & currency );
     virtual void statusChange(const std::list<pqipeer> &plist);
+    /** run task once on the service thread, in the next tick. Takes ownership */
+    void post( ZrScheduler::Task * task ){ m_scheduler.post( task ); }
 
 private:
 
     void processIncoming();
-    void janitor();
+    // periodic jobs, see ZrScheduler
+    void timeoutOrders();
+    void matchOrders();
+    void timeoutRoutes();
+    void logQueueStats();
+    void logJobStats();
+    void syncTxLog();
     void sendPackets();
     void handleOrder( RsZeroReserveOrderBookItem *item );
+    void handleOrderBatch( RsZeroReserveOrderBatchItem *item );
     void handleCredit( RsZeroReserveCreditItem *item );
     void handleMessage( RsZeroReserveMsgItem *item );
-
-
-    /** help our friends to bootstrap the order book */
-    void sendOrderBook(const std::string &uid);
+    void flushGossip();
+    /** propagation policy: hop limit and distance from the top of the book */
+    bool forwardOrder( OrderBook::Order * order );
+    /** @param from the peers which sent us the order, it does not go back to them */
+    void sendToPeers( OrderBook::Order & order, const std::set< std::string > & from );
+    /** false if the peer does not want the order or we cannot carry enough of it */
+    bool routable( const std::string & uid, const OrderBook::Order & order );
+    void sendOrders( const std::string & peer_id, const RsZeroReserveOrderBatchItem::OrderVector & orders );
+
+
+    /** help our friends to bootstrap the order book. @arg currencies: limit to these, empty for all subscribed */
+    void sendOrderBook(const std::string &uid, const std::set< std::string > & currencies = std::set< std::string >() );
+
+    typedef std::set< std::string > CurrencySet;
+    /** currencies we have credit lines in */
+    void wantedCurrencies( CurrencySet & currencies );
+    void sendSubscription( const std::string & uid, const CurrencySet & currencies );
+    void handleSubscription( RsZeroReserveMsgItem * item );
+    /** false if the peer subscribed to other currencies. Peers which never subscribed get everything */
+    bool wants( const std::string & uid, const std::string & currency );
+    void handleFeatures( RsZeroReserveMsgItem * item );
+    /** the peer understands ZERORESERVE_ORDERBOOK_EXT_ITEM and order batches, else it gets the original order items */
+    bool extended( const std::string & uid );
+
+    static const char * const ORDERS_EXTENDED;   // feature: extended order items and batches
 
 private:
     OrderBook * m_bids;
     OrderBook * m_asks;
     RsPeers * m_peers;
     int m_initialized;
+    SendQueue m_sendQueue;
+    InboundQueue m_inboundQueue;
+
+    class PendingGossip
+    {
+    public:
+        OrderBook::Order m_order;   // the latest state
+        std::set< std::string > m_from;   // every peer which sent one of the updates
+        qint64 m_queued;            // time of the first update
+    };
+    typedef std::map< OrderBook::Order::ID, PendingGossip > GossipList;
+    GossipList m_gossip;
+    RsMutex m_gossip_mutex;
+    unsigned long m_gossipCoalesced;
+
+    std::map< std::string, CurrencySet > m_subscriptions;    // what our friends want
+    CurrencySet m_subscribed;                               // what we told them we want
+    std::map< std::string, ZrDB::GrandTotal > m_grandTotals; // per currency, dropped when its credit changes
+    std::set< std::string > m_extendedPeers;                // announced ORDERS_EXTENDED
+    RsMutex m_subscription_mutex;
+
+    ZrScheduler m_scheduler;    // last, its workers stop before the rest goes away
 };
 
 #endif // P3ZERORESERVERRS_H
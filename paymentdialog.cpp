@@ -55,8 +55,7 @@ void PaymentDialog::payTo()
 {
     Currency::CurrencySymbols sym = Currency::getCurrencyByName( ui->currencySelector->currentText().toStdString() );
     Payment * payment = new PaymentSpender( m_payee, ZR::ZR_Number::fromDecimalString( ui->amount->text() ), Currency::currencySymbols[ sym ], Payment::PAYMENT );
-    TmLocalCoordinator * tm = new TmLocalCoordinator( payment );
-    if( ! tm->init() ) delete tm;
+    TransactionManager::start( new TmLocalCoordinator( payment ) );
 }
 
 void PaymentDialog::loadAvailableFunds()
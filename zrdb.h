@@ -24,11 +24,11 @@
 
 #include "util/rsthreads.h"
 
-#include <sqlite3.h>
 #include <QDateTime>
 
 #include <string>
 #include <vector>
+#include <list>
 
 #include <stdlib.h>
 
@@ -36,13 +36,15 @@
 class BtcContract;
 
 /**
-  Database class to save and load friend data and payment info. Uses sqlite3
-  */
+ * @brief Interface to the persistent storage of friend data, orders, wallets, contracts and payment info
+ *
+ * The default implementation is @see ZrSqliteDB. Start with ZERORESERVE_DB=memory in the environment
+ * to run the engine on a @see ZrMemoryDB without disk I/O, e.g. for benchmarks. Other backends
+ * can be installed with setInstance() before the first call to Instance().
+ */
 
 class ZrDB
 {
-    ZrDB();
-    void init();
 public:
 
     typedef struct {
@@ -61,48 +63,57 @@ public:
          QDateTime timestamp;
     } TxLogItem;
 
+    typedef struct {
+         std::string partition;   // yyyyMM of a closed tx log partition
+         QString id;
+         QString currency;
+         ZR::ZR_Number m_amount;
+         int count;
+    } TxRollup;
+
     typedef struct {
          ZR::WalletSecret secret;
          std::string nick;
          int type;
     } MyWallet;
 
+    virtual ~ZrDB(){}
+
     static ZrDB * Instance();
-    void createPeerRecord( const Credit & peer_in );
-    void deletePeerRecord( const std::string & uid, const Currency::CurrencySymbols & sym );
-    void updatePeerCredit(const Credit & peer_in, const std::string & column, ZR::ZR_Number &value );
-    void loadPeer( Credit & peer_out );
-    void loadPeer( const std::string & id, Credit::CreditList & peer_out );
-    bool peerExists( const Credit & peer_in );
+    /** replace the storage backend, takes ownership. Call it before anybody holds on to the old instance */
+    static void setInstance( ZrDB * db );
 
-    GrandTotal &loadGrandTotal( const std::string & currency );
+    virtual void createPeerRecord( const Credit & peer_in ) = 0;
+    virtual void deletePeerRecord( const std::string & uid, const Currency::CurrencySymbols & sym ) = 0;
+    virtual void updatePeerCredit(const Credit & peer_in, const std::string & column, ZR::ZR_Number &value ) = 0;
+    virtual void loadPeer( Credit & peer_out ) = 0;
+    virtual void loadPeer( const std::string & id, Credit::CreditList & peer_out ) = 0;
+    virtual bool peerExists( const Credit & peer_in ) = 0;
 
-    std::string getConfig( const std::string & key );
-    void updateConfig( const std::string & key, const std::string & value );
+    virtual GrandTotal &loadGrandTotal( const std::string & currency ) = 0;
 
-    void addOrder( OrderBook::Order * order );
-    void loadOrders(OrderBook::OrderList *orders_out );
-    void updateOrder( OrderBook::Order * order );
-    void deleteOrder( OrderBook::Order * order );
-    void addToOrderList( OrderBook::Order * order );
+    virtual std::string getConfig( const std::string & key ) = 0;
+    /** store the value and notify the @see ZrConfig listeners */
+    void updateConfig( const std::string & key, const std::string & value );
 
-    void close();
+    virtual void addOrder( OrderBook::Order * order ) = 0;
+    virtual void loadOrders(OrderBook::OrderList *orders_out ) = 0;
+    virtual void updateOrder( OrderBook::Order * order ) = 0;
+    virtual void deleteOrder( OrderBook::Order * order ) = 0;
 
-    void peerRecordExists(){ m_peer_record_exists = true; }
-    void setPeerCredit( const std::string & credit, const std::string & our_credit, const std::string & balance , const std::string & allocation );
-    void addPeerCredit( Credit * credit );
-    void setConfigValue( const std::string & val ) { m_config_value = val; }
-    void addToGrandTotal( char ** cols );
-    void addToTxList( const TxLogItem & item );
+    virtual void close() = 0;
 
-    void openTxLog();
-    void closeTxLog();
-    void appendTx(const std::string & id, const std::string &currency, ZR::ZR_Number amount );
-    void loadTxLog(std::list< TxLogItem > & txList );
+    virtual void appendTx(const std::string & id, const std::string &currency, ZR::ZR_Number amount ) = 0;
+    /** put appends which are still buffered on disk and roll up closed partitions, called periodically */
+    virtual void syncTxLog() = 0;
+    /** load the transactions of the recent partitions, newest first */
+    virtual void loadTxLog(std::list< TxLogItem > & txList ) = 0;
+    /** per peer and currency sums of the older partitions */
+    virtual void loadTxRollups( std::list< TxRollup > & rollups ) = 0;
 
-    void beginTx();
-    void commitTx();
-    void rollbackTx();
+    virtual void beginTx() = 0;
+    virtual void commitTx() = 0;
+    virtual void rollbackTx() = 0;
 
 
     // TODO void logPayment() const;
@@ -111,46 +122,50 @@ public:
     // TODO: void restore() const;
 
 ////////// Bitcoin Wallet //////////////
-    ZR::RetVal storeMyWallet( const ZR::WalletSecret &secret, unsigned int type, const std::string &nick );
-    ZR::RetVal addPeerWallet( const ZR::BitcoinAddress & address, const std::string & nick );
-    void loadMyWallets( std::vector< MyWallet > & wallets );
-    void addMyWallet( MyWallet & wallet );
+    virtual ZR::RetVal storeMyWallet( const ZR::WalletSecret &secret, unsigned int type, const std::string &nick ) = 0;
+    virtual ZR::RetVal addPeerWallet( const ZR::BitcoinAddress & address, const std::string & nick ) = 0;
+    virtual void loadMyWallets( std::vector< MyWallet > & wallets ) = 0;
 
-    void addBtcContract( BtcContract * contract );
-    void rmBtcContract(const ZR::TransactionId & btcTxId , int party );
-    void loadBtcContracts();
+    virtual void addBtcContract( BtcContract * contract ) = 0;
+    virtual void rmBtcContract(const ZR::TransactionId & btcTxId , int party ) = 0;
+    virtual bool btcContractExists( const ZR::TransactionId & btcTxId, int party ) = 0;
+    virtual void loadBtcContracts() = 0;
 
-private:
-    void setConfig( const std::string & key, const std::string & value );
-    void runQuery( const std::string & sql );
+protected:
+    ZrDB(){}
 
+    virtual void storeConfig( const std::string & key, const std::string & value ) = 0;
 
 private:
-    RsMutex m_peer_mutex;
-    RsMutex m_config_mutex;
-    RsMutex m_tx_mutex;
-
-    sqlite3 *m_db;
-    sqlite3 *m_txLog;
-
-    // buffers for the callbacks
-    bool m_peer_record_exists;
-    std::string m_config_value;
-    GrandTotal grandTotal;    
-    Credit * m_credit;
-    Credit::CreditList * m_creditList;
-    std::list< TxLogItem > * m_txList;
-    OrderBook::OrderList * m_orderList;
-    std::vector< MyWallet > * m_wallets;
-
     static ZrDB * instance;
     static RsMutex creation_mutex;
 
 public: // config parameters
     static const char * const TXLOGPATH;
+    static const char * const TXLOG_INDEX;      // "0" disables the SQLite index of a journal
+    static const char * const TXLOG_ARCHIVE;    // "0" keeps old tx log partitions uncompressed
     static const char * const DB_VERSION;       // integer
+    static const char * const TXLOG_ROLLED_UP;  // yyyyMM, the tx log partitions up to it are rolled up. Internal
     static const char * const MINIMUM_FEE;
     static const char * const PERCENTAGE_FEE;
+    static const char * const ROUTING_TABLE_SIZE;   // integer, maximum number of routes
+    static const char * const GOSSIP_COALESCE_MS;   // integer, window to collapse updates of an order, 0 to publish at once
+    static const char * const MAX_ORDER_HOPS;       // integer, orders are not forwarded beyond this distance
+    static const char * const ORDER_BAND;           // number, forward orders within this fraction of the best price, 0 for off
+    static const char * const ORDER_TOP_LEVELS;     // integer, forward orders within the best price levels, 0 for off
+    static const char * const MAX_ORDERS;           // integer, orders on each side of the book, 0 for no limit
+    static const char * const MAX_ORDERS_PER_GATEWAY; // integer, orders one friend may have on each side of the book
+    static const char * const MAX_ORDERS_PER_CURRENCY; // integer, orders in one currency on each side of the book
+    static const char * const ORDER_AGGREGATION;    // integer, advertise price levels instead of the orders of others, 0 for off
+    static const char * const SCHEDULER_WORKERS;    // integer, threads for the background jobs, read at startup
+    static const char * const API_SOCKET;           // string, Unix socket of the trading API, a file name goes in the data dir. Empty for off
+    static const char * const SHM_FEED;             // string, POSIX shared memory name of the market data feed, e.g. /zeroreserve. Empty for off
+    static const char * const SHM_FEED_LEVELS;      // integer, price levels per currency and side in the feed, read at startup
+
+    static const char * const BACKEND_ENV;          // environment variable, "memory" selects the ZrMemoryDB
+
+private:
+    static bool isMemoryBackend();
 };
 
 #endif // ZRDB_H